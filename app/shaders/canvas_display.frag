@@ -0,0 +1,104 @@
+#version 430
+
+// Draws the canvas, optionally with the in-progress stroke blended on top.
+// The blend modes here must match the tools' composite shaders, since
+// that's what the stroke will look like once it's committed.
+#define OVERLAY_NONE 0
+// .r of u_overlay is a coverage mask for u_overlayColor (paint_composite)
+#define OVERLAY_MASK 1
+// u_overlay is a straight-alpha color buffer (splatter_composite)
+#define OVERLAY_BUFFER 2
+
+layout(location = 2) uniform vec4 u_tint;
+layout(location = 3) uniform sampler2D u_overlay;
+layout(location = 4) uniform int u_overlayMode;
+layout(location = 5) uniform vec4 u_overlayColor;
+// Set for single channel canvases. The canvas is already swizzled to gray,
+// but the overlay isn't, and only its red channel will make it in.
+layout(location = 6) uniform bool u_grayscale;
+
+// The virtual canvas, see VirtualCanvas. Every shader which reads the canvas
+// has a copy of this block, keep them in sync.
+const int CANVAS_TILE_SIZE = 512;
+layout(location = 7) uniform sampler2DArray u_canvasAtlas;
+layout(location = 8) uniform isampler2D u_canvasLayers;
+layout(location = 9) uniform sampler2D u_canvasFills;
+layout(location = 10) uniform ivec2 u_canvasSize;
+// Canvas pixel of u_overlay's first texel, it only covers the stroke
+layout(location = 11) uniform ivec2 u_overlayOrigin;
+// `coords` must be within the canvas
+vec4 canvas_fetch(ivec2 coords) {
+	ivec2 tile = coords / CANVAS_TILE_SIZE;
+	int layer = texelFetch(u_canvasLayers, tile, 0).r;
+	if (layer < 0) return texelFetch(u_canvasFills, tile, 0);
+	return texelFetch(u_canvasAtlas, ivec3(coords % CANVAS_TILE_SIZE, layer), 0);
+}
+
+layout(location = 0) in vec2 v_texCoord;
+layout(location = 0) out vec4 o_color;
+
+// canvas_fetch, but from mip `level` of the atlas (see VirtualCanvas).
+// Uniform tiles are the same at every level.
+vec4 canvas_fetch_level(ivec2 coords, int level) {
+	int tileSize = CANVAS_TILE_SIZE >> level;
+	ivec2 tile = coords / tileSize;
+	int layer = texelFetch(u_canvasLayers, tile, 0).r;
+	if (layer < 0) return texelFetch(u_canvasFills, tile, 0);
+	return texelFetch(u_canvasAtlas, ivec3(coords % tileSize, layer), level);
+}
+
+// Bilinear filtering within mip `level`
+vec4 canvas_bilinear(vec2 texCoord, int level) {
+	int scale = 1 << level;
+	ivec2 hi = (u_canvasSize + scale - 1) / scale - 1;
+	vec2 pos = texCoord * vec2(u_canvasSize) / float(scale) - 0.5;
+	ivec2 base = ivec2(floor(pos));
+	vec2 f = pos - vec2(base);
+	vec4 bl = canvas_fetch_level(clamp(base, ivec2(0), hi), level);
+	vec4 br = canvas_fetch_level(clamp(base + ivec2(1, 0), ivec2(0), hi), level);
+	vec4 tl = canvas_fetch_level(clamp(base + ivec2(0, 1), ivec2(0), hi), level);
+	vec4 tr = canvas_fetch_level(clamp(base + ivec2(1, 1), ivec2(0), hi), level);
+	return mix(mix(bl, br, f.x), mix(tl, tr, f.x), f.y);
+}
+
+// Tiles don't have borders for the hardware to filter across, so this
+// does it by hand: nearest when zoomed in, trilinear when zoomed out.
+vec4 canvas_sample(vec2 texCoord) {
+	vec2 footprint = fwidth(texCoord * vec2(u_canvasSize));
+	float lod = log2(max(footprint.x, footprint.y));
+	if (lod <= 0.0) {
+		vec2 pos = texCoord * vec2(u_canvasSize) - 0.5;
+		return canvas_fetch(clamp(ivec2(round(pos)), ivec2(0), u_canvasSize - 1));
+	}
+	// The last level is 1x1 per tile, there's nothing past it
+	const int LAST_LEVEL = 9;
+	lod = min(lod, float(LAST_LEVEL));
+	int level = int(floor(lod));
+	vec4 fine = canvas_bilinear(texCoord, level);
+	if (level == LAST_LEVEL) return fine;
+	return mix(fine, canvas_bilinear(texCoord, level + 1), lod - float(level));
+}
+
+// The overlay at v_texCoord, clear outside of what it covers
+vec4 overlay_sample() {
+	vec2 pos = v_texCoord * vec2(u_canvasSize) - vec2(u_overlayOrigin);
+	vec2 uv = pos / vec2(textureSize(u_overlay, 0));
+	// Sampled unconditionally, for the derivatives
+	vec4 overlay = texture(u_overlay, uv);
+	if (any(lessThan(uv, vec2(0))) || any(greaterThan(uv, vec2(1)))) return vec4(0);
+	return overlay;
+}
+
+void main(){
+	vec4 canvas = canvas_sample(v_texCoord);
+	if (u_overlayMode == OVERLAY_MASK) {
+		float fac = overlay_sample().r * u_overlayColor.a;
+		canvas = mix(canvas, vec4(u_overlayColor.rgb, 1), fac);
+	}
+	else if (u_overlayMode == OVERLAY_BUFFER) {
+		vec4 buf = overlay_sample();
+		canvas = mix(canvas, vec4(buf.rgb, 1), buf.a);
+	}
+	if (u_grayscale) canvas.rgb = canvas.rrr;
+	o_color = u_tint * canvas;
+}
@@ -0,0 +1,11 @@
+#version 430
+
+layout(location = 1) uniform sampler2DArray u_brushes;
+
+layout(location = 0) in vec3 v_texCoord;
+layout(location = 1) flat in vec4 v_tint;
+layout(location = 0) out vec4 o_color;
+
+void main(){
+	o_color = v_tint * texture(u_brushes, v_texCoord);
+}
@@ -0,0 +1,21 @@
+#version 430
+
+// Per-vertex, from configure_quad
+layout(location = 0) in vec3 v_position;
+layout(location = 1) in vec2 v_texCoord;
+// Per-instance, see SplatterTool::SplatInstance
+// Columns of the 2x2 rotation & scale, in clip space
+layout(location = 2) in vec4 i_basis;
+// XY: clip space translation, Z: brush layer
+layout(location = 3) in vec4 i_offset;
+layout(location = 4) in vec4 i_tint;
+
+layout(location = 0) out vec3 o_texCoord;
+layout(location = 1) flat out vec4 o_tint;
+
+void main() {
+	o_texCoord = vec3(v_texCoord, i_offset.z);
+	o_tint = i_tint;
+	vec2 pos = mat2(i_basis.xy, i_basis.zw) * v_position.xy + i_offset.xy;
+	gl_Position = vec4(pos, 0, 1);
+}
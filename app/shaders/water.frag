@@ -4,8 +4,6 @@ layout (location = 2) uniform float u_time;
 layout (location = 3) uniform sampler2D u_reflectionTexture;
 layout (location = 4) uniform ivec2 u_screenSize;
 layout (location = 5) uniform vec4 u_cullPlane;
-layout (location = 6) uniform sampler2D u_canvasTexture;
-layout (location = 7) uniform ivec2 u_canvasSize;
 layout (location = 8) uniform vec3 u_sunDir;
 layout (location = 9) uniform vec3 u_eyePos;
 layout (location = 10) uniform sampler2D u_normalTexture1;
@@ -13,6 +11,21 @@ layout (location = 11) uniform sampler2D u_normalTexture2;
 layout (location = 12) uniform sampler2D u_seafoamTexture;
 layout (location = 13) uniform vec3 u_sunColor;
 
+// The virtual canvas, see VirtualCanvas. Every shader which reads the canvas
+// has a copy of this block, keep them in sync.
+const int CANVAS_TILE_SIZE = 512;
+layout (location = 14) uniform sampler2DArray u_canvasAtlas;
+layout (location = 15) uniform isampler2D u_canvasLayers;
+layout (location = 16) uniform sampler2D u_canvasFills;
+layout (location = 17) uniform ivec2 u_canvasSize;
+// `coords` must be within the canvas
+vec4 canvas_fetch(ivec2 coords) {
+	ivec2 tile = coords / CANVAS_TILE_SIZE;
+	int layer = texelFetch(u_canvasLayers, tile, 0).r;
+	if (layer < 0) return texelFetch(u_canvasFills, tile, 0);
+	return texelFetch(u_canvasAtlas, ivec3(coords % CANVAS_TILE_SIZE, layer), 0);
+}
+
 layout (location = 0) in vec3 v_normalDir;
 layout (location = 1) in vec3 v_fragPos; // in world space
 
@@ -47,9 +60,19 @@ vec3 compute_normal() {
 	
 	return normalize(normal1 + normal2 + normal3);
 }
+// Off the canvas is sea floor, same as the black border the canvas used to have
+float height_at(ivec2 coords) {
+	if (any(lessThan(coords, ivec2(0))) || any(greaterThanEqual(coords, u_canvasSize))) return 0.0;
+	return canvas_fetch(coords).r;
+}
 float compute_height() {
-	vec2 canvasCoords = v_fragPos.xy / vec2(u_canvasSize) + 0.5;
-	return texture(u_canvasTexture, canvasCoords).r;
+	// Bilinear, by hand since the tiles don't have borders to filter across
+	vec2 pos = v_fragPos.xy + 0.5 * vec2(u_canvasSize) - 0.5;
+	ivec2 base = ivec2(floor(pos));
+	vec2 f = pos - vec2(base);
+	float bottom = mix(height_at(base), height_at(base + ivec2(1, 0)), f.x);
+	float top = mix(height_at(base + ivec2(0, 1)), height_at(base + ivec2(1, 1)), f.x);
+	return mix(bottom, top, f.y);
 }
 float foam_factor_2(vec3 normal, float height) {
 	vec2 foamCoords = v_fragPos.xy / 64 + normal.xy / 32 + 0.01*vec2(u_time, 0);
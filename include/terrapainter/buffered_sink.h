@@ -0,0 +1,50 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <functional>
+#include <span>
+#include <vector>
+
+// Where the streaming encoders (PngEncoder, QoiEncoder, HeightmapEncoder)
+// write their files. Small writes are gathered into chunks before they're
+// passed on; big ones go straight through. Once the sink refuses anything,
+// everything after it is dropped, and the encoders return false from then on.
+class BufferedSink {
+public:
+	// Receives the file a piece at a time. Returning false aborts the encode.
+	using Sink = std::function<bool(std::span<const uint8_t>)>;
+	// Output is held back until there's at least this much
+	static constexpr size_t CHUNK_SIZE = size_t(1) << 16;
+private:
+	Sink mSink;
+	std::vector<uint8_t> mBuffer;
+	bool mFailed;
+
+	void pass_on(std::span<const uint8_t> bytes);
+public:
+	explicit BufferedSink(Sink sink);
+
+	BufferedSink(const BufferedSink&) = delete;
+	BufferedSink& operator=(const BufferedSink&) = delete;
+
+	void put(uint8_t byte) {
+		mBuffer.push_back(byte);
+		if (mBuffer.size() >= CHUNK_SIZE) flush();
+	}
+	void write(std::span<const uint8_t> bytes);
+	// Passes on anything held back
+	void flush();
+	bool failed() const { return mFailed; }
+};
+
+// Big endian integers, as PNG & QOI store them
+inline void put_be32(uint8_t* out, uint32_t value) {
+	out[0] = uint8_t(value >> 24);
+	out[1] = uint8_t(value >> 16);
+	out[2] = uint8_t(value >> 8);
+	out[3] = uint8_t(value);
+}
+inline uint32_t get_be32(const uint8_t* in) {
+	return (uint32_t(in[0]) << 24) | (uint32_t(in[1]) << 16) | (uint32_t(in[2]) << 8) | uint32_t(in[3]);
+}
@@ -0,0 +1,66 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "terrapainter/buffered_sink.h"
+
+// Reads & writes the heightmap-only formats other terrain tools trade in, so
+// heights don't have to squeeze through 8 bit color on the way in or out.
+// 16 bit PNGs go through PngEncoder & stb_image instead.
+//
+// Heights are 16 bit, like an R16 canvas. The float formats map them onto
+// 0..1 when writing. When reading, values already within 0..1 are taken as
+// they are, and anything else (i.e. elevations in meters) is rescaled so its
+// lowest & highest values span the whole range.
+class HeightmapEncoder {
+public:
+	enum class Format {
+		// Headerless little endian 16 bit, top to bottom (.r16/.raw, as World
+		// Machine, Unity & Unreal use). There's no size in the file, so only
+		// square ones can be read back.
+		RAW16,
+		// Portable float map: a text header, then 32 bit floats bottom to top
+		PFM,
+		// Baseline TIFF: uncompressed, one channel, top to bottom. Writes one
+		// strip of 32 bit floats. Reads 8/16 bit integers & 32 bit floats in
+		// strips, which covers most plain GeoTIFF DEMs; georeferencing tags are
+		// ignored, as are tiled or compressed files.
+		TIFF,
+	};
+private:
+	BufferedSink mOut;
+	Format mFormat;
+	size_t mWidth;
+	size_t mHeight;
+	size_t mRowsWritten;
+public:
+	// The image has to fit the format, see fits(). Writes the header right away.
+	HeightmapEncoder(BufferedSink::Sink sink, Format format, size_t width, size_t height);
+
+	HeightmapEncoder(const HeightmapEncoder&) = delete;
+	HeightmapEncoder& operator=(const HeightmapEncoder&) = delete;
+
+	// Whether the format's rows go bottom to top, the same way as the canvas
+	static bool bottom_up(Format format);
+	// Whether a `width` x `height` image can be stored in the format
+	// (TIFF offsets are 32 bit)
+	static bool fits(Format format, size_t width, size_t height);
+	// The size of a RAW16 file `bytes` long, if it's square.
+	// Returns false if it isn't.
+	static bool raw_size(size_t bytes, size_t& width, size_t& height);
+
+	// Encodes the next rows, in the order bottom_up() gives. `rows` holds
+	// whole rows of heights. Returns false if the sink has failed.
+	bool write_rows(std::span<const uint16_t> rows);
+	// Passes on the last of the rows, once they're all in (none of the
+	// formats have a trailer). Returns false if the sink failed at any point.
+	bool finish();
+
+	// Decodes a whole file into rows of heights, bottom to top like the
+	// canvas. `low` & `high` are set to the file's values that 0 & 65535
+	// stand for. Returns false if it's malformed or unsupported.
+	static bool decode(Format format, std::span<const uint8_t> file, size_t& width, size_t& height, std::vector<uint16_t>& heights, float& low, float& high);
+};
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <string>
+
+// A whole file mapped read-only into memory. Pages are only read in from
+// disk as they're touched, and the OS can drop them again under memory
+// pressure, so a huge file costs next to no memory of its own.
+class MappedFile {
+	const uint8_t* mData;
+	size_t mSize;
+#if _WIN32
+	void* mFile;
+	void* mMapping;
+#else
+	int mFile;
+#endif
+public:
+	MappedFile();
+	~MappedFile() noexcept;
+
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	// Maps `path`, replacing any file mapped already. Returns false if it
+	// can't be opened. An empty file maps to no bytes.
+	bool open(const std::string& path);
+	void close();
+
+	// Hints that `bytes` bytes from `offset` are about to be read, so the OS
+	// can start reading them in
+	void prefetch(size_t offset, size_t bytes) const;
+
+	std::span<const uint8_t> bytes() const { return { mData, mSize }; }
+	bool is_open() const;
+};
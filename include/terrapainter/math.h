@@ -4,19 +4,130 @@
 #include <cassert>
 #include <cstdlib>
 #include <concepts>
+#include <cstdint>
 #include <cmath>
 #include <limits>
 #include <iostream>
+#include <span>
 
 #include "util.h"
 
 //! \file linalg.h
 //! Graphics-oriented linear algebra.
 
+// SIMD backend selection. Define TP_NO_SIMD to force the portable scalar
+// code (handy for checking whether a bug lives in the intrinsics).
+// SSE2 is baseline on x86-64 and NEON is baseline on AArch64, so neither
+// needs any special compiler flags. AVX/FMA paths are only used if the
+// compiler was told it can target them (-mavx / -mfma or /arch:AVX2).
+#if !defined(TP_NO_SIMD) && (defined(__SSE2__) || defined(_M_X64) || defined(_M_AMD64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+	#define TP_SIMD_SSE 1
+	#include <immintrin.h>
+#elif !defined(TP_NO_SIMD) && (defined(__aarch64__) || defined(_M_ARM64))
+	#define TP_SIMD_NEON 1
+	#include <arm_neon.h>
+#endif
+
+#if defined(TP_SIMD_SSE) || defined(TP_SIMD_NEON)
+	#define TP_SIMD 1
+#else
+	#define TP_SIMD 0
+#endif
+
 template<typename T>
 concept Numeric = std::is_floating_point_v<T> || std::is_integral_v<T>;
 
 namespace math {
+	// Thin wrapper over the four-wide float intrinsics, so the vector and
+	// matrix code below doesn't have to care which backend it's using.
+	// Nothing in here is constexpr; callers must check is_constant_evaluated.
+	namespace simd {
+	#if defined(TP_SIMD_SSE)
+		using f32x4 = __m128;
+		inline f32x4 load(const float* p) { return _mm_load_ps(p); }
+		inline f32x4 loadu(const float* p) { return _mm_loadu_ps(p); }
+		inline void store(float* p, f32x4 v) { _mm_store_ps(p, v); }
+		inline void storeu(float* p, f32x4 v) { _mm_storeu_ps(p, v); }
+		inline f32x4 splat(float f) { return _mm_set1_ps(f); }
+		inline f32x4 add(f32x4 a, f32x4 b) { return _mm_add_ps(a, b); }
+		inline f32x4 sub(f32x4 a, f32x4 b) { return _mm_sub_ps(a, b); }
+		inline f32x4 mul(f32x4 a, f32x4 b) { return _mm_mul_ps(a, b); }
+		inline f32x4 div(f32x4 a, f32x4 b) { return _mm_div_ps(a, b); }
+		inline f32x4 min(f32x4 a, f32x4 b) { return _mm_min_ps(a, b); }
+		inline f32x4 max(f32x4 a, f32x4 b) { return _mm_max_ps(a, b); }
+		// a * b + c
+		inline f32x4 madd(f32x4 a, f32x4 b, f32x4 c) {
+		#if defined(__FMA__)
+			return _mm_fmadd_ps(a, b, c);
+		#else
+			return _mm_add_ps(_mm_mul_ps(a, b), c);
+		#endif
+		}
+		// Broadcasts lane I to every lane
+		template<int I>
+		inline f32x4 lane(f32x4 v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(I, I, I, I)); }
+		// Horizontal sum of all four lanes
+		inline float hsum(f32x4 v) {
+			f32x4 swapped = _mm_shuffle_ps(v, v, _MM_SHUFFLE(2, 3, 0, 1)); // (y, x, w, z)
+			f32x4 pairs = _mm_add_ps(v, swapped); // (x+y, x+y, z+w, z+w)
+			f32x4 high = _mm_movehl_ps(swapped, pairs); // (z+w, ...)
+			return _mm_cvtss_f32(_mm_add_ss(pairs, high));
+		}
+		// Returns (hsum(a), hsum(b), hsum(c), hsum(d))
+		inline f32x4 hsum4(f32x4 a, f32x4 b, f32x4 c, f32x4 d) {
+			_MM_TRANSPOSE4_PS(a, b, c, d);
+			return _mm_add_ps(_mm_add_ps(a, b), _mm_add_ps(c, d));
+		}
+		inline void transpose(f32x4& a, f32x4& b, f32x4& c, f32x4& d) {
+			_MM_TRANSPOSE4_PS(a, b, c, d);
+		}
+		// (a, b, c, d) with a in lane 0
+		inline f32x4 setr(float a, float b, float c, float d) { return _mm_setr_ps(a, b, c, d); }
+		// Returns (v[A], v[B], v[C], v[D])
+		template<int A, int B, int C, int D>
+		inline f32x4 shuffle(f32x4 v) { return _mm_shuffle_ps(v, v, _MM_SHUFFLE(D, C, B, A)); }
+	#elif defined(TP_SIMD_NEON)
+		using f32x4 = float32x4_t;
+		inline f32x4 load(const float* p) { return vld1q_f32(p); }
+		inline f32x4 loadu(const float* p) { return vld1q_f32(p); }
+		inline void store(float* p, f32x4 v) { vst1q_f32(p, v); }
+		inline void storeu(float* p, f32x4 v) { vst1q_f32(p, v); }
+		inline f32x4 splat(float f) { return vdupq_n_f32(f); }
+		inline f32x4 add(f32x4 a, f32x4 b) { return vaddq_f32(a, b); }
+		inline f32x4 sub(f32x4 a, f32x4 b) { return vsubq_f32(a, b); }
+		inline f32x4 mul(f32x4 a, f32x4 b) { return vmulq_f32(a, b); }
+		inline f32x4 div(f32x4 a, f32x4 b) { return vdivq_f32(a, b); }
+		inline f32x4 min(f32x4 a, f32x4 b) { return vminq_f32(a, b); }
+		inline f32x4 max(f32x4 a, f32x4 b) { return vmaxq_f32(a, b); }
+		inline f32x4 madd(f32x4 a, f32x4 b, f32x4 c) { return vfmaq_f32(c, a, b); }
+		template<int I>
+		inline f32x4 lane(f32x4 v) { return vdupq_laneq_f32(v, I); }
+		inline float hsum(f32x4 v) { return vaddvq_f32(v); }
+		inline f32x4 hsum4(f32x4 a, f32x4 b, f32x4 c, f32x4 d) {
+			return vpaddq_f32(vpaddq_f32(a, b), vpaddq_f32(c, d));
+		}
+		inline void transpose(f32x4& a, f32x4& b, f32x4& c, f32x4& d) {
+			float32x4x2_t ab = vtrnq_f32(a, b); // (a0 b0 a2 b2), (a1 b1 a3 b3)
+			float32x4x2_t cd = vtrnq_f32(c, d); // (c0 d0 c2 d2), (c1 d1 c3 d3)
+			a = vcombine_f32(vget_low_f32(ab.val[0]), vget_low_f32(cd.val[0]));
+			b = vcombine_f32(vget_low_f32(ab.val[1]), vget_low_f32(cd.val[1]));
+			c = vcombine_f32(vget_high_f32(ab.val[0]), vget_high_f32(cd.val[0]));
+			d = vcombine_f32(vget_high_f32(ab.val[1]), vget_high_f32(cd.val[1]));
+		}
+		inline f32x4 setr(float a, float b, float c, float d) {
+			alignas(16) float lanes[4] = { a, b, c, d };
+			return vld1q_f32(lanes);
+		}
+		template<int A, int B, int C, int D>
+		inline f32x4 shuffle(f32x4 v) {
+			f32x4 r = vdupq_laneq_f32(v, A);
+			r = vcopyq_laneq_f32(r, 1, v, B);
+			r = vcopyq_laneq_f32(r, 2, v, C);
+			return vcopyq_laneq_f32(r, 3, v, D);
+		}
+	#endif
+	}
+
 	// Operator access relies on reinterpret_cast, which does not function
 	// in a constant context.
 	#define _IMPL_CONSTEVAL_ACCESS(idx, x, y, z, w, rest) \
@@ -120,6 +231,10 @@ namespace math {
 		/// The number of elements in vectors of this type.
 		constexpr static size_t SIZE = C;
 
+		/// Whether arithmetic on this type goes through the SIMD backend
+		/// (outside of constant evaluation, anyways).
+		constexpr static bool SIMD = TP_SIMD && std::is_same_v<T, float> && C == 4;
+
 		/// Default constructor
 		constexpr MVector() : MVectorStorage<T, C>{} {}
 
@@ -171,7 +286,25 @@ namespace math {
 			 auto copy = *this; copy sym##= other; return copy; \
 		}
 
+		// Applies a two-operand SIMD op in place. Only valid if SIMD is true.
+		#if TP_SIMD
+		template<typename Op>
+		void simd_apply(const MVector& other, Op op) {
+			simd::store(data(), op(simd::load(data()), simd::load(other.data())));
+		}
+		#define VEC_TRY_SIMD(other, op) \
+			if constexpr (SIMD) { \
+				if (!std::is_constant_evaluated()) { \
+					simd_apply(other, [](simd::f32x4 a, simd::f32x4 b) { return op(a, b); }); \
+					return *this; \
+				} \
+			}
+		#else
+		#define VEC_TRY_SIMD(other, op)
+		#endif
+
 		constexpr MVector& operator+=(const MVector& other) {
+			VEC_TRY_SIMD(other, simd::add);
 			for (size_t i = 0; i < C; i++) (*this)[i] += other[i];
 			return *this;
 		}
@@ -179,6 +312,7 @@ namespace math {
 		
 
 		constexpr MVector& operator-=(const MVector& other) {
+			VEC_TRY_SIMD(other, simd::sub);
 			for (size_t i = 0; i < C; i++) (*this)[i] -= other[i];
 			return *this;
 		}
@@ -193,6 +327,7 @@ namespace math {
 		template<std::convertible_to<T> S>
 		constexpr MVector& operator*=(S scalar) {
 			auto scalar_cvt = static_cast<T>(scalar);
+			VEC_TRY_SIMD(MVector::splat(scalar_cvt), simd::mul);
 			for (size_t i = 0; i < C; i++) (*this)[i] *= scalar_cvt;
 			return *this;
 		}
@@ -201,6 +336,7 @@ namespace math {
 
 		/// Element-wise vector multiplication (not the dot product!)
 		constexpr MVector& operator*=(const MVector& other) {
+			VEC_TRY_SIMD(other, simd::mul);
 			for (size_t i = 0; i < C; i++) (*this)[i] *= other[i];
 			return *this;
 		}
@@ -227,11 +363,13 @@ namespace math {
 
 		/// Element-wise vector division.
 		constexpr MVector& operator/=(const MVector& other) {
+			VEC_TRY_SIMD(other, simd::div);
 			for (size_t i = 0; i < C; i++) (*this)[i] /= other[i];
 			return *this;
 		}
 		VEC_DERIVE_BINOP(/, const MVector&)
 
+		#undef VEC_TRY_SIMD
 		#undef VEC_DERIVE_BINOP
 
 		// Returns the magnitude of this vector.
@@ -295,6 +433,13 @@ namespace math {
 
 	template<Numeric T, size_t C>
 	inline constexpr T dot(const MVector<T, C>& l, const MVector<T, C>& r) {
+	#if TP_SIMD
+		if constexpr (MVector<T, C>::SIMD) {
+			if (!std::is_constant_evaluated()) {
+				return simd::hsum(simd::mul(simd::load(l.data()), simd::load(r.data())));
+			}
+		}
+	#endif
 		auto sum = static_cast<T>(0);
 		for (size_t i = 0; i < C; i++) sum += l[i] * r[i];
 		return sum;
@@ -336,6 +481,10 @@ namespace math {
 		std::array<MVector<T, N>, M> mStorage;
 
 	public:
+		/// Whether multiplication and transposition of this type go through
+		/// the SIMD backend. Everything else falls out of MVector::SIMD.
+		constexpr static bool SIMD = MVector<T, N>::SIMD && M == 4;
+
 		/// Default constructor (all zeroes).
 		constexpr MMatrix() : mStorage() {}
 
@@ -509,6 +658,22 @@ namespace math {
 		MAT_DERIVE_BINOP(-, const MMatrix&);
 
 		constexpr MVector<T, M> operator*(const MVector<T, N>& vec) const {
+		#if TP_SIMD
+			if constexpr (SIMD) {
+				if (!std::is_constant_evaluated()) {
+					simd::f32x4 v = simd::load(vec.data());
+					simd::f32x4 r = simd::hsum4(
+						simd::mul(simd::load(mStorage[0].data()), v),
+						simd::mul(simd::load(mStorage[1].data()), v),
+						simd::mul(simd::load(mStorage[2].data()), v),
+						simd::mul(simd::load(mStorage[3].data()), v)
+					);
+					MVector<T, M> result;
+					simd::store(result.data(), r);
+					return result;
+				}
+			}
+		#endif
 			auto result = MVector<T, M>::zero();
 			for (size_t i = 0; i < M; ++i) {
 				result[i] = dot(mStorage[i], vec);
@@ -542,6 +707,23 @@ namespace math {
 		#undef MAT_DERIVE_BINOP
 
 		constexpr MMatrix<T, N, M> transpose() const {
+		#if TP_SIMD
+			if constexpr (SIMD) {
+				if (!std::is_constant_evaluated()) {
+					simd::f32x4 r0 = simd::load(mStorage[0].data());
+					simd::f32x4 r1 = simd::load(mStorage[1].data());
+					simd::f32x4 r2 = simd::load(mStorage[2].data());
+					simd::f32x4 r3 = simd::load(mStorage[3].data());
+					simd::transpose(r0, r1, r2, r3);
+					MMatrix transposed;
+					simd::store(transposed.mStorage[0].data(), r0);
+					simd::store(transposed.mStorage[1].data(), r1);
+					simd::store(transposed.mStorage[2].data(), r2);
+					simd::store(transposed.mStorage[3].data(), r3);
+					return transposed;
+				}
+			}
+		#endif
 			auto transposed = MMatrix<T,N,M>::zero();
 			for (size_t j = 0; j < M; j++) {
 				transposed.set_col(j, mStorage[j]);
@@ -551,6 +733,15 @@ namespace math {
 
 		template<size_t O>
 		constexpr MMatrix<T, M, O> operator*(const MMatrix<T, N, O>& other) const {
+		#if TP_SIMD
+			if constexpr (SIMD && O == 4) {
+				if (!std::is_constant_evaluated()) {
+					MMatrix result;
+					simd_mul(result, *this, other);
+					return result;
+				}
+			}
+		#endif
 			auto mul = MMatrix<T, M, O>::zero();
 			for (size_t r = 0; r < M; r++) {
 				auto in_row = this->row(r);
@@ -564,6 +755,42 @@ namespace math {
 		}
 
 	private:
+	#if TP_SIMD
+		// Since storage is row-major, each output row is a linear combination
+		// of the rows of `r`, weighted by the entries of the matching row in `l`.
+		// This needs no shuffling besides broadcasts.
+		static void simd_mul(MMatrix& out, const MMatrix& l, const MMatrix& r) requires(SIMD) {
+			simd::f32x4 r0 = simd::load(r.mStorage[0].data());
+			simd::f32x4 r1 = simd::load(r.mStorage[1].data());
+			simd::f32x4 r2 = simd::load(r.mStorage[2].data());
+			simd::f32x4 r3 = simd::load(r.mStorage[3].data());
+		#if defined(TP_SIMD_SSE) && defined(__AVX__)
+			// With AVX we can do two output rows at once.
+			__m256 r00 = _mm256_set_m128(r0, r0);
+			__m256 r11 = _mm256_set_m128(r1, r1);
+			__m256 r22 = _mm256_set_m128(r2, r2);
+			__m256 r33 = _mm256_set_m128(r3, r3);
+			for (size_t i = 0; i < 4; i += 2) {
+				__m256 ls = _mm256_loadu_ps(l.mStorage[i].data());
+				__m256 acc = _mm256_mul_ps(_mm256_shuffle_ps(ls, ls, _MM_SHUFFLE(0, 0, 0, 0)), r00);
+				acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_shuffle_ps(ls, ls, _MM_SHUFFLE(1, 1, 1, 1)), r11));
+				acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_shuffle_ps(ls, ls, _MM_SHUFFLE(2, 2, 2, 2)), r22));
+				acc = _mm256_add_ps(acc, _mm256_mul_ps(_mm256_shuffle_ps(ls, ls, _MM_SHUFFLE(3, 3, 3, 3)), r33));
+				_mm256_storeu_ps(out.mStorage[i].data(), acc);
+			}
+		#else
+			for (size_t i = 0; i < 4; i++) {
+				simd::f32x4 ls = simd::load(l.mStorage[i].data());
+				simd::f32x4 acc = simd::mul(simd::lane<0>(ls), r0);
+				acc = simd::madd(simd::lane<1>(ls), r1, acc);
+				acc = simd::madd(simd::lane<2>(ls), r2, acc);
+				acc = simd::madd(simd::lane<3>(ls), r3, acc);
+				simd::store(out.mStorage[i].data(), acc);
+			}
+		#endif
+		}
+	#endif
+
 		template<bool Reduce>
 		constexpr T gauss_eliminate() requires(std::is_floating_point_v<T>) {
 			T determinant = static_cast<T>(1);
@@ -657,24 +884,120 @@ namespace math {
 			return copy;
 		}
 
+		// Closed-form (cofactor expansion) for N <= 4, Gaussian elimination otherwise.
 		constexpr T determinant() const requires(N == M) {
+			const auto& a = mStorage;
 			if constexpr (N == 2) {
-				return mStorage[0].x * mStorage[1].y - mStorage[0].y * mStorage[1].x;
+				return a[0][0] * a[1][1] - a[0][1] * a[1][0];
+			}
+			else if constexpr (N == 3) {
+				return a[0][0] * (a[1][1] * a[2][2] - a[1][2] * a[2][1])
+					- a[0][1] * (a[1][0] * a[2][2] - a[1][2] * a[2][0])
+					+ a[0][2] * (a[1][0] * a[2][1] - a[1][1] * a[2][0]);
+			}
+			else if constexpr (N == 4) {
+				// 2x2 minors of the top two rows (s) and bottom two rows (c).
+				// Every 4x4 cofactor can be built out of these, see inverse().
+				T s0 = a[0][0] * a[1][1] - a[1][0] * a[0][1];
+				T s1 = a[0][0] * a[1][2] - a[1][0] * a[0][2];
+				T s2 = a[0][0] * a[1][3] - a[1][0] * a[0][3];
+				T s3 = a[0][1] * a[1][2] - a[1][1] * a[0][2];
+				T s4 = a[0][1] * a[1][3] - a[1][1] * a[0][3];
+				T s5 = a[0][2] * a[1][3] - a[1][2] * a[0][3];
+				T c5 = a[2][2] * a[3][3] - a[3][2] * a[2][3];
+				T c4 = a[2][1] * a[3][3] - a[3][1] * a[2][3];
+				T c3 = a[2][1] * a[3][2] - a[3][1] * a[2][2];
+				T c2 = a[2][0] * a[3][3] - a[3][0] * a[2][3];
+				T c1 = a[2][0] * a[3][2] - a[3][0] * a[2][2];
+				T c0 = a[2][0] * a[3][1] - a[3][0] * a[2][1];
+				return s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+			}
+			else {
+				auto copy = *this;
+				return copy.make_row_echelon();
 			}
-			auto copy = *this;
-			return copy.make_row_echelon();
 		}
 
+		// Closed-form (adjugate over determinant) for N <= 4, Gauss-Jordan
+		// elimination otherwise. Singular matrices produce non-finite entries.
 		template<typename _ = void> 
-			requires(N == M)
+			requires(N == M && std::is_floating_point_v<T>)
 		constexpr MMatrix inverse() const {
+			const auto& a = mStorage;
 			if constexpr (N == 2) {
 				MMatrix<T, 2, 2> unscaled = {
-					mStorage[1][1], -mStorage[0][1],
-					-mStorage[1][0], mStorage[0][0]
+					a[1][1], -a[0][1],
+					-a[1][0], a[0][0]
 				};
 				return unscaled / this->determinant();
 			}
+			else if constexpr (N == 3) {
+				MMatrix<T, 3, 3> adj = {
+					a[1][1] * a[2][2] - a[1][2] * a[2][1],
+					a[0][2] * a[2][1] - a[0][1] * a[2][2],
+					a[0][1] * a[1][2] - a[0][2] * a[1][1],
+
+					a[1][2] * a[2][0] - a[1][0] * a[2][2],
+					a[0][0] * a[2][2] - a[0][2] * a[2][0],
+					a[0][2] * a[1][0] - a[0][0] * a[1][2],
+
+					a[1][0] * a[2][1] - a[1][1] * a[2][0],
+					a[0][1] * a[2][0] - a[0][0] * a[2][1],
+					a[0][0] * a[1][1] - a[0][1] * a[1][0]
+				};
+				// Expanding along the first row reuses the adjugate's first column
+				T det = a[0][0] * adj.mStorage[0][0] + a[0][1] * adj.mStorage[1][0] + a[0][2] * adj.mStorage[2][0];
+				return adj / det;
+			}
+			else if constexpr (N == 4) {
+				// See determinant() for what these are
+				T s0 = a[0][0] * a[1][1] - a[1][0] * a[0][1];
+				T s1 = a[0][0] * a[1][2] - a[1][0] * a[0][2];
+				T s2 = a[0][0] * a[1][3] - a[1][0] * a[0][3];
+				T s3 = a[0][1] * a[1][2] - a[1][1] * a[0][2];
+				T s4 = a[0][1] * a[1][3] - a[1][1] * a[0][3];
+				T s5 = a[0][2] * a[1][3] - a[1][2] * a[0][3];
+				T c5 = a[2][2] * a[3][3] - a[3][2] * a[2][3];
+				T c4 = a[2][1] * a[3][3] - a[3][1] * a[2][3];
+				T c3 = a[2][1] * a[3][2] - a[3][1] * a[2][2];
+				T c2 = a[2][0] * a[3][3] - a[3][0] * a[2][3];
+				T c1 = a[2][0] * a[3][2] - a[3][0] * a[2][2];
+				T c0 = a[2][0] * a[3][1] - a[3][0] * a[2][1];
+				T det = s0 * c5 - s1 * c4 + s2 * c3 + s3 * c2 - s4 * c1 + s5 * c0;
+				MMatrix<T, 4, 4> adj = {
+					a[1][1] * c5 - a[1][2] * c4 + a[1][3] * c3,
+					-a[0][1] * c5 + a[0][2] * c4 - a[0][3] * c3,
+					a[3][1] * s5 - a[3][2] * s4 + a[3][3] * s3,
+					-a[2][1] * s5 + a[2][2] * s4 - a[2][3] * s3,
+
+					-a[1][0] * c5 + a[1][2] * c2 - a[1][3] * c1,
+					a[0][0] * c5 - a[0][2] * c2 + a[0][3] * c1,
+					-a[3][0] * s5 + a[3][2] * s2 - a[3][3] * s1,
+					a[2][0] * s5 - a[2][2] * s2 + a[2][3] * s1,
+
+					a[1][0] * c4 - a[1][1] * c2 + a[1][3] * c0,
+					-a[0][0] * c4 + a[0][1] * c2 - a[0][3] * c0,
+					a[3][0] * s4 - a[3][1] * s2 + a[3][3] * s0,
+					-a[2][0] * s4 + a[2][1] * s2 - a[2][3] * s0,
+
+					-a[1][0] * c3 + a[1][1] * c1 - a[1][2] * c0,
+					a[0][0] * c3 - a[0][1] * c1 + a[0][2] * c0,
+					-a[3][0] * s3 + a[3][1] * s1 - a[3][2] * s0,
+					a[2][0] * s3 - a[2][1] * s1 + a[2][2] * s0
+				};
+				return adj / det;
+			}
+			else {
+				return this->gauss_jordan_inverse();
+			}
+		}
+
+		// Inverts the matrix by row-reducing the augmented system [A | I].
+		// This works for any size, but it's much slower than the closed
+		// forms inverse() uses for small matrices.
+		template<typename _ = void>
+			requires(N == M && std::is_floating_point_v<T>)
+		constexpr MMatrix gauss_jordan_inverse() const {
 			auto system = MMatrix<T, M, 2 * N>::zero();
 			for (size_t i = 0; i < M; ++i) {
 				auto sys_row = MVector<T, 2 * N>::zero();
@@ -692,6 +1015,58 @@ namespace math {
 			}
 			return inv;
 		}
+
+		// Inverts a homogenous affine transform, i.e. one whose bottom row
+		// is (0, ..., 0, 1). This covers every combination of translation,
+		// rotation, scale and shear, which is everything Entity produces.
+		// Only the (N-1)x(N-1) linear part needs a general inverse; the
+		// translation is just that inverse applied to the negated offset.
+		template<typename _ = void>
+			requires(N == M && N > 2 && std::is_floating_point_v<T>)
+		constexpr MMatrix affine_inverse() const {
+			auto linear = MMatrix<T, N - 1, N - 1>::zero();
+			for (size_t i = 0; i < N - 1; i++) {
+				for (size_t j = 0; j < N - 1; j++) linear.mStorage[i][j] = mStorage[i][j];
+			}
+			return from_linear_inverse(linear.inverse());
+		}
+
+		// Inverts a homogenous rigid transform (rotation and translation
+		// only). The linear part is orthonormal, so its inverse is just its
+		// transpose. Applying this to a transform with any scale or shear
+		// gives garbage -- use affine_inverse() for those.
+		template<typename _ = void>
+			requires(N == M && N > 2 && std::is_floating_point_v<T>)
+		constexpr MMatrix rigid_inverse() const {
+			auto transposed = MMatrix<T, N - 1, N - 1>::zero();
+			for (size_t i = 0; i < N - 1; i++) {
+				for (size_t j = 0; j < N - 1; j++) transposed.mStorage[i][j] = mStorage[j][i];
+			}
+			return from_linear_inverse(transposed);
+		}
+
+	private:
+		// Given the inverse of this affine transform's linear part, builds
+		// the inverse of the full homogenous transform.
+		template<typename Linear>
+			requires(N == M && N > 2)
+		constexpr MMatrix from_linear_inverse(const Linear& inv) const {
+			auto result = MMatrix::zero();
+			for (size_t i = 0; i < N - 1; i++) {
+				T offset = static_cast<T>(0);
+				for (size_t j = 0; j < N - 1; j++) {
+					result.mStorage[i][j] = inv.mStorage[i][j];
+					offset -= inv.mStorage[i][j] * mStorage[j][N - 1];
+				}
+				result.mStorage[i][N - 1] = offset;
+			}
+			result.mStorage[N - 1][N - 1] = static_cast<T>(1);
+			return result;
+		}
+
+		template<Numeric, size_t P, size_t Q>
+			requires (2 <= P && 2 <= Q)
+		friend class MMatrix;
 	};
 
 	template<Numeric T, size_t M, size_t N, std::convertible_to<T> S>
@@ -768,6 +1143,170 @@ namespace math {
 		}
 		return result;
 	}
+
+	// A rotation quaternion (x, y, z, w), where w is the scalar part.
+	// Unless noted otherwise, operations assume the quaternion is unit length.
+	// Composition follows matrices: (a * b).rotate(v) == a.rotate(b.rotate(v)).
+	template<std::floating_point T>
+	class MQuaternion {
+		MVector<T, 4> mStorage;
+
+		constexpr static bool SIMD = MVector<T, 4>::SIMD;
+	public:
+		// The identity rotation.
+		constexpr MQuaternion() : mStorage(0, 0, 0, 1) {}
+		constexpr MQuaternion(T x, T y, T z, T w) : mStorage(x, y, z, w) {}
+		constexpr explicit MQuaternion(const MVector<T, 4>& xyzw) : mStorage(xyzw) {}
+
+		constexpr static MQuaternion ident() { return MQuaternion(); }
+
+		// Rotation by `angle` radians around `axis`, which must be normalized.
+		static MQuaternion axis_angle(const MVector<T, 3>& axis, T angle) {
+			T s = std::sin(angle / 2);
+			return MQuaternion(axis.x * s, axis.y * s, axis.z * s, std::cos(angle / 2));
+		}
+
+		// The same rotation as MMatrix::rotate_xyz(rotX, rotY, rotZ).
+		// Note that, like rotate_xyz, positive Y angles pitch *upwards*.
+		static MQuaternion rotate_xyz(T rotX, T rotY, T rotZ) {
+			auto qx = axis_angle(MVector<T, 3>(1, 0, 0), rotX);
+			auto qy = axis_angle(MVector<T, 3>(0, 1, 0), -rotY);
+			auto qz = axis_angle(MVector<T, 3>(0, 0, 1), rotZ);
+			return qz * qy * qx;
+		}
+
+		constexpr T x() const { return mStorage.x; }
+		constexpr T y() const { return mStorage.y; }
+		constexpr T z() const { return mStorage.z; }
+		constexpr T w() const { return mStorage.w; }
+		constexpr const MVector<T, 4>& xyzw() const { return mStorage; }
+
+		constexpr bool operator==(const MQuaternion& other) const { return mStorage == other.mStorage; }
+		constexpr bool operator!=(const MQuaternion& other) const { return mStorage != other.mStorage; }
+
+		// Hamilton product
+		constexpr MQuaternion operator*(const MQuaternion& r) const {
+		#if TP_SIMD
+			if constexpr (SIMD) {
+				if (!std::is_constant_evaluated()) {
+					// Each lane of the result is a signed combination of
+					// every lane of r, so build it out of four broadcasts
+					simd::f32x4 a = simd::load(mStorage.data());
+					simd::f32x4 b = simd::load(r.mStorage.data());
+					simd::f32x4 res = simd::mul(simd::lane<3>(a), b);
+					res = simd::madd(simd::lane<0>(a),
+						simd::mul(simd::shuffle<3, 2, 1, 0>(b), simd::setr(1, -1, 1, -1)), res);
+					res = simd::madd(simd::lane<1>(a),
+						simd::mul(simd::shuffle<2, 3, 0, 1>(b), simd::setr(1, 1, -1, -1)), res);
+					res = simd::madd(simd::lane<2>(a),
+						simd::mul(simd::shuffle<1, 0, 3, 2>(b), simd::setr(-1, 1, 1, -1)), res);
+					MQuaternion out;
+					simd::store(out.mStorage.data(), res);
+					return out;
+				}
+			}
+		#endif
+			const auto& l = mStorage;
+			const auto& q = r.mStorage;
+			return MQuaternion(
+				l.w * q.x + l.x * q.w + l.y * q.z - l.z * q.y,
+				l.w * q.y - l.x * q.z + l.y * q.w + l.z * q.x,
+				l.w * q.z + l.x * q.y - l.y * q.x + l.z * q.w,
+				l.w * q.w - l.x * q.x - l.y * q.y - l.z * q.z
+			);
+		}
+		constexpr MQuaternion& operator*=(const MQuaternion& r) {
+			return *this = *this * r;
+		}
+
+		// For unit quaternions, this is also the inverse.
+		constexpr MQuaternion conjugate() const {
+			return MQuaternion(-mStorage.x, -mStorage.y, -mStorage.z, mStorage.w);
+		}
+		constexpr MQuaternion normalize() const {
+			return MQuaternion(mStorage.normalize());
+		}
+
+		// Rotates v. Cheaper than building a matrix for a single vector.
+		constexpr MVector<T, 3> rotate(const MVector<T, 3>& v) const {
+			MVector<T, 3> u = { mStorage.x, mStorage.y, mStorage.z };
+			MVector<T, 3> t = static_cast<T>(2) * cross(u, v);
+			return v + mStorage.w * t + cross(u, t);
+		}
+
+		constexpr MMatrix<T, 3, 3> to_mat3() const {
+			T x = mStorage.x, y = mStorage.y, z = mStorage.z, w = mStorage.w;
+			T x2 = x + x, y2 = y + y, z2 = z + z;
+			T xx = x * x2, yy = y * y2, zz = z * z2;
+			T xy = x * y2, xz = x * z2, yz = y * z2;
+			T wx = w * x2, wy = w * y2, wz = w * z2;
+			return MMatrix<T, 3, 3> {
+				1 - (yy + zz), xy - wz, xz + wy,
+				xy + wz, 1 - (xx + zz), yz - wx,
+				xz - wy, yz + wx, 1 - (xx + yy)
+			};
+		}
+		constexpr MMatrix<T, 4, 4> to_mat4() const {
+			return to_mat3().hmg();
+		}
+
+		// Recovers (rotX, rotY, rotZ) such that rotate_xyz(rotX, rotY, rotZ)
+		// is this rotation. When pitched straight up or down, X and Z aren't
+		// independent, so X is chosen to be 0.
+		MVector<T, 3> to_angles_xyz() const {
+			MMatrix<T, 3, 3> m = to_mat3();
+			MVector<T, 3> r0 = m.row(0), r1 = m.row(1), r2 = m.row(2);
+			T sY = std::clamp(r2.x, static_cast<T>(-1), static_cast<T>(1));
+			T rotY = std::asin(sY);
+			if (std::abs(sY) > static_cast<T>(0.99999)) {
+				return MVector<T, 3>(0, rotY, std::atan2(-r0.y, r1.y));
+			}
+			return MVector<T, 3>(std::atan2(r2.y, r2.z), rotY, std::atan2(r1.x, r0.x));
+		}
+	};
+
+	template<std::floating_point T>
+	inline constexpr T dot(const MQuaternion<T>& l, const MQuaternion<T>& r) {
+		return dot(l.xyzw(), r.xyzw());
+	}
+
+	// Normalized linear interpolation along the shorter arc. This doesn't
+	// move at a constant angular speed, but it's cheap and close enough to
+	// slerp for small steps like per-frame smoothing.
+	template<std::floating_point T, std::convertible_to<T> S>
+	inline constexpr MQuaternion<T> nlerp(const MQuaternion<T>& a, const MQuaternion<T>& b, S factor) {
+		T t = static_cast<T>(factor);
+		MVector<T, 4> end = dot(a, b) < 0 ? -b.xyzw() : b.xyzw();
+		return MQuaternion<T>(lerp(a.xyzw(), end, t).normalize());
+	}
+
+	// Spherical linear interpolation along the shorter arc.
+	template<std::floating_point T, std::convertible_to<T> S>
+	inline MQuaternion<T> slerp(const MQuaternion<T>& a, const MQuaternion<T>& b, S factor) {
+		T t = static_cast<T>(factor);
+		T cosTheta = dot(a, b);
+		MVector<T, 4> end = b.xyzw();
+		if (cosTheta < 0) {
+			cosTheta = -cosTheta;
+			end = -end;
+		}
+		// sin(theta) vanishes as the quaternions coincide; nlerp is
+		// indistinguishable at that point anyways.
+		if (cosTheta > static_cast<T>(0.9995)) {
+			return MQuaternion<T>(lerp(a.xyzw(), end, t).normalize());
+		}
+		T theta = std::acos(cosTheta);
+		T sinTheta = std::sin(theta);
+		T wa = std::sin((1 - t) * theta) / sinTheta;
+		T wb = std::sin(t * theta) / sinTheta;
+		return MQuaternion<T>(wa * a.xyzw() + wb * end);
+	}
+
+	// Compares rotations, so q and -q are considered equal.
+	template<std::floating_point T>
+	inline bool aeq(const MQuaternion<T>& left, const MQuaternion<T>& right, T tolerance = std::numeric_limits<T>::epsilon()) {
+		return aeq(left.xyzw(), right.xyzw(), tolerance) || aeq(left.xyzw(), -right.xyzw(), tolerance);
+	}
 }
 
 using vec2 = math::MVector<float, 2>;
@@ -785,7 +1324,176 @@ using ivec2 = math::MVector<int, 2>;
 using ivec3 = math::MVector<int, 3>;
 using ivec4 = math::MVector<int, 4>;
 
+using quat = math::MQuaternion<float>;
+
 using math::dot;
 using math::cross;
 using math::aeq;
 using math::lerp;
+using math::nlerp;
+using math::slerp;
+
+// Bounding volumes and view frustums, for culling.
+namespace math {
+	// The half-space dot(normal, p) + offset >= 0.
+	struct Plane {
+		vec3 normal;
+		float offset;
+
+		// From plane equation coefficients (a, b, c, d), normalizing them
+		// so that signed_distance is an actual distance.
+		static Plane from_coefficients(const vec4& abcd) {
+			float invLen = 1.0f / std::sqrt(abcd.x * abcd.x + abcd.y * abcd.y + abcd.z * abcd.z);
+			return Plane{ vec3(abcd.x, abcd.y, abcd.z) * invLen, abcd.w * invLen };
+		}
+		// Positive on the side the normal points to
+		float signed_distance(const vec3& p) const { return dot(normal, p) + offset; }
+	};
+
+	// An axis-aligned bounding box.
+	struct AABB {
+		vec3 min;
+		vec3 max;
+
+		static AABB from_center_extents(const vec3& center, const vec3& extents) {
+			return AABB{ center - extents, center + extents };
+		}
+		vec3 center() const { return 0.5f * (min + max); }
+		// Half the size along each axis
+		vec3 extents() const { return 0.5f * (max - min); }
+
+		// The smallest AABB containing this box after an affine transform.
+		// This grows with rotation, so don't repeatedly re-transform a box.
+		AABB transformed(const mat4& m) const {
+			vec3 c = center(), e = extents();
+			vec3 newCenter, newExtents;
+			for (size_t i = 0; i < 3; i++) {
+				vec4 row = m.row(i);
+				newCenter[i] = row.x * c.x + row.y * c.y + row.z * c.z + row.w;
+				newExtents[i] = std::abs(row.x) * e.x + std::abs(row.y) * e.y + std::abs(row.z) * e.z;
+			}
+			return from_center_extents(newCenter, newExtents);
+		}
+	};
+
+	struct Sphere {
+		vec3 center;
+		float radius;
+	};
+
+	enum class Containment {
+		Outside,
+		Intersecting,
+		Inside,
+	};
+
+	// A convex volume bounded by six inward-facing planes.
+	// Tests are conservative: a volume straddling two planes just outside
+	// a frustum corner may be reported as intersecting. That's harmless
+	// for culling, it just means drawing something that ends up offscreen.
+	struct Frustum {
+		// Suffixed, since windows.h defines NEAR and FAR as macros
+		enum PlaneIndex { LEFT_PLANE, RIGHT_PLANE, BOTTOM_PLANE, TOP_PLANE, NEAR_PLANE, FAR_PLANE, PLANE_COUNT };
+		std::array<Plane, PLANE_COUNT> planes;
+
+		// Extracts the world-space frustum from an OpenGL-style (clip z in
+		// [-w, w]) view-projection matrix, a la Gribb and Hartmann. Each
+		// plane is a sum or difference of the matrix's bottom row with
+		// one of the others, since e.g. "left" is exactly -w <= x.
+		static Frustum from_view_proj(const mat4& viewProj) {
+			vec4 r0 = viewProj.row(0), r1 = viewProj.row(1), r2 = viewProj.row(2), r3 = viewProj.row(3);
+			Frustum f;
+			f.planes[LEFT_PLANE] = Plane::from_coefficients(r3 + r0);
+			f.planes[RIGHT_PLANE] = Plane::from_coefficients(r3 - r0);
+			f.planes[BOTTOM_PLANE] = Plane::from_coefficients(r3 + r1);
+			f.planes[TOP_PLANE] = Plane::from_coefficients(r3 - r1);
+			f.planes[NEAR_PLANE] = Plane::from_coefficients(r3 + r2);
+			f.planes[FAR_PLANE] = Plane::from_coefficients(r3 - r2);
+			return f;
+		}
+
+		bool contains(const vec3& p) const {
+			for (const Plane& plane : planes) {
+				if (plane.signed_distance(p) < 0) return false;
+			}
+			return true;
+		}
+
+		Containment classify(const AABB& box) const {
+			vec3 c = box.center(), e = box.extents();
+			Containment result = Containment::Inside;
+			for (const Plane& plane : planes) {
+				// How far the box reaches along the plane normal
+				float reach = std::abs(plane.normal.x) * e.x + std::abs(plane.normal.y) * e.y + std::abs(plane.normal.z) * e.z;
+				float dist = plane.signed_distance(c);
+				if (dist + reach < 0) return Containment::Outside;
+				if (dist - reach < 0) result = Containment::Intersecting;
+			}
+			return result;
+		}
+		Containment classify(const Sphere& sphere) const {
+			Containment result = Containment::Inside;
+			for (const Plane& plane : planes) {
+				float dist = plane.signed_distance(sphere.center);
+				if (dist + sphere.radius < 0) return Containment::Outside;
+				if (dist - sphere.radius < 0) result = Containment::Intersecting;
+			}
+			return result;
+		}
+
+		bool intersects(const AABB& box) const { return classify(box) != Containment::Outside; }
+		bool intersects(const Sphere& sphere) const { return classify(sphere) != Containment::Outside; }
+	};
+}
+
+using math::Plane;
+using math::AABB;
+using math::Sphere;
+using math::Containment;
+using math::Frustum;
+
+// Batched operations over structure-of-arrays data, for when there are far
+// too many elements to push through MVector temporaries one at a time
+// (terrain vertices, foliage instances, ...). These process four elements
+// per iteration using the math::simd wrappers and finish any remainder with
+// scalar code, so the inputs don't need to be padded or aligned.
+// Unless noted otherwise, the output may alias the input.
+namespace math::batch {
+	// N three-component vectors, stored as three parallel arrays.
+	template<typename F>
+	struct MSoA3 {
+		std::span<F> x, y, z;
+
+		constexpr MSoA3() = default;
+		constexpr MSoA3(std::span<F> _x, std::span<F> _y, std::span<F> _z) : x(_x), y(_y), z(_z) {
+			assert(x.size() == y.size() && y.size() == z.size());
+		}
+		// Allows passing mutable arrays where read-only ones are expected
+		constexpr operator MSoA3<const F>() const requires(!std::is_const_v<F>) {
+			return MSoA3<const F>(x, y, z);
+		}
+		constexpr size_t size() const { return x.size(); }
+	};
+	using soa3 = MSoA3<float>;
+	using csoa3 = MSoA3<const float>;
+
+	// out[i] = (m * vec4(in[i], 1)).xyz
+	// The bottom row of m is ignored, so this is only correct for affine m.
+	void transform_points(const mat4& m, csoa3 in, soa3 out);
+	// out[i] = (m * vec4(in[i], 0)).xyz
+	void transform_vectors(const mat4& m, csoa3 in, soa3 out);
+	// out[i] = translate_hmg(pos[i]) * rotate_xyz(angles[i]).hmg() * diag(scale[i], 1)
+	// This is the same transform Entity builds from its position, angles and scale.
+	void build_trs(csoa3 positions, csoa3 angles, csoa3 scales, std::span<mat4> out);
+	// out[i] = dot(a[i], b[i])
+	void dot(csoa3 a, csoa3 b, std::span<float> out);
+	// out[i] = cross(a[i], b[i])
+	void cross(csoa3 a, csoa3 b, soa3 out);
+
+	// visible[i] = frustum.intersects(AABB{ mins[i], maxs[i] })
+	// Returns how many boxes were visible.
+	size_t frustum_cull(const Frustum& frustum, csoa3 mins, csoa3 maxs, std::span<uint8_t> visible);
+	// visible[i] = frustum.intersects(Sphere{ centers[i], radii[i] })
+	// Returns how many spheres were visible.
+	size_t frustum_cull(const Frustum& frustum, csoa3 centers, std::span<const float> radii, std::span<uint8_t> visible);
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <deque>
+#include <future>
+#include <memory>
+#include <span>
+#include <vector>
+
+#include "terrapainter/buffered_sink.h"
+
+class ThreadPool;
+
+// Writes 8 or 16 bit PNGs a few rows at a time, so the whole image never has to be
+// in memory at once (stb_image_write wants every row up front).
+//
+// Each row gets whichever PNG filter makes it smallest by the usual sum of
+// absolute differences heuristic, then goes through a small deflate
+// compressor: greedy LZ77 over a 32K window, fixed Huffman codes. That's about
+// what stb_image_write does too.
+//
+// Rows are grouped into bands, and each band is filtered & deflated on its
+// own, pigz style: it ends with a sync flush (an empty stored block), so the
+// bands' output can just be concatenated into one zlib stream, and their
+// Adler-32s are combined arithmetically. Given a thread pool, the bands are
+// encoded in parallel, with a few in flight at once; they're written out in
+// order as they finish. Matches can't reach back into the previous band,
+// which costs next to nothing at this band size.
+class PngEncoder {
+public:
+	enum class Level {
+		// Fewer filters & a shorter match search, for quick saves of big
+		// canvases. About 2.3x as fast, for a file about 45% bigger.
+		FAST,
+		DEFAULT,
+	};
+	// Rows are grouped into bands of about this many bytes
+	static constexpr size_t BAND_BYTES = size_t(1) << 20;
+private:
+	struct Band {
+		// Rows as given, and the row above the first (zeros at the top)
+		std::vector<uint8_t> rows;
+		std::vector<uint8_t> above;
+		// Deflated rows, byte aligned after a sync flush
+		std::vector<uint8_t> compressed;
+		// Of the filtered rows, which is what the zlib stream holds
+		uint32_t adler;
+		size_t filteredBytes;
+		std::future<void> done;
+	};
+
+	BufferedSink mOut;
+	size_t mWidth;
+	size_t mHeight;
+	size_t mChannels;
+	size_t mBitDepth;
+	// Filters work on whole pixels' worth of bytes
+	size_t mPixelBytes;
+	Level mLevel;
+	ThreadPool* mPool;
+	size_t mRowsPerBand;
+	size_t mRowsWritten;
+	// The band being filled, and the last row of the one before it
+	std::unique_ptr<Band> mPending;
+	std::vector<uint8_t> mLastRow;
+	// Bands being encoded, oldest first
+	std::deque<std::unique_ptr<Band>> mInFlight;
+	bool mHeaderWritten;
+	uint32_t mAdler;
+
+	static void encode_band(Band& band, size_t width, size_t pixelBytes, Level level);
+	// Starts encoding mPending
+	void dispatch();
+	// Waits for the oldest band in flight and writes it out
+	void write_oldest();
+	void write_chunk(const char type[4], std::span<const uint8_t> data);
+public:
+	// `channels` is 1 (gray), 2 (gray + alpha), 3 (RGB) or 4 (RGBA), and
+	// `bitDepth` is 8 or 16. Without a pool, bands are encoded on the calling
+	// thread. Writes the header right away.
+	PngEncoder(BufferedSink::Sink sink, size_t width, size_t height, size_t channels, Level level = Level::DEFAULT, ThreadPool* pool = nullptr, size_t bitDepth = 8);
+	// Waits for any bands still in flight
+	~PngEncoder() noexcept;
+
+	PngEncoder(const PngEncoder&) = delete;
+	PngEncoder& operator=(const PngEncoder&) = delete;
+
+	// Encodes the next rows, top to bottom. `rows` holds whole rows of
+	// tightly packed pixels, 16 bit samples big endian as PNG stores them.
+	// Returns false if the sink has failed.
+	bool write_rows(std::span<const uint8_t> rows);
+	// Writes the last IDAT (with the combined Adler-32) & IEND, once every
+	// row is in. Returns false if the sink failed at any point.
+	bool finish();
+
+	size_t rows_written() const { return mRowsWritten; }
+};
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+#include "terrapainter/buffered_sink.h"
+
+// Writes "Quite OK Image" files (https://qoiformat.org) a few rows at a time.
+//
+// QOI is lossless and trivial to encode: each pixel is either a run of the
+// last one, a hit in a 64 entry table of recent colors, a small difference
+// from the last pixel, or the raw value. That's something like ten times
+// faster than PNG for a file maybe a third bigger, which makes it good for
+// quick scratch saves. It only does 8 bit RGB(A), so heightmaps can't use it.
+class QoiEncoder {
+public:
+	// The spec's limit, so decoders know how much they might have to allocate
+	static constexpr size_t MAX_PIXELS = 400000000;
+private:
+	BufferedSink mOut;
+	size_t mWidth;
+	size_t mHeight;
+	size_t mChannels;
+	size_t mRowsWritten;
+	// RGBA of the previous pixel, and of recent pixels by hash
+	std::array<uint8_t, 4> mPrev;
+	std::array<std::array<uint8_t, 4>, 64> mIndex;
+	// Length of the run of mPrev not written yet
+	int mRun;
+public:
+	// `channels` is 3 (RGB) or 4 (RGBA). Writes the header right away.
+	QoiEncoder(BufferedSink::Sink sink, size_t width, size_t height, size_t channels);
+
+	QoiEncoder(const QoiEncoder&) = delete;
+	QoiEncoder& operator=(const QoiEncoder&) = delete;
+
+	// Encodes the next rows, top to bottom. `rows` holds whole rows of
+	// tightly packed pixels. Returns false if the sink has failed.
+	bool write_rows(std::span<const uint8_t> rows);
+	// Writes the last run & the end marker, once every row is in.
+	// Returns false if the sink failed at any point.
+	bool finish();
+
+	// Decodes a whole file into tightly packed RGBA rows, top to bottom.
+	// Returns false if it's malformed.
+	static bool decode(std::span<const uint8_t> file, size_t& width, size_t& height, std::vector<uint8_t>& pixels);
+};
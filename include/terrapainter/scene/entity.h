@@ -28,7 +28,14 @@ private:
 	// Position aka translation
 	vec3 mPosition;
 	// XYZ angles (aka: rotation around X axis, Y axis, Z axis)
-	vec3 mAngles;
+	// These are only kept up to date lazily when the entity was
+	// oriented with set_orientation, see mAnglesStale.
+	mutable vec3 mAngles;
+	// The same rotation as mAngles. This is what transform baking
+	// actually uses, since it converts to a matrix without any trig.
+	quat mOrientation;
+	// Set when mOrientation changed without going through set_angles
+	mutable bool mAnglesStale;
 	// Axis scale
 	vec3 mScale;
 
@@ -68,6 +75,7 @@ private:
 	}
 protected:
 	Entity(vec3 position, vec3 angles, vec3 scale);
+	Entity(vec3 position, quat orientation, vec3 scale);
 
 public:
 	virtual ~Entity() noexcept;
@@ -89,12 +97,29 @@ public:
 	}
 
 	// XYZ angles
-	vec3 angles() const { return mAngles; };
+	vec3 angles() const {
+		if (mAnglesStale) {
+			mAngles = mOrientation.to_angles_xyz();
+			mAnglesStale = false;
+		}
+		return mAngles;
+	};
 	void set_angles(vec3 angles) { 
 		mAngles = angles; 
+		mOrientation = quat::rotate_xyz(angles.x, angles.y, angles.z);
+		mAnglesStale = false;
 		set_world_transform_dirty();
 	};
 
+	// The entity's rotation. Prefer this over angles() when the
+	// actual direction vectors are needed, since it avoids trig.
+	quat orientation() const { return mOrientation; }
+	void set_orientation(quat orientation) {
+		mOrientation = orientation;
+		mAnglesStale = true;
+		set_world_transform_dirty();
+	}
+
 	vec3 scale() const { return mScale; }
 	void set_scale(vec3 scale) { 
 		mScale = scale;
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <future>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads running jobs in the order they were submitted.
+// For CPU work which splits into independent pieces (i.e. encoding an image
+// in bands), nothing here touches OpenGL.
+class ThreadPool {
+	std::vector<std::thread> mThreads;
+	std::mutex mMutex;
+	std::condition_variable mWake;
+	std::deque<std::packaged_task<void()>> mJobs;
+	bool mStopping;
+
+	void work();
+public:
+	// Zero means one per hardware thread
+	explicit ThreadPool(size_t threads = 0);
+	// Finishes every queued job first
+	~ThreadPool() noexcept;
+
+	ThreadPool(const ThreadPool&) = delete;
+	ThreadPool& operator=(const ThreadPool&) = delete;
+
+	// Queues `job`. The future becomes ready once it has run, and rethrows
+	// anything it threw.
+	std::future<void> submit(std::function<void()> job);
+
+	size_t size() const { return mThreads.size(); }
+};
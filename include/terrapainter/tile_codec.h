@@ -0,0 +1,23 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+#include <span>
+#include <vector>
+
+// A tiny lossless codec for small image tiles (undo history, etc).
+//
+// Each channel is split into its own plane and every pixel is replaced with
+// its difference from the pixel to its left (or above, at the start of a
+// row). That turns flat areas and smooth gradients (i.e. most of a heightmap)
+// into long runs of a single byte, which are then run-length encoded,
+// PackBits style. This is nowhere near as tight as deflate, but it's cheap
+// enough to run on the main thread.
+namespace tile_codec {
+	// Compresses `pixels`, which is `width * height` tightly packed pixels
+	// of `channels` bytes each.
+	std::vector<uint8_t> encode(std::span<const uint8_t> pixels, size_t width, size_t height, size_t channels);
+	// Decompresses the output of `encode` into `pixels`, which must be
+	// exactly the size of the original. Returns false on malformed input.
+	bool decode(std::span<const uint8_t> encoded, std::span<uint8_t> pixels, size_t width, size_t height, size_t channels);
+}
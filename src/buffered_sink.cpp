@@ -0,0 +1,23 @@
+#include "terrapainter/buffered_sink.h"
+
+BufferedSink::BufferedSink(Sink sink) : mSink(std::move(sink)) {
+	mBuffer.reserve(CHUNK_SIZE);
+	mFailed = false;
+}
+void BufferedSink::pass_on(std::span<const uint8_t> bytes) {
+	if (!mFailed && !bytes.empty() && !mSink(bytes)) mFailed = true;
+}
+void BufferedSink::write(std::span<const uint8_t> bytes) {
+	if (bytes.size() >= CHUNK_SIZE) {
+		// Not worth copying, but whatever's buffered has to go first
+		flush();
+		pass_on(bytes);
+		return;
+	}
+	mBuffer.insert(mBuffer.end(), bytes.begin(), bytes.end());
+	if (mBuffer.size() >= CHUNK_SIZE) flush();
+}
+void BufferedSink::flush() {
+	pass_on(mBuffer);
+	mBuffer.clear();
+}
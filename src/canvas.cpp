@@ -1,11 +1,15 @@
 #include <algorithm>
+#include <cstring>
+#include <fstream>
 
 #include <imgui/imgui.h>
 #include <imgui/imgui_internal.h>
 #include <stb/stb_image.h>
-#include <stb/stb_image_write.h>
 #include <nfd.hpp>
 
+#include "terrapainter/heightmap_formats.h"
+#include "terrapainter/qoi.h"
+
 #include "shadermgr.h"
 #include "canvas.h"
 #include "helpers.h"
@@ -16,31 +20,34 @@ const char SEPARATOR = '\\';
 const char SEPARATOR = '/';
 #endif
 
-Canvas::Canvas(SDL_Window* window) {
+Canvas::Canvas(SDL_Window* window) : mStrokeBackup(mScratchPool), mProxyBackup(mScratchPool) {
 	mTools = std::vector<std::unique_ptr<ICanvasTool>>();
 	mCurTool = 0;
 	mCanvasOffset = ivec2::zero();
 	mCanvasScaleLog = 0.0f;
 	// We don't know the size or contents of the canvas yet,
-	// but we can still register texture objects for them 
-	// and resize/fill them as needed.
+	// mVirtualCanvas starts out empty until set_canvas is called
 	mCanvasSize = ivec2::zero();
+	mCanvasFormat = CanvasFormat::RGBA8;
+	mStrokeComposited = false;
+	mProxyEditing = true;
+	mProxyScale = 0;
+	mRefining = false;
+	mRefineJob = 0;
+	mReplayNext = 0;
+	mReplayBatch = 0;
+	mReplayRegion = CanvasRegion::empty();
 
-	vec4 border = { 0.0f, 0.0f, 0.0f, 1.0f };
-	glGenTextures(1, &mCanvasTexture);
-	configure_texture(mCanvasTexture, GL_LINEAR, GL_NEAREST, GL_CLAMP_TO_BORDER, GL_CLAMP_TO_BORDER, GL_RGBA8, GL_RGBA);
-	glBindTexture(GL_TEXTURE_2D, mCanvasTexture);
-	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border.data());
-
-	glGenTextures(1, &mCanvasDstTexture);
-	configure_texture(mCanvasDstTexture, GL_LINEAR, GL_NEAREST, GL_CLAMP_TO_BORDER, GL_CLAMP_TO_BORDER, GL_RGBA8, GL_RGBA);
-	glBindTexture(GL_TEXTURE_2D, mCanvasDstTexture);
-	glTexParameterfv(GL_TEXTURE_2D, GL_TEXTURE_BORDER_COLOR, border.data());
-
-	mCanvasProgram = g_shaderMgr.graphics("simple_2d");
+	mCanvasProgram = g_shaderMgr.graphics("canvas_display");
+	glGenSamplers(1, &mOverlaySampler);
+	glSamplerParameteri(mOverlaySampler, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glSamplerParameteri(mOverlaySampler, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glSamplerParameteri(mOverlaySampler, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glSamplerParameteri(mOverlaySampler, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
 	glGenVertexArrays(1, &mCanvasVAO);
 	glGenBuffers(1, &mCanvasVBO);
 	configure_quad(mCanvasVAO, mCanvasVBO);
+	mStrokeModifier = false;
 	mHeldKey = SDLK_0; // doesn't matter
 	mLastMousePos = ivec2::zero(); // doesn't matter
 	mWindow = window;
@@ -49,13 +56,12 @@ Canvas::Canvas(SDL_Window* window) {
 	mPath = "";
 	mShowNewDialog = false; // TODO change this?
 	mNewDialogCanvasSize = ivec2{ 512, 512 }; // seems reasonable
+	mNewDialogCanvasFormat = CanvasFormat::RGBA8;
 	mDidAStupid = false;
 }
 Canvas::~Canvas() noexcept {
-	assert(mCanvasTexture);
-	glDeleteTextures(1, &mCanvasTexture);
-	assert(mCanvasDstTexture);
-	glDeleteTextures(1, &mCanvasDstTexture);
+	assert(mOverlaySampler);
+	glDeleteSamplers(1, &mOverlaySampler);
 	assert(mCanvasVAO);
 	glDeleteVertexArrays(1, &mCanvasVAO);
 	assert(mCanvasVBO);
@@ -64,8 +70,16 @@ Canvas::~Canvas() noexcept {
 ivec2 Canvas::get_canvas_size() const {
 	return mCanvasSize;
 }
-GLuint Canvas::get_canvas_texture() const {
-	return mCanvasTexture;
+bool Canvas::fits(ivec2 canvasSize) const {
+	if (canvasSize.x > MAX_CANVAS_AXIS || canvasSize.y > MAX_CANVAS_AXIS)
+		return false;
+	return VirtualCanvas::fits(canvasSize) && mStrokeBackup.fits(canvasSize);
+}
+const VirtualCanvas& Canvas::get_virtual_canvas() const {
+	return mVirtualCanvas;
+}
+CanvasFormat Canvas::get_canvas_format() const {
+	return mCanvasFormat;
 }
 std::vector<uint8_t> Canvas::get_canvas() const {
 	size_t numPixels = size_t(mCanvasSize.x) * size_t(mCanvasSize.y);
@@ -73,34 +87,52 @@ std::vector<uint8_t> Canvas::get_canvas() const {
 	if (numPixels == 0) {
 		return pixels;
 	}
-	pixels.resize(numPixels * 4); // 4 bytes per pixel since RGBA
-	glBindTexture(GL_TEXTURE_2D, mCanvasTexture);
-	glGetTexImage(GL_TEXTURE_2D, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data());
+	auto info = canvas_format_info(mCanvasFormat);
+	pixels.resize(numPixels * info.bytesPerPixel);
+	mVirtualCanvas.read(info.format, info.type, pixels.data());
 	return pixels;
 }
-bool Canvas::set_canvas(ivec2 canvasSize, uint8_t* pixels, std::string source) {
+std::vector<float> Canvas::get_heights() const {
+	std::vector<float> heights(size_t(mCanvasSize.x) * size_t(mCanvasSize.y));
+	if (heights.empty()) {
+		return heights;
+	}
+	// GL does the conversion from whatever the format is
+	mVirtualCanvas.read(GL_RED, GL_FLOAT, heights.data());
+	return heights;
+}
+bool Canvas::set_canvas(ivec2 canvasSize, const void* pixels, std::string source, CanvasFormat format) {
 	if (canvasSize.x < 0 || canvasSize.y < 0)
 		return false;
-	if (canvasSize.x > MAX_CANVAS_AXIS || canvasSize.y > MAX_CANVAS_AXIS)
+	if (!fits(canvasSize))
 		return false;
+	// A pending refinement was for the old canvas
+	if (mRefining) {
+		mScheduler.cancel(mRefineJob);
+		mRefining = false;
+		mReplayPoints.clear();
+		mReplayBatches.clear();
+		mReplayPieces.clear();
+	}
+	if (mProxyScale) {
+		mTools.at(mCurTool)->set_proxy_scale(1);
+		mProxyScale = 0;
+		mProxyCanvas.reset(ivec2::zero(), format, nullptr);
+	}
+	// A blank canvas doesn't cost any memory until it's painted on
+	mVirtualCanvas.reset(canvasSize, format, pixels);
 	if (canvasSize != ivec2::zero()) {
-		glBindTexture(GL_TEXTURE_2D, mCanvasTexture);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, canvasSize.x, canvasSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
-		if(!pixels){
-			// that image just got filled with uninitialized memory, let's fix this.
-			uint8_t clearColor[4] = { 0, 0, 0, 255 };
-			glClearTexImage(mCanvasTexture, 0, GL_RGBA, GL_UNSIGNED_BYTE, clearColor);
-		}
-		// Also resize the dst texture, this is overwritten by composite so we don't care about giving it sensible values
-		// We can just leave it uninitialized
-		glBindTexture(GL_TEXTURE_2D, mCanvasDstTexture);
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, canvasSize.x, canvasSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
 		// Inform tools of the change
 		for (auto& tool : mTools) {
-			tool->clear_stroke(canvasSize);
+			tool->clear_stroke(canvasSize, format);
 		}
 	}
+	// Nothing sitting in the pool is the right size anymore
+	mStrokeBackup.reset(canvasSize, format);
+	mScratchPool.purge();
+	mHistory.reset(canvasSize, format);
 	mCanvasSize = canvasSize;
+	mCanvasFormat = format;
 	mModified = false;
 	mShowNewDialog = false;
 	mPath = source;
@@ -116,13 +148,34 @@ bool Canvas::set_canvas(ivec2 canvasSize, uint8_t* pixels, std::string source) {
 	return true;
 }
 Canvas::ToolIndex Canvas::register_tool(std::unique_ptr<ICanvasTool> tool) {
+	tool->attach(mScratchPool, mScheduler);
 	mTools.emplace_back(std::move(tool));
 	return mTools.size() - 1;
 }
 void Canvas::set_current_tool(ToolIndex toolIndex) {
 	assert(toolIndex < mTools.size());
+	// The replay needs the tool which made the stroke
+	mScheduler.finish();
 	mCurTool = toolIndex;
 }
+bool Canvas::undo() {
+	if (mInteractState != InteractState::NONE) return false;
+	mScheduler.finish();
+	CanvasRegion region = mHistory.undo(mVirtualCanvas);
+	if (region.is_empty()) return false;
+	mVirtualCanvas.update_mips(region);
+	mModified = true;
+	return true;
+}
+bool Canvas::redo() {
+	if (mInteractState != InteractState::NONE) return false;
+	mScheduler.finish();
+	CanvasRegion region = mHistory.redo(mVirtualCanvas);
+	if (region.is_empty()) return false;
+	mVirtualCanvas.update_mips(region);
+	mModified = true;
+	return true;
+}
 void Canvas::activate() {
 	glDepthFunc(GL_ALWAYS);
 	glClearColor(0.3f, 0.3f, 0.3f, 1.0f);
@@ -132,6 +185,11 @@ void Canvas::activate() {
 // NOTE: setting state to configure doesn't set the held key
 void Canvas::set_interact_state(InteractState s) {
 	if (mInteractState == s) return;
+	// New strokes start from the real canvas, and configuring the tool
+	// would change the stroke being replayed
+	if (s == InteractState::STROKE || s == InteractState::CONFIGURE) {
+		mScheduler.finish();
+	}
 	
 	// Transition to InteractState::NONE, do cleanup as necessary
 	if (mInteractState == InteractState::NONE) {
@@ -142,9 +200,36 @@ void Canvas::set_interact_state(InteractState s) {
 	}
 	else if (mInteractState == InteractState::STROKE) {
 		// Commit current stroke, clear canvas
-		mTools.at(mCurTool)->composite(mCanvasDstTexture, mCanvasTexture);
-		mTools.at(mCurTool)->clear_stroke(mCanvasSize);
-		std::swap(mCanvasDstTexture, mCanvasTexture);
+		flush_stroke();
+		auto& tool = mTools.at(mCurTool);
+		if (mProxyScale) {
+			// Show the finished stroke on the proxy until the refinement
+			// catches up, which also commits it to the history
+			if (mStrokeComposited) mProxyBackup.restore(mProxyCanvas);
+			// The tool's jobs have to see the canvas without the preview
+			mScheduler.finish();
+			mProxyCanvas.update_mips(tool->composite(mProxyCanvas, CanvasRegion(ivec2::zero(), mProxyCanvas.size())));
+			mProxyBackup.clear();
+			tool->clear_stroke(mCanvasSize, mCanvasFormat);
+			tool->set_proxy_scale(1);
+			mRefining = true;
+			mReplayNext = 0;
+			mReplayBatch = 0;
+			mReplayRegion = CanvasRegion::empty();
+			mRefineJob = mScheduler.submit("canvas: replay stroke", [this](size_t count) { return replay_points(count); });
+		}
+		else {
+			// This has to be recorded before compositing: the history reads
+			// the pre-stroke tiles out of mVirtualCanvas
+			if (mStrokeComposited) mStrokeBackup.restore(mVirtualCanvas);
+			// The tool's jobs have to see the canvas without the preview
+			mScheduler.finish();
+			mHistory.commit(mVirtualCanvas);
+			mVirtualCanvas.update_mips(tool->composite(mVirtualCanvas, CanvasRegion(ivec2::zero(), mCanvasSize)));
+			tool->clear_stroke(mCanvasSize, mCanvasFormat);
+			mStrokeBackup.clear();
+		}
+		mStrokeComposited = false;
 		mModified = true;
 	}
 	else if (mInteractState == InteractState::CONFIGURE) {
@@ -162,8 +247,8 @@ void Canvas::set_interact_state(InteractState s) {
 		// Nothing needs to be done
 	} 
 	else if (mInteractState == InteractState::STROKE) {
-		// Nothing really needs to be done
 		// We allow transitioning to the stroke state without placing an initial stroke
+		begin_proxy_stroke();
 	}
 	else if (mInteractState == InteractState::CONFIGURE) {
 		// You must set mHeldKey first
@@ -172,13 +257,114 @@ void Canvas::set_interact_state(InteractState s) {
 		SDL_SetRelativeMouseMode(SDL_TRUE);
 	}
 }
+VirtualCanvas& Canvas::stroke_canvas() {
+	return mProxyScale ? mProxyCanvas : mVirtualCanvas;
+}
+StrokeBackup& Canvas::stroke_backup() {
+	return mProxyScale ? mProxyBackup : mStrokeBackup;
+}
+void Canvas::flush_stroke() {
+	if (mStrokePoints.empty()) return;
+	if (mProxyScale) {
+		// Kept for the replay, and only then marked in the history
+		mReplayPoints.insert(mReplayPoints.end(), mStrokePoints.begin(), mStrokePoints.end());
+		mReplayBatches.push_back(StrokeBatch{ .end = mReplayPoints.size(), .modifier = mStrokeModifier });
+		for (vec2& point : mStrokePoints) {
+			point = point / float(mProxyScale);
+		}
+	}
+	CanvasRegion region = mTools.at(mCurTool)->update_stroke(stroke_canvas(), mStrokePoints, mStrokeModifier);
+	// Nothing has been composited over these tiles yet
+	stroke_canvas().make_resident(region);
+	stroke_backup().save(stroke_canvas(), region);
+	if (!mProxyScale) mHistory.mark(region);
+	mStrokePoints.clear();
+}
+void Canvas::begin_proxy_stroke() {
+	int axis = std::max(mCanvasSize.x, mCanvasSize.y);
+	if (!mProxyEditing || axis <= PROXY_MAX_AXIS) return;
+	int level = 1;
+	while ((axis >> level) > PROXY_MAX_AXIS) level++;
+	if (!mTools.at(mCurTool)->set_proxy_scale(1 << level)) return;
+	mProxyScale = 1 << level;
+	mProxyCanvas.reset_downsampled(mVirtualCanvas, level);
+	mProxyBackup.reset(mProxyCanvas.size(), mCanvasFormat);
+	mTools.at(mCurTool)->clear_stroke(mProxyCanvas.size(), mCanvasFormat);
+}
+GpuScheduler::Progress Canvas::replay_points(size_t count) {
+	auto& tool = mTools.at(mCurTool);
+	size_t done = 0;
+	while (done < count && mReplayNext < mReplayPoints.size()) {
+		const StrokeBatch& batch = mReplayBatches[mReplayBatch];
+		size_t take = std::min(count - done, batch.end - mReplayNext);
+		CanvasRegion region = tool->update_stroke(mVirtualCanvas, std::span(mReplayPoints).subspan(mReplayNext, take), batch.modifier);
+		mVirtualCanvas.make_resident(region);
+		mHistory.mark(region);
+		mReplayRegion = CanvasRegion::merge(mReplayRegion, region.clamp(mCanvasSize));
+		mReplayNext += take;
+		done += take;
+		if (mReplayNext == batch.end) mReplayBatch++;
+	}
+	if (mReplayNext < mReplayPoints.size()) return { done, false };
+
+	// Nothing's been composited yet, so this is still the pre-stroke canvas
+	mHistory.commit(mVirtualCanvas);
+	// Pieces are canvas tiles, so each one's mips are rebuilt exactly once
+	mReplayPieces.clear();
+	if (!mReplayRegion.is_empty()) {
+		constexpr int TILE = VirtualCanvas::TILE_SIZE;
+		ivec2 first = mReplayRegion.min / TILE;
+		ivec2 last = (mReplayRegion.max - ivec2::splat(1)) / TILE;
+		for (int y = last.y; y >= first.y; y--) {
+			for (int x = last.x; x >= first.x; x--) {
+				CanvasRegion tile(ivec2(x, y) * TILE, ivec2(x + 1, y + 1) * TILE);
+				mReplayPieces.push_back(CanvasRegion::intersect(tile, mReplayRegion));
+			}
+		}
+	}
+	// Anything the tool queued up during the replay (i.e. blur tables) is
+	// ahead of this, so it's done before the first piece
+	mRefineJob = mScheduler.submit("canvas: composite stroke", [this](size_t count) { return replay_pieces(count); });
+	return { done, true };
+}
+GpuScheduler::Progress Canvas::replay_pieces(size_t count) {
+	auto& tool = mTools.at(mCurTool);
+	size_t done = 0;
+	// Popped from the back, so these go bottom to top
+	while (done < count && !mReplayPieces.empty()) {
+		mVirtualCanvas.update_mips(tool->composite(mVirtualCanvas, mReplayPieces.back()));
+		mReplayPieces.pop_back();
+		done++;
+	}
+	if (!mReplayPieces.empty()) return { done, false };
+
+	// The real canvas has caught up, the proxy isn't needed anymore
+	tool->clear_stroke(mCanvasSize, mCanvasFormat);
+	mReplayPoints.clear();
+	mReplayBatches.clear();
+	mRefining = false;
+	mRefineJob = 0;
+	mProxyScale = 0;
+	mProxyCanvas.reset(ivec2::zero(), mCanvasFormat, nullptr);
+	return { std::max<size_t>(done, 1), true };
+}
 void Canvas::deactivate() {
 	set_interact_state(InteractState::NONE);
+	// Whatever's next (i.e. the world) reads the real canvas
+	mScheduler.finish();
 }
 void Canvas::process_key_down(const SDL_KeyboardEvent& event) {
 	const Uint8* keys = SDL_GetKeyboardState(nullptr);
 	bool ctrl = keys[SDL_SCANCODE_LCTRL] || keys[SDL_SCANCODE_RCTRL];
-	if (ctrl && event.keysym.sym == SDLK_n) {
+	bool shift = keys[SDL_SCANCODE_LSHIFT] || keys[SDL_SCANCODE_RSHIFT];
+	if (ctrl && event.keysym.sym == SDLK_z) {
+		if (shift) redo();
+		else undo();
+	}
+	else if (ctrl && event.keysym.sym == SDLK_y) {
+		redo();
+	}
+	else if (ctrl && event.keysym.sym == SDLK_n) {
 		prompt_new();
 	}
 	else if (ctrl && event.keysym.sym == SDLK_s) {
@@ -206,8 +392,8 @@ void Canvas::process_mouse_button_down(const SDL_MouseButtonEvent& event) {
 	const Uint8* keys = SDL_GetKeyboardState(nullptr);
 	if (mInteractState == InteractState::NONE) {
 		if (event.button == SDL_BUTTON_LEFT && !mTools.empty()) {
-			vec2 canvasMouse = cursor_canvas_coords();
-			mTools.at(mCurTool)->update_stroke(canvasMouse, keys[SDL_SCANCODE_LSHIFT]);
+			mStrokePoints.push_back(cursor_canvas_coords());
+			mStrokeModifier = keys[SDL_SCANCODE_LSHIFT];
 			set_interact_state(InteractState::STROKE);
 		}
 		else if (event.button == SDL_BUTTON_RIGHT) {
@@ -230,8 +416,8 @@ void Canvas::process_mouse_motion(const SDL_MouseMotionEvent& event) {
 		mCanvasOffset += delta;
 	}
 	else if (mInteractState == InteractState::STROKE) {
-		vec2 canvasMouse = cursor_canvas_coords();
-		mTools.at(mCurTool)->update_stroke(canvasMouse, keys[SDL_SCANCODE_LSHIFT]);
+		mStrokePoints.push_back(cursor_canvas_coords());
+		mStrokeModifier = keys[SDL_SCANCODE_LSHIFT];
 	}
 	else if (mInteractState == InteractState::CONFIGURE) {
 		mTools.at(mCurTool)->update_param(mHeldKey, delta, keys[SDL_SCANCODE_LSHIFT]);
@@ -268,13 +454,29 @@ void Canvas::process_event(const SDL_Event& event) {
 		process_mouse_wheel(event.wheel);
 	}
 }
-void Canvas::process_frame(float deltaTime) {}
+void Canvas::process_frame(float deltaTime) {
+	if (mInteractState == InteractState::STROKE) flush_stroke();
+	mHistory.update();
+	mScratchPool.trim();
+}
 void Canvas::render(ivec2 viewportSize) {
-	GLuint image = mCanvasTexture;
-	// Composite current stroke, if there's a stroke to composite
-	if (!mTools.empty() && mInteractState == InteractState::STROKE) {
-		mTools.at(mCurTool)->composite(mCanvasDstTexture, mCanvasTexture);
-		image = mCanvasDstTexture;
+	StrokeOverlay overlay;
+	bool stroking = !mTools.empty() && mInteractState == InteractState::STROKE;
+	if (stroking) overlay = mTools.at(mCurTool)->overlay();
+	// The last frame's preview went straight into the canvas. Jobs expect
+	// to see the canvas without it, so it's undone before they run.
+	VirtualCanvas& strokeCanvas = stroke_canvas();
+	if (mStrokeComposited) {
+		stroke_backup().restore(strokeCanvas);
+		mStrokeComposited = false;
+	}
+	mScheduler.run();
+	// Show the current stroke, if there is one. Preferably this is drawn
+	// over the canvas, so the real composite only happens once on commit.
+	if (stroking && overlay.mode == StrokeOverlay::Mode::NONE) {
+		// The stroke only grows, so this covers everything restore() put back
+		strokeCanvas.update_mips(mTools.at(mCurTool)->composite(strokeCanvas, CanvasRegion(ivec2::zero(), strokeCanvas.size())));
+		mStrokeComposited = true;
 	}
 	// 2x to account for the fact that OpenGL uses [-1, 1] not [0, 1]
 	vec2 relativeOffset = 2 * vec2(mCanvasOffset) / vec2(viewportSize);
@@ -290,11 +492,22 @@ void Canvas::render(ivec2 viewportSize) {
 	glBindVertexArray(mCanvasVAO);
 	glUseProgram(mCanvasProgram->id());
 	glUniformMatrix3fv(0, 1, GL_TRUE, xform.data());
-	glActiveTexture(GL_TEXTURE0);
-	glBindTexture(GL_TEXTURE_2D, image);
-	glUniform1i(1, 0);
 	glUniform4f(2, 1.0f, 1.0f, 1.0f, 1.0f);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, overlay.texture);
+	glBindSampler(3, mOverlaySampler);
+	glUniform1i(3, 3);
+	glUniform1i(4, int(overlay.mode));
+	glUniform4fv(5, 1, overlay.color.data());
+	glUniform1i(6, canvas_format_info(mCanvasFormat).singleChannel);
+	// The proxy covers the same area, just with fewer texels
+	(mProxyScale ? mProxyCanvas : mVirtualCanvas).bind(7, 0);
+	glUniform2iv(11, 1, overlay.origin.data());
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+	glBindSampler(3, 0);
+	glActiveTexture(GL_TEXTURE3);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	glActiveTexture(GL_TEXTURE0);
 	glUseProgram(0);
 
 	// mCurTool should always be valid unless we have no tools at all
@@ -354,23 +567,83 @@ bool Canvas::prompt_open() {
 		if (response == SaveResponse::SAVE && !prompt_save())
 			return false;
 	}
-	nfdu8filteritem_t filters[1] = { { "Images", "png,jpg,tga,bmp,psd,gif" } };
+	nfdu8filteritem_t filters[2] = {
+		{ "Images", "png,jpg,tga,bmp,psd,gif,qoi" },
+		{ "Heightmaps", "png,r16,raw,pfm,tif,tiff" },
+	};
 	NFD::UniquePathU8 path = nullptr;
-	auto res = NFD::OpenDialog(path, filters, 1);
+	auto res = NFD::OpenDialog(path, filters, 2);
+	auto fileFormat = res == NFD_OKAY ? CanvasSaver::file_format(path.get()) : CanvasSaver::FileFormat::PNG;
+	auto read_file = [&] {
+		std::ifstream file(path.get(), std::ios::binary);
+		return std::vector<uint8_t>((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+	};
 	if (res == NFD_ERROR) {
 		fprintf(stderr, "[error] internal error (load dialog)");
 	}
+	else if (fileFormat == CanvasSaver::FileFormat::QOI) {
+		// stb_image doesn't know QOI
+		auto bytes = read_file();
+		size_t width, height;
+		std::vector<uint8_t> pixels;
+		if (QoiEncoder::decode(bytes, width, height, pixels)) {
+			// Files go top to bottom, the canvas goes bottom to top
+			size_t rowBytes = width * 4;
+			for (size_t y = 0; y < height / 2; y++) {
+				std::swap_ranges(pixels.begin() + y * rowBytes, pixels.begin() + (y + 1) * rowBytes, pixels.begin() + (height - 1 - y) * rowBytes);
+			}
+			return set_canvas(ivec2(int(width), int(height)), pixels.data(), path.get(), CanvasFormat::RGBA8);
+		}
+		fprintf(stderr, "[error] \"%s\" isn't a valid QOI image\n", path.get());
+	}
+	else if (fileFormat == CanvasSaver::FileFormat::RAW16) {
+		// These can be huge, so they're streamed in from disk rather than decoded
+		ivec2 canvasSize = CanvasLoader::raw_size(path.get());
+		if (canvasSize == ivec2::zero()) {
+			fprintf(stderr, "[error] couldn't read \"%s\" (raw heightmaps have to be square)\n", path.get());
+			return false;
+		}
+		if (!set_canvas(canvasSize, nullptr, path.get(), CanvasFormat::R16)) {
+			fprintf(stderr, "[error] \"%s\" is too big for a canvas\n", path.get());
+			return false;
+		}
+		if (!mLoader.load_raw(mVirtualCanvas, path.get())) {
+			// Whatever's in there isn't the file
+			set_canvas(ivec2::zero(), nullptr);
+			return false;
+		}
+		return true;
+	}
+	else if (fileFormat != CanvasSaver::FileFormat::PNG) {
+		// Decoded straight into canvas order, and uploaded as is
+		auto bytes = read_file();
+		size_t width, height;
+		std::vector<uint16_t> heights;
+		float low, high;
+		if (HeightmapEncoder::decode(CanvasSaver::heightmap_format(fileFormat), bytes, width, height, heights, low, high)) {
+			if (low != 0.0f || high != 1.0f) {
+				fprintf(stderr, "[info] heights from %g to %g were rescaled to fit\n", low, high);
+			}
+			return set_canvas(ivec2(int(width), int(height)), heights.data(), path.get(), CanvasFormat::R16);
+		}
+		if (fileFormat == CanvasSaver::FileFormat::TIFF) {
+			fprintf(stderr, "[error] couldn't read TIFF \"%s\" (only uncompressed, untiled ones are supported)\n", path.get());
+		}
+		else {
+			fprintf(stderr, "[error] \"%s\" isn't a valid PFM heightmap\n", path.get());
+		}
+	}
 	else if (res == NFD_OKAY) {
 		ivec2 canvasSize;
-		stbi_uc* pixels = stbi_load(
-			path.get(), 
-			&canvasSize.x, 
-			&canvasSize.y,
-			nullptr,
-			4);
+		// 16 bit images are heightmaps, don't throw away their precision
+		bool is16 = stbi_is_16_bit(path.get());
+		void* pixels = is16
+			? (void*)stbi_load_16(path.get(), &canvasSize.x, &canvasSize.y, nullptr, 1)
+			: (void*)stbi_load(path.get(), &canvasSize.x, &canvasSize.y, nullptr, 4);
 
 		if (pixels) {
-			set_canvas(canvasSize, pixels, path.get());
+			set_canvas(canvasSize, pixels, path.get(), is16 ? CanvasFormat::R16 : CanvasFormat::RGBA8);
+			stbi_image_free(pixels);
 			return true;
 		}
 		else {
@@ -380,11 +653,27 @@ bool Canvas::prompt_open() {
 	return false;
 }
 bool Canvas::prompt_save() {
-	fprintf(stderr, "[info] dumping texture...");
-	auto pixels = get_canvas();
-	fprintf(stderr, " complete\n");
+	// Only one save at a time
+	if (auto saved = mSaver.finish(); saved && !*saved) mModified = true;
+	// The last frame's stroke preview isn't part of the canvas yet
+	if (mStrokeComposited) {
+		stroke_backup().restore(stroke_canvas());
+		mStrokeComposited = false;
+	}
+	mScheduler.finish();
 
-	nfdu8filteritem_t filters[1] = { { "PNG Images", "png" } };
+	// QOI is much quicker to write, but only holds 8 bit color.
+	// Heightmaps take the red channel of color canvases.
+	nfdu8filteritem_t pngFilter = { "PNG Images", "png" };
+	nfdu8filteritem_t qoiFilter = { "QOI Images", "qoi" };
+	nfdu8filteritem_t heightmapFilters[3] = {
+		{ "Raw Heightmaps", "r16,raw" },
+		{ "Float Heightmaps", "pfm" },
+		{ "TIFF Heightmaps", "tif,tiff" },
+	};
+	std::vector<nfdu8filteritem_t> filters = { pngFilter };
+	if (mCanvasFormat == CanvasFormat::RGBA8) filters.push_back(qoiFilter);
+	filters.insert(filters.end(), std::begin(heightmapFilters), std::end(heightmapFilters));
 	NFD::UniquePathU8 path = nullptr;
 
 	std::string parent = "";
@@ -396,8 +685,8 @@ bool Canvas::prompt_save() {
 	}
 	auto res = NFD::SaveDialog(
 		path,
-		filters,
-		1,
+		filters.data(),
+		nfdfiltersize_t(filters.size()),
 		parent.empty() ? nullptr : parent.c_str(),
 		filename.c_str());
 
@@ -405,19 +694,19 @@ bool Canvas::prompt_save() {
 		fprintf(stderr, "[error] internal error (save dialog)\n");
 	}
 	else if (res == NFD_OKAY) {
-		stbi_write_png(
-			path.get(), 
-			mCanvasSize.x, 
-			mCanvasSize.y, 
-			4, 
-			pixels.data(), 
-			mCanvasSize.x * 4);
-		fprintf(stderr, "[info] image saved to \"%s\"\n", path.get());
+		// This snapshots the canvas, painting can carry on right away
+		if (!mSaver.start(mVirtualCanvas, path.get()))
+			return false;
+		// Anything painted from here on is a new change
 		mModified = false;
 		return true;
 	}
 	return false;
 }
+void Canvas::update_save() {
+	auto saved = mSaver.update();
+	if (saved && !*saved) mModified = true;
+}
 void Canvas::run_tool_menu() {
 	auto windowFlags = ImGuiWindowFlags_AlwaysAutoResize;
 	if (ImGui::Begin("Tool Panel", nullptr, windowFlags)) {
@@ -431,7 +720,10 @@ void Canvas::run_tool_menu() {
 			}
 		}
 		ImGui::Text("Tool Configuration");
+		// Changing the tool's settings would change the stroke being replayed
+		ImGui::BeginDisabled(mRefining);
 		if (!mTools.empty()) mTools.at(mCurTool)->run_ui();
+		ImGui::EndDisabled();
 	}
 	ImGui::End();
 }
@@ -447,6 +739,38 @@ void Canvas::run_main_menu() {
 			if (ImGui::MenuItem("Save", "S", nullptr)) {
 				prompt_save();
 			}
+			bool fast = mSaver.fast();
+			if (ImGui::MenuItem("Fast PNG Compression", nullptr, &fast)) {
+				mSaver.set_fast(fast);
+			}
+			ImGui::EndMenu();
+		}
+		if (ImGui::BeginMenu("Edit")) {
+			bool idle = mInteractState == InteractState::NONE;
+			if (ImGui::MenuItem("Undo", "Ctrl+Z", nullptr, idle && mHistory.undo_count() > 0)) {
+				undo();
+			}
+			if (ImGui::MenuItem("Redo", "Ctrl+Y", nullptr, idle && mHistory.redo_count() > 0)) {
+				redo();
+			}
+			ImGui::Separator();
+			bool compress = mHistory.compression();
+			if (ImGui::MenuItem("Compress History", nullptr, &compress)) {
+				mHistory.set_compression(compress);
+			}
+			ImGui::MenuItem("Proxy Editing", nullptr, &mProxyEditing);
+			if (ImGui::IsItemHovered()) {
+				ImGui::SetTooltip("Slow tools paint on a %dpx preview of big canvases,\n"
+					"which is refined to full resolution after each stroke", PROXY_MAX_AXIS);
+			}
+			float jobBudget = mScheduler.budget();
+			if (ImGui::SliderFloat("Background Work (ms/frame)", &jobBudget, 1.0f, 16.0f, "%.1f")) {
+				mScheduler.set_budget(jobBudget);
+			}
+			int budgetMB = int(mHistory.budget() >> 20);
+			if (ImGui::SliderInt("History Budget (MB)", &budgetMB, 16, 4096, "%d", ImGuiSliderFlags_Logarithmic)) {
+				mHistory.set_budget(size_t(budgetMB) << 20);
+			}
 			ImGui::EndMenu();
 		}
 		ImGui::EndMainMenuBar();
@@ -482,6 +806,18 @@ void Canvas::run_status_bar() {
 			// ImGui::Text("Offset: %i,%i", mCanvasOffset.x, mCanvasOffset.y);
 			vec2 cursor = cursor_canvas_coords();
 			ImGui::Text("Cursor: (%5g,%5g)\t", cursor.x, cursor.y);
+			ImGui::Text("History: %zu/%zu (%.1f MB)\t", mHistory.undo_count(), mHistory.undo_count() + mHistory.redo_count(), mHistory.memory_usage() / 1048576.0);
+			ImGui::Text("Canvas: %.1f MB (%zu/%zu tiles)\t", mVirtualCanvas.memory_usage() / 1048576.0, mVirtualCanvas.resident_count(), mVirtualCanvas.tile_count());
+			ImGui::Text("Scratch: %.1f MB (peak %.1f MB)\t", mScratchPool.memory_usage() / 1048576.0, mScratchPool.peak_memory_usage() / 1048576.0);
+			if (mSaver.busy()) {
+				ImGui::Text("Saving: %d%%\t", int(mSaver.progress() * 100.0f));
+			}
+			if (mRefining) {
+				ImGui::Text("Refining stroke...\t");
+			}
+			else if (!mScheduler.idle()) {
+				ImGui::Text("Working...\t");
+			}
 			ImGui::EndMenuBar();
 		}
 	}
@@ -493,6 +829,11 @@ void Canvas::run_new_dialog() {
 	if (ImGui::Begin("New Canvas", &mShowNewDialog, ImGuiWindowFlags_AlwaysAutoResize)) {
 		ImGui::InputInt("Width", &mNewDialogCanvasSize.x, 16, 256);
 		ImGui::InputInt("Height", &mNewDialogCanvasSize.y, 16, 256);
+		int format = int(mNewDialogCanvasFormat);
+		ImGui::RadioButton("Color (RGBA8)", &format, int(CanvasFormat::RGBA8));
+		ImGui::SameLine();
+		ImGui::RadioButton("Heightmap (R16)", &format, int(CanvasFormat::R16));
+		mNewDialogCanvasFormat = CanvasFormat(format);
 		if (mDidAStupid) {
 			ImGui::PushStyleColor(ImGuiCol_Text, IM_COL32(255, 31, 31, 255));
 			ImGui::Text("Please enter a valid size.");
@@ -501,16 +842,15 @@ void Canvas::run_new_dialog() {
 		if (ImGui::Button("Create")) {
 			if (
 				mNewDialogCanvasSize.x < 0 ||
-				mNewDialogCanvasSize.x > MAX_CANVAS_AXIS ||
 				mNewDialogCanvasSize.y < 0 ||
-				mNewDialogCanvasSize.y > MAX_CANVAS_AXIS
+				!fits(mNewDialogCanvasSize)
 			) {
 				mDidAStupid = true;
 			}
 			else {
 				mDidAStupid = false;
 				// This automatically hides the new dialog
-				set_canvas(mNewDialogCanvasSize, nullptr);
+				set_canvas(mNewDialogCanvasSize, nullptr, "", mNewDialogCanvasFormat);
 			}
 		}
 	}
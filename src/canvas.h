@@ -25,42 +25,12 @@
 //  𐌢 Change cursor to "hitmarker" when not over UI element?
 //  ✔️ ~~Somehow dock brush stroke UI to the side of the screen~~ nah
 //  ✔️ More keyboard shortcuts!!!
-//  𐌢 Undo/Redo
-
-// ==== Considerations for undo/redo =====
-// A 1920x1080 texture w/ 8bit RGBA is 8MB
-// The Iceland heightmap is 18MB in GPU memory
-// 
-// To keep memory pressure light, we don't want
-// to keep the undo textures on the GPU...
-// Instead we want to transfer them to main memory
-// This is a really slow operation so we should do it
-// async with a pixel buffer object
-// 
-// This requires keeping the old texture valid so we shouldn't
-// final-composite onto the current mCanvasTexture, we should 
-// copy it and shove the old one in a command object along with
-// a sync object, create a PBO and set up the transfer
-// 
-// However if the user undoes *before* the transfer completes,
-// we should swap the current mCanvasTexture with the previous texture
-// Do we delete the mCanvasTexture we just discarded? No -- we've
-// gotta repeat the same process except now we stick it in the redo
-// stack.
-//
-// Again, to keep memory light, we should somehow record which ranges
-// of the image were modified. GIMP uses a tile-based system where they
-// simply copy out hit tiles. We don't need to be that advanced, we
-// can probably get away with minX/minY and maxX/maxY since we already
-// compute that for the brush compute shader
-//
-// If this *actually* causes issues in practice we should move to tiles
-// since there are a ton of pathological cases for minmax
-// 
-// To destroy the associated GPU resources we'll ideally check status of
-// sync objects each frame
+//  ✔️ Undo/Redo
+//		|-> Went with tiles after all, see history.h
 
+#include <climits>
 #include <memory>
+#include <span>
 #include <vector>
 #include <string>
 
@@ -69,22 +39,87 @@
 #include "terrapainter/math.h"
 #include "terrapainter.h"
 #include "shadermgr.h"
+#include "canvas_format.h"
+#include "history.h"
+#include "stroke_backup.h"
+#include "virtual_canvas.h"
+#include "scratch_pool.h"
+#include "gpu_scheduler.h"
+#include "canvas_loader.h"
+#include "canvas_saver.h"
 
-// The maximum supported size of the axis of a Canvas texture.
-constexpr size_t MAX_CANVAS_AXIS = 8192;
+// The maximum supported size of the axis of a Canvas. Canvas positions go
+// through floats in a few places (the display, splats), which are still exact
+// to a fraction of a pixel at this size. What the GPU can hold is usually the
+// tighter limit though, see Canvas::fits.
+constexpr size_t MAX_CANVAS_AXIS = 65536;
+// Canvases bigger than this along either axis are edited through a proxy
+// (when the tool & user allow it), which is downsampled to at most this size.
+constexpr int PROXY_MAX_AXIS = 2048;
 
 struct CanvasRegion {
 	ivec2 min; // Min X & Y coordinates of the region
 	ivec2 max; // Max X & Y coordinates of the region
 
+	// Default constructed regions are empty
+	CanvasRegion() : min(ivec2::splat(INT_MAX)), max(ivec2::splat(INT_MIN)) {}
 	CanvasRegion(ivec2 min, ivec2 max) : min(min), max(max) {}
 	CanvasRegion(vec2 point, float radius) {
 		min = ivec2(point - vec2::splat(radius));
 		max = ivec2(point + vec2::splat(0.5 + radius));
 	}
+	// A region containing nothing, which is the identity for `merge`
+	static CanvasRegion empty() {
+		return CanvasRegion();
+	}
 	static CanvasRegion merge(const CanvasRegion& a, const CanvasRegion& b) {
 		return CanvasRegion(math::vmin(a.min, b.min), math::vmax(a.max, b.max));
 	}
+	static CanvasRegion intersect(const CanvasRegion& a, const CanvasRegion& b) {
+		return CanvasRegion(math::vmax(a.min, b.min), math::vmin(a.max, b.max));
+	}
+	bool is_empty() const {
+		return min.x >= max.x || min.y >= max.y;
+	}
+	// Whether `other` lies entirely within this region
+	bool contains(const CanvasRegion& other) const {
+		return other.is_empty() || (
+			min.x <= other.min.x && min.y <= other.min.y &&
+			max.x >= other.max.x && max.y >= other.max.y);
+	}
+	// Expands the region by `amount` pixels on every side
+	CanvasRegion grow(int amount) const {
+		if (is_empty()) return *this;
+		return CanvasRegion(min - ivec2::splat(amount), max + ivec2::splat(amount));
+	}
+	// Clamps the region to the bounds of a canvas of the given size
+	CanvasRegion clamp(ivec2 canvasSize) const {
+		return intersect(*this, CanvasRegion(ivec2::zero(), canvasSize));
+	}
+	// Dimensions of the region. Only meaningful if the region isn't empty.
+	ivec2 size() const {
+		return max - min;
+	}
+};
+
+// Describes how to draw an in-progress stroke over the canvas at display time,
+// so the canvas doesn't have to be composited every frame just to show it.
+// This must produce the same result as the tool's composite shader.
+struct StrokeOverlay {
+	enum class Mode {
+		// Can't be drawn as an overlay; the canvas composites each frame instead
+		NONE = 0,
+		// `texture`'s red channel is the coverage of `color` (which includes alpha)
+		MASK = 1,
+		// `texture` is a straight-alpha RGBA buffer drawn over the canvas
+		BUFFER = 2,
+	};
+	Mode mode = Mode::NONE;
+	GLuint texture = 0;
+	// Canvas pixel of `texture`'s first texel. It only covers the stroke,
+	// and the overlay is clear outside of it.
+	ivec2 origin = ivec2::zero();
+	vec4 color = vec4::splat(1);
 };
 
 // Abstract interface for canvas tools
@@ -94,20 +129,52 @@ public:
 	virtual ~ICanvasTool() noexcept = 0;
 	// Returns the human-readable tool name.
 	virtual const char* name() const = 0;
+	// Called once, when the tool is registered. Scratch textures should come
+	// from `pool`, only cover what the stroke needs (see ScratchRegion), and
+	// only be held while a stroke is in progress.
+	// Anything slow enough to hitch on a big canvas should be a job on
+	// `scheduler`. Its jobs run when the canvas holds no stroke preview, and
+	// it's finished before the final composite of a stroke.
+	virtual void attach(ScratchPool& pool, GpuScheduler& scheduler) = 0;
 	// Clears stroke state to prepare for a fresh canvas texture.
-	// canvasSize is guaranteed to be positive.
-	virtual void clear_stroke(ivec2 canvasSize) = 0;
-	// Creates or continues the current stroke. Strokes are ended by `reset`.
+	// canvasSize is guaranteed to be positive. composite's textures
+	// will be in canvasFormat until the next call.
+	virtual void clear_stroke(ivec2 canvasSize, CanvasFormat canvasFormat) = 0;
+	// Creates or continues the current stroke through each of `points`, in order.
+	// These are all the cursor positions since the last call, usually one frame's
+	// worth. Strokes are ended by `clear_stroke`.
 	// `modifier` indicates whether the modifier key (shift) is being held.
-	virtual void update_stroke(vec2 canvasMouse, bool modifier) = 0;
+	// `canvas` is the one the stroke is being made on. It may hold a preview
+	// of the stroke right now, so anything which reads it has to be a job.
+	// Returns a bound on the region this call may have modified.
+	virtual CanvasRegion update_stroke(const VirtualCanvas& canvas, std::span<const vec2> points, bool modifier) = 0;
 	// TODO: explain
 	virtual bool understands_param(SDL_Keycode keyCode) = 0;
 	// TODO: A bit complicated to explain
 	// TODO: Leaking SDL details here is really ugly
 	virtual void update_param(SDL_Keycode keyCode, ivec2 mouseDelta, bool modifier) = 0;
-	// Composites the tool's output with the current Canvas content.
-	// Returns a maximal bound on the modified region.
-	virtual void composite(GLuint dst, GLuint src) = 0;
+	// Asks the tool to make strokes on a proxy canvas `scale` times smaller
+	// along each axis than the real one, until it's called again with 1.
+	// Sizes given in canvas pixels (brush radius etc) should be divided by
+	// `scale`. Returns false if the tool would rather not, in which case
+	// nothing changes. Only called between strokes.
+	// Proxied strokes are later replayed on the real canvas (see Canvas), so
+	// tools must only say yes if replaying the same points gives the same
+	// result, and if their strokes are slow enough to be worth it.
+	virtual bool set_proxy_scale(int scale) = 0;
+	// Composites the tool's output into `canvas`, in place.
+	// Only the returned region is written, which bounds everything the
+	// stroke has touched so far within `clip`. The rest of the canvas is
+	// left as-is, so a stroke can be composited a piece at a time.
+	// When this is called, the canvas holds what it did before the stroke
+	// (see StrokeBackup), apart from earlier pieces of the same stroke, and
+	// every tile the stroke touched is resident. Since it's written in place,
+	// the composite itself may only read the canvas at the texel it's writing,
+	// and anything else it reads must be read before the first piece.
+	virtual CanvasRegion composite(VirtualCanvas& canvas, const CanvasRegion& clip) = 0;
+	// Returns how the current stroke can be previewed over the canvas.
+	// Tools which return Mode::NONE have composite called every frame instead.
+	virtual StrokeOverlay overlay() const = 0;
 	// Draws/updates the IMGUI UI within an existing tool window.
 	virtual void run_ui() = 0;
 	// Render a fullscreen preview into the active framebuffer.
@@ -125,6 +192,10 @@ public:
 private:
 	// The set of all registered tools
 	std::vector<std::unique_ptr<ICanvasTool>> mTools;
+	// Scratch textures for the tools, only the active one holds any
+	ScratchPool mScratchPool;
+	// Long running GPU work, spread over frames. Shared with the tools.
+	GpuScheduler mScheduler;
 	// The index of the current tool within mTools
 	ToolIndex mCurTool;
 
@@ -133,25 +204,76 @@ private:
 	// The logarithmic scale of the canvas (log2)
 	float mCanvasScaleLog;
 
-	// The dimensions of the canvas texture(s)
-	// Invariant: This is kept in sync with mCanvasTexture
+	// The dimensions of the canvas
+	// Invariant: This is kept in sync with mVirtualCanvas
 	ivec2 mCanvasSize;
-	// Handle to the current canvas texture
-	GLuint mCanvasTexture;
-	// Handle to the canvas destination texture
-	// This is used as the "write target" while compositing
-	// a non-final stroke, once the stroke is finalized this becomes
-	// the main canvas texture and the canvas texture is cleared
-	GLuint mCanvasDstTexture;
+	// The storage format of the canvas
+	CanvasFormat mCanvasFormat;
+	// The canvas's pixels. Strokes are composited into this in place.
+	VirtualCanvas mVirtualCanvas;
+
+	// Undo/redo state for mVirtualCanvas
+	CanvasHistory mHistory;
+	// Writes mVirtualCanvas out in the background
+	CanvasSaver mSaver;
+	// Streams raw heightmaps into mVirtualCanvas
+	CanvasLoader mLoader;
+	// The pre-stroke contents of the tiles the current stroke has touched
+	StrokeBackup mStrokeBackup;
+	// Whether a preview of the current stroke has been composited into
+	// the stroke canvas, which has to be undone before compositing again
+	bool mStrokeComposited;
+
+	// Proxy editing: on big canvases, slow tools stroke a downsampled copy
+	// of the canvas, so the cost per frame doesn't depend on the canvas size.
+	// When the stroke ends, it's replayed on the real canvas over the next
+	// few frames ("refinement") as jobs on mScheduler. Until that's done,
+	// the proxy is what's displayed.
+	// Whether the user wants any of that
+	bool mProxyEditing;
+	// How many times smaller the proxy is along each axis, or 0 if neither
+	// the current stroke nor a refinement uses it
+	int mProxyScale;
+	VirtualCanvas mProxyCanvas;
+	StrokeBackup mProxyBackup;
+	// Whether a proxied stroke is still being replayed on mVirtualCanvas,
+	// and the job doing it
+	bool mRefining;
+	GpuScheduler::JobId mRefineJob;
+	// Every point of the proxied stroke in real canvas coords, and where each
+	// batch of them (one flush_stroke's worth) ends.
+	struct StrokeBatch {
+		size_t end;
+		bool modifier;
+	};
+	std::vector<vec2> mReplayPoints;
+	std::vector<StrokeBatch> mReplayBatches;
+	// The next point to replay, and the batch it's in
+	size_t mReplayNext;
+	size_t mReplayBatch;
+	// Bounds everything the replay has touched, clamped to the canvas
+	CanvasRegion mReplayRegion;
+	// Once every point is replayed, the stroke is composited a tile at a time.
+	// These are the tiles which haven't been yet.
+	std::vector<CanvasRegion> mReplayPieces;
 
 	// Handle to the program used for drawing the canvas onscreen
-	// This is pretty basic, pretty much just a blit
+	// This is pretty basic, pretty much just a blit, plus the stroke overlay
 	Program* mCanvasProgram;
+	// Sampler for the stroke overlay, so that it's filtered the same as the canvas
+	GLuint mOverlaySampler;
 
 	// VAO and VBO for the quad used for drawing the canvas
 	GLuint mCanvasVAO;
 	GLuint mCanvasVBO;
 
+	// Cursor positions (canvas coords) for the current stroke which haven't been
+	// passed on to the tool yet. Mice & tablets can report way more motion events
+	// than we have frames, so these are batched up and handed over once per frame.
+	std::vector<vec2> mStrokePoints;
+	// Whether the modifier was held for the most recent of mStrokePoints
+	bool mStrokeModifier;
+
 	// This is used with mInteractState for configuring the tools
 	SDL_Keycode mHeldKey;
 	// This is used for save/restore mouse position in relative mode,
@@ -167,6 +289,7 @@ private:
 	// Whether the new dialog is open, this is modal so we block out everything else but the main menu
 	bool mShowNewDialog; 
 	ivec2 mNewDialogCanvasSize; // the size used in the new file dialog
+	CanvasFormat mNewDialogCanvasFormat; // the format used in the new file dialog
 	bool mDidAStupid; // if the user "accidentally" entered an invalid size in the new file dialog
 
 	enum class InteractState {
@@ -208,6 +331,18 @@ private:
 	vec2 cursor_canvas_coords() const;
 
 	void set_interact_state(InteractState s);
+	// The canvas the current stroke is made on, the proxy or the real one
+	VirtualCanvas& stroke_canvas();
+	StrokeBackup& stroke_backup();
+	// Passes mStrokePoints on to the current tool
+	void flush_stroke();
+	// Sets up the proxy for a new stroke, if it should be used
+	void begin_proxy_stroke();
+	// The two refinement jobs: replaying up to `count` of the proxied stroke's
+	// points, and then compositing up to `count` pieces of it
+	GpuScheduler::Progress replay_points(size_t count);
+	GpuScheduler::Progress replay_pieces(size_t count);
+
 public:
 	Canvas(SDL_Window* window);
 	~Canvas() noexcept override;
@@ -219,19 +354,34 @@ public:
 	Canvas& operator=(Canvas&&) = delete;
 
 	ivec2 get_canvas_size() const;
-	GLuint get_canvas_texture() const;
+	// Whether a canvas this big can be edited on this GPU. Memory is only
+	// spent on what's painted, but a fully painted canvas has to fit the
+	// tile atlas (VirtualCanvas::fits) and the stroke backup (StrokeBackup::fits).
+	bool fits(ivec2 canvasSize) const;
+	// For shaders which need to read the canvas, see VirtualCanvas::bind
+	const VirtualCanvas& get_virtual_canvas() const;
 
-	// Returns the pixels comprising the canvas (RGBA)
+	CanvasFormat get_canvas_format() const;
+
+	// Returns the pixels comprising the canvas, in the layout given by
+	// canvas_format_info(get_canvas_format()) (i.e. RGBA8 or native endian R16)
 	std::vector<uint8_t> get_canvas() const;
-	// Sets the pixels comprising the canvas (RGBA)
+	// Returns the canvas's red channel (height) in [0, 1], whatever the format
+	std::vector<float> get_heights() const;
+	// Sets the pixels comprising the canvas, which are laid out as described by `format`
 	// If pixels is nullptr, then it will create a blank texture of the requested size
 	// Source is used to track where this canvas came from
-	// Returns false if the size is invalid
-	bool set_canvas(ivec2 canvasSize, uint8_t* pixels, std::string source = "");
+	// Returns false if the size is invalid, or doesn't fit
+	bool set_canvas(ivec2 canvasSize, const void* pixels, std::string source = "", CanvasFormat format = CanvasFormat::RGBA8);
 
 	bool prompt_new();
 	bool prompt_open();
+	// Returns true once the save has started, it's finished in the background
+	// and mModified is set again if that fails. Waits for any save before it.
 	bool prompt_save();
+	// Picks up finished saves. Saves carry on whichever app is active,
+	// so this is called every frame regardless.
+	void update_save();
 	
 	// Registers the given tool and returns its tool index.
 	ToolIndex register_tool(std::unique_ptr<ICanvasTool> tool);
@@ -241,6 +391,12 @@ public:
 	// do any other side effects, etc)
 	void set_current_tool(ToolIndex toolIndex);
 
+	// Reverts the most recent stroke, returning false if there was none.
+	// This can only be done while not interacting with the canvas.
+	bool undo();
+	// Reapplies the most recently undone stroke, returning false if there was none.
+	bool redo();
+
 	// IApp implementation
 	void activate() override;
 	void deactivate() override;
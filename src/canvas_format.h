@@ -0,0 +1,36 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdlib>
+
+#include <glad/gl.h>
+
+// How the canvas texture stores its pixels. Terrain, water & the smooth tool
+// only ever look at the red channel, so heightmaps don't need the other three.
+enum class CanvasFormat {
+	// Color canvas. Needed for color splats; height is the red channel.
+	RGBA8,
+	// Height only. Twice the precision in half the memory.
+	R16,
+};
+
+struct CanvasFormatInfo {
+	GLenum internalFormat;
+	// Pixel transfer format & type matching internalFormat exactly
+	GLenum format;
+	GLenum type;
+	size_t bytesPerPixel;
+	// Single channel formats are swizzled to grayscale for sampling
+	bool singleChannel;
+	const char* name;
+};
+
+inline CanvasFormatInfo canvas_format_info(CanvasFormat format) {
+	switch (format) {
+	case CanvasFormat::RGBA8:
+		return CanvasFormatInfo{ GL_RGBA8, GL_RGBA, GL_UNSIGNED_BYTE, 4, false, "RGBA8" };
+	case CanvasFormat::R16:
+		return CanvasFormatInfo{ GL_R16, GL_RED, GL_UNSIGNED_SHORT, 2, true, "R16" };
+	}
+	std::abort();
+}
@@ -0,0 +1,113 @@
+#include <algorithm>
+#include <bit>
+#include <cassert>
+#include <cstdio>
+#include <cstring>
+
+#include "terrapainter/heightmap_formats.h"
+#include "terrapainter/mapped_file.h"
+
+#include "canvas_loader.h"
+#include "virtual_canvas.h"
+
+// Raw heightmaps are little endian, and get copied into the canvas as they are
+static_assert(std::endian::native == std::endian::little);
+
+CanvasLoader::CanvasLoader() {
+	for (auto& slot : mRing) slot = { 0, nullptr, nullptr };
+	mSlotBytes = 0;
+}
+CanvasLoader::~CanvasLoader() noexcept {
+	release();
+}
+void CanvasLoader::reserve(size_t bytes) {
+	if (bytes <= mSlotBytes) return;
+	release();
+	// Written by the CPU & read by GL while mapped. Coherent, so the writes
+	// are visible to anything GL does after them without a flush.
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	for (auto& slot : mRing) {
+		glGenBuffers(1, &slot.buffer);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, bytes, nullptr, flags);
+		slot.mapped = static_cast<uint8_t*>(glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, bytes, flags));
+		slot.fence = nullptr;
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	mSlotBytes = bytes;
+}
+void CanvasLoader::release() {
+	for (auto& slot : mRing) {
+		if (slot.fence) glDeleteSync(slot.fence);
+		// Deleting a buffer unmaps it, and GL keeps it around until any
+		// uploads from it are done
+		if (slot.buffer) glDeleteBuffers(1, &slot.buffer);
+		slot = { 0, nullptr, nullptr };
+	}
+	mSlotBytes = 0;
+}
+ivec2 CanvasLoader::raw_size(const std::string& path) {
+	MappedFile file;
+	size_t width, height;
+	if (!file.open(path) || !HeightmapEncoder::raw_size(file.bytes().size(), width, height)) return ivec2::zero();
+	return ivec2(int(width), int(height));
+}
+bool CanvasLoader::load_raw(VirtualCanvas& canvas, const std::string& path) {
+	MappedFile file;
+	size_t width, height;
+	if (!file.open(path) || !HeightmapEncoder::raw_size(file.bytes().size(), width, height)) {
+		fprintf(stderr, "[error] couldn't read \"%s\" (raw heightmaps have to be square)\n", path.c_str());
+		return false;
+	}
+	constexpr int TILE = VirtualCanvas::TILE_SIZE;
+	size_t rowBytes = width * sizeof(uint16_t);
+	reserve(rowBytes * TILE);
+	for (auto& slot : mRing) {
+		if (!slot.mapped) {
+			fprintf(stderr, "[error] failed to map upload buffer\n");
+			release();
+			return false;
+		}
+	}
+
+	const uint8_t* data = file.bytes().data();
+	ivec2 canvasSize = ivec2(int(width), int(height));
+	int tileRows = (canvasSize.y + TILE - 1) / TILE;
+	canvas.begin_upload(canvasSize, CanvasFormat::R16);
+	// The canvas goes bottom to top, so this reads the file back to front
+	auto file_offset = [&](int y) { return (height - 1 - size_t(y)) * rowBytes; };
+	file.prefetch(file_offset(std::min(TILE, canvasSize.y) - 1), size_t(std::min(TILE, canvasSize.y)) * rowBytes);
+	std::array<const uint8_t*, TILE> rows;
+	for (int tileY = 0; tileY < tileRows; tileY++) {
+		int first = tileY * TILE;
+		int count = std::min(TILE, canvasSize.y - first);
+		// Have the OS read in the next band while this one's copied
+		if (tileY + 1 < tileRows) {
+			int nextCount = std::min(TILE, canvasSize.y - first - TILE);
+			file.prefetch(file_offset(first + TILE + nextCount - 1), size_t(nextCount) * rowBytes);
+		}
+		Slot& slot = mRing[tileY % RING_SIZE];
+		if (slot.fence) {
+			GLenum status;
+			do {
+				status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+			} while (status == GL_TIMEOUT_EXPIRED);
+			if (status == GL_WAIT_FAILED) fprintf(stderr, "[error] upload fence wait failed\n");
+			glDeleteSync(slot.fence);
+			slot.fence = nullptr;
+		}
+		for (int r = 0; r < count; r++) {
+			rows[r] = data + file_offset(first + r);
+			memcpy(slot.mapped + size_t(r) * rowBytes, rows[r], rowBytes);
+		}
+		// Uniform tiles are found from the mapping, which unlike the buffer
+		// is cached memory
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, slot.buffer);
+		canvas.upload_tile_row(tileY, std::span(rows.data(), count), nullptr);
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	}
+	canvas.end_upload();
+	release();
+	return true;
+}
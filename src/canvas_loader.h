@@ -0,0 +1,53 @@
+#pragma once
+
+#include <array>
+#include <string>
+
+#include <glad/gl.h>
+
+#include "terrapainter/math.h"
+
+class VirtualCanvas;
+
+// Loads raw 16 bit heightmaps (.r16/.raw) straight from disk into the canvas,
+// without ever decoding the whole image into memory.
+//
+// The file is memory mapped, and goes to the GPU a row of tiles at a time
+// through a small ring of persistently mapped pixel buffer objects. Each band
+// is copied (flipped, since the file goes top to bottom) from the mapping into
+// the next free buffer and uploaded from there, with a fence so the buffer
+// isn't reused before GL has read it. So the copy into one buffer overlaps
+// the transfers out of the others, and the OS reads the next band in from disk
+// meanwhile. The host only holds the pages of the file being looked at.
+class CanvasLoader {
+public:
+	// Buffers in the ring. Enough for one being filled while the others upload.
+	static constexpr int RING_SIZE = 3;
+private:
+	struct Slot {
+		GLuint buffer;
+		uint8_t* mapped;
+		// Signalled once GL is done reading the buffer, null when it's free
+		GLsync fence;
+	};
+	std::array<Slot, RING_SIZE> mRing;
+	size_t mSlotBytes;
+
+	// Makes each buffer in the ring hold at least `bytes`
+	void reserve(size_t bytes);
+	// Frees the ring, it's only needed while loading
+	void release();
+public:
+	CanvasLoader();
+	~CanvasLoader() noexcept;
+
+	CanvasLoader(const CanvasLoader&) = delete;
+	CanvasLoader& operator=(const CanvasLoader&) = delete;
+
+	// The size of the raw heightmap at `path`, or zero if it can't be read
+	// (raw files have to be square, their size isn't stored)
+	static ivec2 raw_size(const std::string& path);
+	// Replaces `canvas` with the raw heightmap at `path`, as an R16 canvas.
+	// Returns false if it can't be read.
+	bool load_raw(VirtualCanvas& canvas, const std::string& path);
+};
@@ -0,0 +1,291 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "terrapainter/qoi.h"
+
+#include "canvas_saver.h"
+#include "helpers.h"
+#include "virtual_canvas.h"
+
+CanvasSaver::FileFormat CanvasSaver::file_format(const std::string& path) {
+	std::string extension = file_extension(path);
+	if (extension == "qoi") return FileFormat::QOI;
+	if (extension == "r16" || extension == "raw") return FileFormat::RAW16;
+	if (extension == "pfm") return FileFormat::PFM;
+	if (extension == "tif" || extension == "tiff") return FileFormat::TIFF;
+	return FileFormat::PNG;
+}
+HeightmapEncoder::Format CanvasSaver::heightmap_format(FileFormat format) {
+	switch (format) {
+	case FileFormat::RAW16: return HeightmapEncoder::Format::RAW16;
+	case FileFormat::PFM: return HeightmapEncoder::Format::PFM;
+	case FileFormat::TIFF: return HeightmapEncoder::Format::TIFF;
+	default: break;
+	}
+	std::abort();
+}
+CanvasSaver::CanvasSaver() {
+	mPbo = 0;
+	mPboBytes = 0;
+	mFence = nullptr;
+	mMapped = nullptr;
+	mFileFormat = FileFormat::PNG;
+	mLevel = PngEncoder::Level::DEFAULT;
+	mCanvasSize = ivec2::zero();
+	mFormat = CanvasFormat::RGBA8;
+	mTileCount = ivec2::zero();
+	mRowsDone = 0;
+	mEncoded = false;
+	mSucceeded = false;
+	mBusy = false;
+	mFast = false;
+}
+CanvasSaver::~CanvasSaver() noexcept {
+	// Whatever the user asked to save still gets saved
+	finish();
+}
+bool CanvasSaver::start(const VirtualCanvas& canvas, std::string path) {
+	assert(!mBusy);
+	ivec2 canvasSize = canvas.size();
+	if (canvasSize.x <= 0 || canvasSize.y <= 0) {
+		fprintf(stderr, "[error] can't save an empty canvas\n");
+		return false;
+	}
+	FileFormat fileFormat = file_format(path);
+	if (fileFormat == FileFormat::QOI && canvas.format() != CanvasFormat::RGBA8) {
+		fprintf(stderr, "[error] QOI can't hold a %s canvas, save it as a PNG\n", canvas_format_info(canvas.format()).name);
+		return false;
+	}
+	bool heightmap = fileFormat != FileFormat::PNG && fileFormat != FileFormat::QOI;
+	if (heightmap && !HeightmapEncoder::fits(heightmap_format(fileFormat), size_t(canvasSize.x), size_t(canvasSize.y))) {
+		fprintf(stderr, "[error] the canvas is too big for a TIFF, save it as a raw heightmap\n");
+		return false;
+	}
+	if (fileFormat == FileFormat::RAW16 && canvasSize.x != canvasSize.y) {
+		// Other tools can be told the size, but it can't be opened here again
+		fprintf(stderr, "[warning] raw heightmaps don't record their size, remember it's %dx%d\n", canvasSize.x, canvasSize.y);
+	}
+	auto info = canvas_format_info(canvas.format());
+	mPath = std::move(path);
+	mFileFormat = fileFormat;
+	mLevel = mFast ? PngEncoder::Level::FAST : PngEncoder::Level::DEFAULT;
+	mCanvasSize = canvasSize;
+	mFormat = canvas.format();
+	mTileCount = canvas.tile_grid();
+	mOffsets.assign(canvas.tile_count(), SIZE_MAX);
+	mFills.assign(canvas.tile_count(), {});
+
+	constexpr int TILE = VirtualCanvas::TILE_SIZE;
+	std::vector<VirtualCanvas::Readback> pieces;
+	size_t offset = 0;
+	for (size_t index = 0; index < canvas.tile_count(); index++) {
+		if (canvas.tile_layer(index) >= 0) {
+			ivec2 origin = ivec2(int(index % mTileCount.x), int(index / mTileCount.x)) * TILE;
+			ivec2 size = math::vmin(ivec2::splat(TILE), canvasSize - origin);
+			mOffsets[index] = offset;
+			pieces.push_back({ origin, size, offset });
+			offset += size_t(size.x) * size_t(size.y) * info.bytesPerPixel;
+		}
+		else {
+			canvas.tile_fill(index, mFills[index].data());
+		}
+	}
+	mPboBytes = offset;
+
+	if (mPboBytes > 0) {
+		glGenBuffers(1, &mPbo);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, mPbo);
+		glBufferData(GL_PIXEL_PACK_BUFFER, mPboBytes, nullptr, GL_STREAM_READ);
+		canvas.read_into_buffer(pieces);
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	}
+	mFence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	mRowsDone = 0;
+	mEncoded = false;
+	mSucceeded = false;
+	mBusy = true;
+	return true;
+}
+void CanvasSaver::begin_encode() {
+	mMapped = nullptr;
+	if (mPbo) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, mPbo);
+		mMapped = static_cast<const uint8_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, mPboBytes, GL_MAP_READ_BIT));
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		if (!mMapped) {
+			fprintf(stderr, "[error] failed to map save buffer\n");
+			mSucceeded = false;
+			mEncoded = true;
+			return;
+		}
+	}
+	mWorker = std::thread([this] { encode(); });
+}
+void CanvasSaver::encode() {
+	FILE* file = fopen(mPath.c_str(), "wb");
+	if (!file) {
+		fprintf(stderr, "[error] couldn't open \"%s\" for writing\n", mPath.c_str());
+		mSucceeded = false;
+		mEncoded.store(true, std::memory_order_release);
+		return;
+	}
+	constexpr int TILE = VirtualCanvas::TILE_SIZE;
+	size_t width = size_t(mCanvasSize.x);
+	size_t height = size_t(mCanvasSize.y);
+	size_t bytesPerPixel = canvas_format_info(mFormat).bytesPerPixel;
+	bool r16 = mFormat == CanvasFormat::R16;
+	auto sink = [file](std::span<const uint8_t> bytes) {
+		return fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size();
+	};
+	std::optional<PngEncoder> png;
+	std::optional<QoiEncoder> qoi;
+	std::optional<HeightmapEncoder> heightmap;
+	// What the encoder takes per pixel
+	size_t outBytes;
+	bool bottomUp = false;
+	if (mFileFormat == FileFormat::PNG) {
+		// 16 bit grayscale for heights, so they keep all their precision
+		png.emplace(sink, width, height, r16 ? 1 : 4, mLevel, &mPool, r16 ? 16 : 8);
+		outBytes = bytesPerPixel;
+	}
+	else if (mFileFormat == FileFormat::QOI) {
+		qoi.emplace(sink, width, height, 4);
+		outBytes = bytesPerPixel;
+	}
+	else {
+		auto format = heightmap_format(mFileFormat);
+		heightmap.emplace(sink, format, width, height);
+		outBytes = sizeof(uint16_t);
+		bottomUp = HeightmapEncoder::bottom_up(format);
+	}
+	// Canvas pixels can go straight into the band unless they need converting
+	bool direct = png ? !r16 : bool(qoi);
+
+	std::vector<uint8_t> row(width * bytesPerPixel);
+	std::vector<uint8_t> band(size_t(BAND_ROWS) * width * outBytes);
+	bool ok = true;
+	// The canvas goes bottom to top, most files go top to bottom
+	for (size_t done = 0; done < height && ok; done += BAND_ROWS) {
+		size_t rows = std::min(size_t(BAND_ROWS), height - done);
+		for (size_t r = 0; r < rows; r++) {
+			int y = int(bottomUp ? done + r : height - 1 - done - r);
+			int tileY = y / TILE;
+			uint8_t* bandRow = band.data() + r * width * outBytes;
+			uint8_t* out = direct ? bandRow : row.data();
+			for (int tileX = 0; tileX < mTileCount.x; tileX++) {
+				size_t index = size_t(tileY) * mTileCount.x + tileX;
+				size_t tileWidth = size_t(std::min(TILE, mCanvasSize.x - tileX * TILE));
+				uint8_t* first = out + size_t(tileX) * TILE * bytesPerPixel;
+				size_t offset = mOffsets[index];
+				if (offset != SIZE_MAX) {
+					const uint8_t* src = mMapped + offset + size_t(y - tileY * TILE) * tileWidth * bytesPerPixel;
+					memcpy(first, src, tileWidth * bytesPerPixel);
+				}
+				else {
+					for (size_t x = 0; x < tileWidth; x++) {
+						memcpy(first + x * bytesPerPixel, mFills[index].data(), bytesPerPixel);
+					}
+				}
+			}
+			if (direct) continue;
+			for (size_t x = 0; x < width; x++) {
+				uint16_t value;
+				if (r16) {
+					memcpy(&value, row.data() + x * sizeof(uint16_t), sizeof(uint16_t));
+				}
+				else {
+					// Height is the red channel
+					value = uint16_t(row[x * 4] * 257);
+				}
+				if (png) {
+					// PNG is big endian
+					bandRow[x * 2] = uint8_t(value >> 8);
+					bandRow[x * 2 + 1] = uint8_t(value);
+				}
+				else {
+					memcpy(bandRow + x * sizeof(uint16_t), &value, sizeof(uint16_t));
+				}
+			}
+		}
+		std::span<const uint8_t> pixels(band.data(), rows * width * outBytes);
+		if (png) ok = png->write_rows(pixels);
+		else if (qoi) ok = qoi->write_rows(pixels);
+		else ok = heightmap->write_rows(std::span(reinterpret_cast<const uint16_t*>(pixels.data()), rows * width));
+		mRowsDone.store(int(done + rows), std::memory_order_relaxed);
+	}
+	if (png) ok = png->finish() && ok;
+	else if (qoi) ok = qoi->finish() && ok;
+	else ok = heightmap->finish() && ok;
+	if (!ok) fprintf(stderr, "[error] failed writing to \"%s\"\n", mPath.c_str());
+	ok = fclose(file) == 0 && ok;
+	mSucceeded = ok;
+	mEncoded.store(true, std::memory_order_release);
+}
+bool CanvasSaver::end() {
+	if (mWorker.joinable()) mWorker.join();
+	if (mMapped) {
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, mPbo);
+		if (!glUnmapBuffer(GL_PIXEL_PACK_BUFFER)) {
+			// The contents got trashed while mapped (i.e. display mode change),
+			// so whatever was written is garbage
+			fprintf(stderr, "[error] save buffer was corrupted while mapped\n");
+			mSucceeded = false;
+		}
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+		mMapped = nullptr;
+	}
+	if (mPbo) {
+		glDeleteBuffers(1, &mPbo);
+		mPbo = 0;
+		mPboBytes = 0;
+	}
+	mOffsets.clear();
+	mFills.clear();
+	mBusy = false;
+	if (mSucceeded) fprintf(stderr, "[info] image saved to \"%s\"\n", mPath.c_str());
+	return mSucceeded;
+}
+std::optional<bool> CanvasSaver::update() {
+	if (!mBusy) return std::nullopt;
+	if (mFence) {
+		GLenum status = glClientWaitSync(mFence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED) return std::nullopt;
+		glDeleteSync(mFence);
+		mFence = nullptr;
+		if (status == GL_WAIT_FAILED) {
+			// The readback may never land, so give up on this save
+			fprintf(stderr, "[error] save fence wait failed\n");
+			mSucceeded = false;
+			return end();
+		}
+		begin_encode();
+		return std::nullopt;
+	}
+	if (!mEncoded.load(std::memory_order_acquire)) return std::nullopt;
+	return end();
+}
+std::optional<bool> CanvasSaver::finish() {
+	if (!mBusy) return std::nullopt;
+	if (mFence) {
+		GLenum status;
+		do {
+			status = glClientWaitSync(mFence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000);
+		} while (status == GL_TIMEOUT_EXPIRED);
+		glDeleteSync(mFence);
+		mFence = nullptr;
+		if (status == GL_WAIT_FAILED) {
+			fprintf(stderr, "[error] save fence wait failed\n");
+			mSucceeded = false;
+			return end();
+		}
+		begin_encode();
+	}
+	return end();
+}
+float CanvasSaver::progress() const {
+	if (!mBusy || mCanvasSize.y == 0) return 0.0f;
+	return float(mRowsDone.load(std::memory_order_relaxed)) / float(mCanvasSize.y);
+}
@@ -0,0 +1,116 @@
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <optional>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include "terrapainter/heightmap_formats.h"
+#include "terrapainter/math.h"
+#include "terrapainter/png_encoder.h"
+#include "terrapainter/thread_pool.h"
+
+#include "canvas_format.h"
+
+class VirtualCanvas;
+
+// Saves the canvas to a PNG (or QOI, for quick scratch saves, or one of the
+// heightmap formats) without stalling the UI. R16 canvases go to 16 bit PNGs,
+// and the heightmap formats take the red channel of RGBA8 ones.
+//
+// start() queues a readback of every resident tile into a pixel buffer
+// object, followed by a fence, and returns right away. The canvas can be
+// painted on immediately, since GL runs the readback before anything queued
+// after it. Once the fence has signalled, the PBO is mapped and a worker
+// thread puts the rows together (filling in uniform tiles itself) and streams
+// them through an encoder into the file, a band at a time. The pixels are only
+// ever held by the driver, so the host only needs a few bands' worth of memory.
+// PNG bands are compressed in parallel on a thread pool.
+//
+// The mapping has to be undone on the GL thread, so whoever owns this calls
+// update() every frame to pick up finished saves. Only one save runs at once.
+class CanvasSaver {
+public:
+	// Rows handed to the encoder at a time
+	static constexpr int BAND_ROWS = 64;
+	enum class FileFormat {
+		PNG,
+		// Only for RGBA8 canvases
+		QOI,
+		// See HeightmapEncoder::Format
+		RAW16,
+		PFM,
+		TIFF,
+	};
+	// Picks the format by the path's extension, PNG if it isn't known
+	static FileFormat file_format(const std::string& path);
+	// For RAW16, PFM & TIFF
+	static HeightmapEncoder::Format heightmap_format(FileFormat format);
+private:
+	// The resident tiles, packed back to back. Zero if there weren't any.
+	GLuint mPbo;
+	size_t mPboBytes;
+	// Signalled once the readback is complete, null once that's been observed
+	GLsync mFence;
+	// The PBO's contents while the worker runs
+	const uint8_t* mMapped;
+
+	// What's being saved
+	std::string mPath;
+	FileFormat mFileFormat;
+	PngEncoder::Level mLevel;
+	ivec2 mCanvasSize;
+	CanvasFormat mFormat;
+	ivec2 mTileCount;
+	// Byte offset of each tile within the PBO, or SIZE_MAX if it's uniform
+	std::vector<size_t> mOffsets;
+	// The pixel filling each uniform tile, in the canvas format
+	std::vector<std::array<uint8_t, 4>> mFills;
+
+	// Compresses PNG bands for the worker
+	ThreadPool mPool;
+	// Whether PNGs use PngEncoder::Level::FAST
+	bool mFast;
+	std::thread mWorker;
+	std::atomic<int> mRowsDone;
+	// Set by the worker when it's done. mSucceeded is only valid after that.
+	std::atomic<bool> mEncoded;
+	bool mSucceeded;
+	bool mBusy;
+
+	// Maps the PBO and starts the worker
+	void begin_encode();
+	// Runs on the worker
+	void encode();
+	// Cleans up after the worker, returning whether the save worked
+	bool end();
+public:
+	CanvasSaver();
+	// Finishes any save in progress
+	~CanvasSaver() noexcept;
+
+	CanvasSaver(const CanvasSaver&) = delete;
+	CanvasSaver& operator=(const CanvasSaver&) = delete;
+
+	// Starts saving the canvas as it is now to `path`, in the format its
+	// extension gives. Returns false if that's impossible (i.e. an empty
+	// canvas). There mustn't be a save in progress already, see finish().
+	bool start(const VirtualCanvas& canvas, std::string path);
+	// Call once per frame. If a save finished meanwhile, returns whether
+	// it worked.
+	std::optional<bool> update();
+	// Blocks until the save in progress (if any) is done, see update()
+	std::optional<bool> finish();
+
+	bool busy() const { return mBusy; }
+	// Fraction of the rows written so far
+	float progress() const;
+	const std::string& path() const { return mPath; }
+	bool fast() const { return mFast; }
+	// Applies from the next save on
+	void set_fast(bool fast) { mFast = fast; }
+};
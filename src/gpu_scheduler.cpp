@@ -0,0 +1,110 @@
+#include <algorithm>
+#include <cassert>
+
+#include "gpu_scheduler.h"
+
+GpuScheduler::GpuScheduler() {
+	mNextId = 1;
+	mBudgetMs = DEFAULT_JOB_BUDGET_MS;
+	mRunning = false;
+}
+GpuScheduler::~GpuScheduler() noexcept {
+	for (Timing& timing : mTimings) {
+		glDeleteQueries(2, timing.queries);
+	}
+	if (!mFreeQueries.empty()) {
+		glDeleteQueries(GLsizei(mFreeQueries.size()), mFreeQueries.data());
+	}
+}
+GLuint GpuScheduler::take_query() {
+	if (mFreeQueries.empty()) {
+		GLuint query;
+		glGenQueries(1, &query);
+		return query;
+	}
+	GLuint query = mFreeQueries.back();
+	mFreeQueries.pop_back();
+	return query;
+}
+void GpuScheduler::collect_timings() {
+	// Queries complete in order, so stop at the first one that isn't ready
+	size_t collected = 0;
+	for (Timing& timing : mTimings) {
+		GLint available = GL_FALSE;
+		glGetQueryObjectiv(timing.queries[1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available) break;
+		GLuint64 begin = 0, end = 0;
+		glGetQueryObjectui64v(timing.queries[0], GL_QUERY_RESULT, &begin);
+		glGetQueryObjectui64v(timing.queries[1], GL_QUERY_RESULT, &end);
+		float ms = float(end - begin) / 1e6f / float(std::max<size_t>(timing.units, 1));
+		auto [it, inserted] = mEstimates.try_emplace(timing.kind, ms);
+		// Smoothed, so a single slow step doesn't throw it off
+		if (!inserted) it->second = 0.5f * it->second + 0.5f * ms;
+		mFreeQueries.push_back(timing.queries[0]);
+		mFreeQueries.push_back(timing.queries[1]);
+		collected++;
+	}
+	mTimings.erase(mTimings.begin(), mTimings.begin() + collected);
+}
+size_t GpuScheduler::step_front(size_t units, bool timed) {
+	// Steps may submit jobs, but pushing to the back of a deque leaves
+	// references to the front alone
+	Job& job = mJobs.front();
+	Timing timing;
+	if (timed) {
+		timing.kind = job.kind;
+		timing.queries[0] = take_query();
+		timing.queries[1] = take_query();
+		glQueryCounter(timing.queries[0], GL_TIMESTAMP);
+	}
+	Progress progress = job.step(units);
+	if (timed) {
+		glQueryCounter(timing.queries[1], GL_TIMESTAMP);
+		timing.units = progress.units;
+		mTimings.push_back(std::move(timing));
+	}
+	if (progress.finished || job.cancelled) mJobs.pop_front();
+	return progress.units;
+}
+GpuScheduler::JobId GpuScheduler::submit(std::string kind, Step step) {
+	JobId id = mNextId++;
+	mJobs.push_back(Job{ .id = id, .kind = std::move(kind), .step = std::move(step), .cancelled = false });
+	return id;
+}
+void GpuScheduler::cancel(JobId id) {
+	// Only flagged, the job may be the one which is running
+	for (Job& job : mJobs) {
+		if (job.id == id) job.cancelled = true;
+	}
+}
+void GpuScheduler::run() {
+	assert(!mRunning);
+	mRunning = true;
+	collect_timings();
+	float spent = 0.0f;
+	while (spent < mBudgetMs) {
+		while (!mJobs.empty() && mJobs.front().cancelled) mJobs.pop_front();
+		if (mJobs.empty()) break;
+		auto estimate = mEstimates.find(mJobs.front().kind);
+		if (estimate == mEstimates.end()) {
+			// Nothing is known about this kind of job yet, so try a single
+			// unit and leave the rest of the frame alone until it's measured
+			step_front(1, true);
+			break;
+		}
+		float perUnit = std::max(estimate->second, 1e-4f);
+		size_t units = size_t(std::clamp((mBudgetMs - spent) / perUnit, 1.0f, 1e9f));
+		// The step may have done more than it was asked to
+		spent += perUnit * float(step_front(units, true));
+	}
+	mRunning = false;
+}
+void GpuScheduler::finish() {
+	assert(!mRunning);
+	mRunning = true;
+	while (!mJobs.empty()) {
+		if (mJobs.front().cancelled) mJobs.pop_front();
+		else step_front(SIZE_MAX, false);
+	}
+	mRunning = false;
+}
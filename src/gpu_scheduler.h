@@ -0,0 +1,96 @@
+#pragma once
+
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+#include <glad/gl.h>
+
+// Default GPU time per frame given to jobs, in ms
+constexpr float DEFAULT_JOB_BUDGET_MS = 4.0f;
+
+// Runs long GPU operations (rebuilding blur tables, replaying strokes...)
+// a piece at a time, spread over as many frames as it takes, instead of
+// stalling a single frame for however long they need.
+//
+// Whoever submits a job splits it into steps, and each step is asked to do
+// roughly some number of units of work, where a unit is whatever the job
+// likes (a row, a tile...) as long as they all cost about the same.
+// Each step is timed with a pair of GL_TIMESTAMP queries, which are read back
+// once they're available, and the scheduler keeps a running estimate of the
+// cost of a unit for each kind of job. That's used to fit as many units into
+// each frame's budget as it can.
+//
+// Jobs run strictly in the order they were submitted, and a job doesn't start
+// until the one before it has finished, so a job may rely on the results of
+// anything submitted before it. Whoever needs a result right away calls finish().
+class GpuScheduler {
+public:
+	using JobId = uint64_t;
+	struct Progress {
+		// How many units the step actually did. It may be more than it was
+		// asked for, if that can't be split any further.
+		size_t units;
+		// Whether the job is done, in which case it's never stepped again
+		bool finished;
+	};
+	// Does about `units` units of work, at least one. SIZE_MAX means everything.
+	using Step = std::function<Progress(size_t units)>;
+private:
+	struct Job {
+		JobId id;
+		// Jobs of the same kind share a cost estimate
+		std::string kind;
+		Step step;
+		bool cancelled;
+	};
+	std::deque<Job> mJobs;
+	JobId mNextId;
+	// A timed step whose queries haven't been read back yet
+	struct Timing {
+		std::string kind;
+		size_t units;
+		GLuint queries[2];
+	};
+	std::vector<Timing> mTimings;
+	std::vector<GLuint> mFreeQueries;
+	// Estimated GPU time per unit of each kind of job, in ms
+	std::unordered_map<std::string, float> mEstimates;
+	float mBudgetMs;
+	// Guards against finish() from inside a step, which would reenter it
+	bool mRunning;
+
+	GLuint take_query();
+	// Reads back whichever timings are available, without waiting
+	void collect_timings();
+	// Steps the first job, removing it if it's finished (or was cancelled
+	// meanwhile). Returns how many units it did.
+	size_t step_front(size_t units, bool timed);
+public:
+	GpuScheduler();
+	~GpuScheduler() noexcept;
+
+	GpuScheduler(const GpuScheduler&) = delete;
+	GpuScheduler& operator=(const GpuScheduler&) = delete;
+
+	// Queues a job behind every other one. `kind` names what the job does,
+	// not the instance, e.g. "smooth: summed-area table". Steps may submit
+	// & cancel jobs, but not run or finish them.
+	JobId submit(std::string kind, Step step);
+	// Drops a job which hasn't finished yet, if it's still queued.
+	// Its step is never called again.
+	void cancel(JobId id);
+	// Runs jobs until this frame's budget is used up, by the estimates.
+	// Call once per frame, when the jobs can see what they expect to.
+	void run();
+	// Runs every queued job to completion right away
+	void finish();
+
+	bool idle() const { return mJobs.empty(); }
+	size_t job_count() const { return mJobs.size(); }
+	float budget() const { return mBudgetMs; }
+	void set_budget(float ms) { mBudgetMs = ms; }
+};
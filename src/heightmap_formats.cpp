@@ -0,0 +1,354 @@
+#include "terrapainter/heightmap_formats.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cctype>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <string>
+
+namespace {
+	constexpr uint16_t TIFF_TAG_WIDTH = 256;
+	constexpr uint16_t TIFF_TAG_HEIGHT = 257;
+	constexpr uint16_t TIFF_TAG_BITS_PER_SAMPLE = 258;
+	constexpr uint16_t TIFF_TAG_COMPRESSION = 259;
+	constexpr uint16_t TIFF_TAG_PHOTOMETRIC = 262;
+	constexpr uint16_t TIFF_TAG_STRIP_OFFSETS = 273;
+	constexpr uint16_t TIFF_TAG_SAMPLES_PER_PIXEL = 277;
+	constexpr uint16_t TIFF_TAG_ROWS_PER_STRIP = 278;
+	constexpr uint16_t TIFF_TAG_STRIP_BYTE_COUNTS = 279;
+	constexpr uint16_t TIFF_TAG_TILE_WIDTH = 322;
+	constexpr uint16_t TIFF_TAG_SAMPLE_FORMAT = 339;
+	constexpr uint16_t TIFF_SHORT = 3;
+	constexpr uint16_t TIFF_LONG = 4;
+	constexpr uint16_t TIFF_SAMPLE_UINT = 1;
+	constexpr uint16_t TIFF_SAMPLE_INT = 2;
+	constexpr uint16_t TIFF_SAMPLE_FLOAT = 3;
+	// Header, then an IFD of 10 entries, padded so the floats are aligned
+	constexpr size_t TIFF_ENTRIES = 10;
+	constexpr size_t TIFF_IFD_END = 8 + 2 + TIFF_ENTRIES * 12 + 4;
+	constexpr size_t TIFF_DATA_OFFSET = 136;
+	// Anything bigger is surely a corrupt header
+	constexpr size_t MAX_SIDE = size_t(1) << 24;
+
+	void put_le16(BufferedSink& out, uint16_t value) {
+		out.put(uint8_t(value));
+		out.put(uint8_t(value >> 8));
+	}
+	void put_le32(BufferedSink& out, uint32_t value) {
+		for (int i = 0; i < 4; i++) out.put(uint8_t(value >> (i * 8)));
+	}
+	void put_float(BufferedSink& out, uint16_t height) {
+		float value = float(height) / 65535.0f;
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		put_le32(out, bits);
+	}
+	float to_float(uint32_t bits) {
+		float value;
+		memcpy(&value, &bits, sizeof(value));
+		return value;
+	}
+
+	// Stores a file's samples as heights. `sample(x, y)` reads the sample at
+	// column x of the y'th row in the file, as a float where 0..1 is the
+	// whole height range, or as-is for elevations.
+	template<typename Sample>
+	void store_floats(size_t width, size_t height, bool bottomUp, Sample sample, std::vector<uint16_t>& heights, float& low, float& high) {
+		// Two passes over the file rather than a float copy of it
+		float lowest = INFINITY, highest = -INFINITY;
+		for (size_t y = 0; y < height; y++) {
+			for (size_t x = 0; x < width; x++) {
+				float value = sample(x, y);
+				if (!std::isfinite(value)) continue;
+				lowest = std::min(lowest, value);
+				highest = std::max(highest, value);
+			}
+		}
+		low = 0.0f;
+		high = 1.0f;
+		if (lowest < 0.0f || highest > 1.0f) {
+			low = lowest;
+			high = highest > lowest ? highest : lowest + 1.0f;
+		}
+		float scale = 65535.0f / (high - low);
+		heights.resize(width * height);
+		for (size_t y = 0; y < height; y++) {
+			uint16_t* out = heights.data() + (bottomUp ? y : height - 1 - y) * width;
+			for (size_t x = 0; x < width; x++) {
+				float value = sample(x, y);
+				// Holes (NaN) end up at the bottom
+				value = std::isfinite(value) ? std::clamp((value - low) * scale, 0.0f, 65535.0f) : 0.0f;
+				out[x] = uint16_t(value + 0.5f);
+			}
+		}
+	}
+
+	bool decode_raw(std::span<const uint8_t> file, size_t& width, size_t& height, std::vector<uint16_t>& heights) {
+		if (!HeightmapEncoder::raw_size(file.size(), width, height)) return false;
+		size_t side = width;
+		heights.resize(side * side);
+		for (size_t y = 0; y < side; y++) {
+			const uint8_t* in = file.data() + y * side * 2;
+			uint16_t* out = heights.data() + (side - 1 - y) * side;
+			for (size_t x = 0; x < side; x++) out[x] = uint16_t(in[x * 2] | (in[x * 2 + 1] << 8));
+		}
+		return true;
+	}
+
+	bool decode_pfm(std::span<const uint8_t> file, size_t& width, size_t& height, std::vector<uint16_t>& heights, float& low, float& high) {
+		size_t pos = 0;
+		auto token = [&] {
+			while (pos < file.size() && isspace(file[pos])) pos++;
+			std::string text;
+			while (pos < file.size() && !isspace(file[pos]) && text.size() < 32) text.push_back(char(file[pos++]));
+			return text;
+		};
+		std::string magic = token();
+		if (magic != "Pf" && magic != "PF") return false;
+		size_t channels = magic == "PF" ? 3 : 1;
+		long long w = 0, h = 0;
+		double scale = 0.0;
+		if (sscanf(token().c_str(), "%lld", &w) != 1 || sscanf(token().c_str(), "%lld", &h) != 1) return false;
+		if (sscanf(token().c_str(), "%lf", &scale) != 1 || scale == 0.0) return false;
+		// Exactly one whitespace character before the data
+		pos++;
+		if (w <= 0 || h <= 0 || size_t(w) > MAX_SIDE || size_t(h) > MAX_SIDE) return false;
+		width = size_t(w);
+		height = size_t(h);
+		size_t stride = channels * 4;
+		if (pos > file.size() || file.size() - pos < width * height * stride) return false;
+		// The sign of the scale gives the byte order
+		bool little = scale < 0.0;
+		const uint8_t* data = file.data() + pos;
+		auto sample = [&](size_t x, size_t y) {
+			const uint8_t* in = data + (y * width + x) * stride;
+			uint32_t bits = little
+				? uint32_t(in[0]) | (uint32_t(in[1]) << 8) | (uint32_t(in[2]) << 16) | (uint32_t(in[3]) << 24)
+				: uint32_t(in[3]) | (uint32_t(in[2]) << 8) | (uint32_t(in[1]) << 16) | (uint32_t(in[0]) << 24);
+			return to_float(bits);
+		};
+		// Already bottom to top
+		store_floats(width, height, true, sample, heights, low, high);
+		return true;
+	}
+
+	// Bounds checked reads in the file's byte order
+	struct TiffReader {
+		std::span<const uint8_t> file;
+		bool little;
+		bool ok = true;
+
+		uint32_t read(size_t at, size_t bytes) {
+			if (at > file.size() || file.size() - at < bytes) {
+				ok = false;
+				return 0;
+			}
+			uint32_t value = 0;
+			for (size_t i = 0; i < bytes; i++) {
+				value |= uint32_t(file[at + i]) << ((little ? i : bytes - 1 - i) * 8);
+			}
+			return value;
+		}
+		// The SHORT or LONG values of the IFD entry at `entry`
+		std::vector<uint32_t> values(size_t entry) {
+			uint32_t type = read(entry + 2, 2);
+			uint32_t count = read(entry + 4, 4);
+			size_t size = type == TIFF_SHORT ? 2 : type == TIFF_LONG ? 4 : 0;
+			if (size == 0 || count > file.size()) {
+				ok = false;
+				return {};
+			}
+			// Values that fit are stored in the entry itself
+			size_t at = size * count <= 4 ? entry + 8 : read(entry + 8, 4);
+			std::vector<uint32_t> result(count);
+			for (size_t i = 0; i < count && ok; i++) result[i] = read(at + i * size, size);
+			return result;
+		}
+		// The first value of the entry at `entry`
+		uint32_t value(size_t entry) {
+			auto all = values(entry);
+			if (all.empty()) ok = false;
+			return all.empty() ? 0 : all[0];
+		}
+	};
+
+	bool decode_tiff(std::span<const uint8_t> file, size_t& width, size_t& height, std::vector<uint16_t>& heights, float& low, float& high) {
+		if (file.size() < 8) return false;
+		bool little = file[0] == 'I' && file[1] == 'I';
+		if (!little && !(file[0] == 'M' && file[1] == 'M')) return false;
+		TiffReader reader{ file, little };
+		if (reader.read(2, 2) != 42) return false;
+		size_t ifd = reader.read(4, 4);
+		size_t entries = reader.read(ifd, 2);
+
+		width = height = 0;
+		uint32_t bits = 1, compression = 1, samples = 1, format = TIFF_SAMPLE_UINT;
+		std::vector<uint32_t> offsets;
+		size_t rowsPerStrip = SIZE_MAX;
+		for (size_t i = 0; i < entries && reader.ok; i++) {
+			size_t entry = ifd + 2 + i * 12;
+			uint32_t tag = reader.read(entry, 2);
+			switch (tag) {
+			case TIFF_TAG_WIDTH: width = reader.value(entry); break;
+			case TIFF_TAG_HEIGHT: height = reader.value(entry); break;
+			// One per sample, and they're all the same
+			case TIFF_TAG_BITS_PER_SAMPLE: bits = reader.value(entry); break;
+			case TIFF_TAG_COMPRESSION: compression = reader.value(entry); break;
+			case TIFF_TAG_SAMPLES_PER_PIXEL: samples = reader.value(entry); break;
+			case TIFF_TAG_SAMPLE_FORMAT: format = reader.value(entry); break;
+			case TIFF_TAG_ROWS_PER_STRIP: rowsPerStrip = reader.value(entry); break;
+			case TIFF_TAG_STRIP_OFFSETS: offsets = reader.values(entry); break;
+			case TIFF_TAG_TILE_WIDTH: return false;
+			}
+		}
+		if (!reader.ok || compression != 1 || samples != 1) return false;
+		if (width == 0 || height == 0 || width > MAX_SIDE || height > MAX_SIDE) return false;
+		bool supported = (format == TIFF_SAMPLE_UINT && (bits == 8 || bits == 16))
+			|| (format == TIFF_SAMPLE_INT && bits == 16)
+			|| (format == TIFF_SAMPLE_FLOAT && bits == 32);
+		if (!supported) return false;
+
+		size_t sampleBytes = bits / 8;
+		size_t rowBytes = width * sampleBytes;
+		rowsPerStrip = std::min(rowsPerStrip, height);
+		if (rowsPerStrip == 0 || offsets.size() != (height + rowsPerStrip - 1) / rowsPerStrip) return false;
+		// Check every strip's there up front, so the rows can be read unchecked
+		for (size_t strip = 0; strip < offsets.size(); strip++) {
+			size_t rows = std::min(rowsPerStrip, height - strip * rowsPerStrip);
+			if (offsets[strip] > file.size() || file.size() - offsets[strip] < rows * rowBytes) return false;
+		}
+		auto row_start = [&](size_t y) {
+			return file.data() + offsets[y / rowsPerStrip] + (y % rowsPerStrip) * rowBytes;
+		};
+		auto read = [&](const uint8_t* in) {
+			uint32_t value = 0;
+			for (size_t i = 0; i < sampleBytes; i++) value |= uint32_t(in[i]) << ((little ? i : sampleBytes - 1 - i) * 8);
+			return value;
+		};
+
+		if (format == TIFF_SAMPLE_UINT) {
+			// Already heights, just widened
+			low = 0.0f;
+			high = 1.0f;
+			heights.resize(width * height);
+			for (size_t y = 0; y < height; y++) {
+				const uint8_t* in = row_start(y);
+				uint16_t* out = heights.data() + (height - 1 - y) * width;
+				for (size_t x = 0; x < width; x++) {
+					uint32_t value = read(in + x * sampleBytes);
+					out[x] = uint16_t(bits == 8 ? value * 257 : value);
+				}
+			}
+		}
+		else {
+			auto sample = [&](size_t x, size_t y) {
+				uint32_t value = read(row_start(y) + x * sampleBytes);
+				return format == TIFF_SAMPLE_FLOAT ? to_float(value) : float(int16_t(value));
+			};
+			store_floats(width, height, false, sample, heights, low, high);
+		}
+		return true;
+	}
+}
+
+HeightmapEncoder::HeightmapEncoder(BufferedSink::Sink sink, Format format, size_t width, size_t height)
+	: mOut(std::move(sink)), mFormat(format), mWidth(width), mHeight(height) {
+	assert(width > 0 && height > 0);
+	assert(fits(format, width, height));
+	mRowsWritten = 0;
+	switch (format) {
+	case Format::RAW16:
+		break;
+	case Format::PFM: {
+		// A negative scale means little endian
+		std::string header = "Pf\n" + std::to_string(width) + " " + std::to_string(height) + "\n-1.0\n";
+		mOut.write(std::span(reinterpret_cast<const uint8_t*>(header.data()), header.size()));
+		break;
+	}
+	case Format::TIFF: {
+		mOut.put('I');
+		mOut.put('I');
+		put_le16(mOut, 42);
+		put_le32(mOut, 8);
+		put_le16(mOut, uint16_t(TIFF_ENTRIES));
+		auto entry = [&](uint16_t tag, uint16_t type, uint32_t value) {
+			put_le16(mOut, tag);
+			put_le16(mOut, type);
+			put_le32(mOut, 1);
+			if (type == TIFF_SHORT) {
+				put_le16(mOut, uint16_t(value));
+				put_le16(mOut, 0);
+			}
+			else {
+				put_le32(mOut, value);
+			}
+		};
+		// Sorted by tag, as the spec requires
+		entry(TIFF_TAG_WIDTH, TIFF_LONG, uint32_t(width));
+		entry(TIFF_TAG_HEIGHT, TIFF_LONG, uint32_t(height));
+		entry(TIFF_TAG_BITS_PER_SAMPLE, TIFF_SHORT, 32);
+		entry(TIFF_TAG_COMPRESSION, TIFF_SHORT, 1);
+		// Black is zero
+		entry(TIFF_TAG_PHOTOMETRIC, TIFF_SHORT, 1);
+		entry(TIFF_TAG_STRIP_OFFSETS, TIFF_LONG, uint32_t(TIFF_DATA_OFFSET));
+		entry(TIFF_TAG_SAMPLES_PER_PIXEL, TIFF_SHORT, 1);
+		entry(TIFF_TAG_ROWS_PER_STRIP, TIFF_LONG, uint32_t(height));
+		entry(TIFF_TAG_STRIP_BYTE_COUNTS, TIFF_LONG, uint32_t(width * height * 4));
+		entry(TIFF_TAG_SAMPLE_FORMAT, TIFF_SHORT, TIFF_SAMPLE_FLOAT);
+		// No more IFDs
+		put_le32(mOut, 0);
+		for (size_t i = TIFF_IFD_END; i < TIFF_DATA_OFFSET; i++) mOut.put(0);
+		break;
+	}
+	}
+}
+bool HeightmapEncoder::bottom_up(Format format) {
+	return format == Format::PFM;
+}
+bool HeightmapEncoder::fits(Format format, size_t width, size_t height) {
+	if (format == Format::TIFF) return width * height <= (UINT32_MAX - TIFF_DATA_OFFSET) / 4;
+	return true;
+}
+bool HeightmapEncoder::raw_size(size_t bytes, size_t& width, size_t& height) {
+	size_t count = bytes / 2;
+	size_t side = size_t(std::sqrt(double(count)) + 0.5);
+	if (bytes % 2 != 0 || count == 0 || side * side != count) return false;
+	width = height = side;
+	return true;
+}
+bool HeightmapEncoder::write_rows(std::span<const uint16_t> rows) {
+	assert(rows.size() % mWidth == 0);
+	assert(mRowsWritten + rows.size() / mWidth <= mHeight);
+	if (mOut.failed()) return false;
+	for (size_t i = 0; i < rows.size(); i++) {
+		if (mFormat == Format::RAW16) {
+			put_le16(mOut, rows[i]);
+		}
+		else {
+			put_float(mOut, rows[i]);
+		}
+	}
+	mRowsWritten += rows.size() / mWidth;
+	return !mOut.failed();
+}
+bool HeightmapEncoder::finish() {
+	if (mOut.failed()) return false;
+	assert(mRowsWritten == mHeight);
+	mOut.flush();
+	return !mOut.failed();
+}
+bool HeightmapEncoder::decode(Format format, std::span<const uint8_t> file, size_t& width, size_t& height, std::vector<uint16_t>& heights, float& low, float& high) {
+	switch (format) {
+	case Format::RAW16:
+		low = 0.0f;
+		high = 1.0f;
+		return decode_raw(file, width, height, heights);
+	case Format::PFM:
+		return decode_pfm(file, width, height, heights, low, high);
+	case Format::TIFF:
+		return decode_tiff(file, width, height, heights, low, high);
+	}
+	return false;
+}
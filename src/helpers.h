@@ -1,5 +1,7 @@
 #pragma once
 
+#include <algorithm>
+#include <cctype>
 #include <string>
 #include <cmath>
 #include <glad/gl.h>
@@ -7,6 +9,16 @@
 
 #include "terrapainter/math.h"
 
+// The extension of `path` in lowercase without the dot, or "" if it has none
+inline std::string file_extension(const std::string& path) {
+	size_t dot = path.rfind('.');
+	size_t separator = path.find_last_of("/\\");
+	if (dot == path.npos || (separator != path.npos && dot < separator)) return "";
+	std::string extension = path.substr(dot + 1);
+	std::transform(extension.begin(), extension.end(), extension.begin(), [](unsigned char c) { return char(std::tolower(c)); });
+	return extension;
+}
+
 class RGBAImage {
 	uint8_t* mData;
 	ivec2 mSize;
@@ -0,0 +1,241 @@
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+#include "terrapainter/tile_codec.h"
+
+#include "history.h"
+#include "canvas.h"
+#include "virtual_canvas.h"
+
+// How long update() may spend moving tiles into main memory each frame
+constexpr auto LANDING_TIME_BUDGET = std::chrono::microseconds(1500);
+// How many tiles are mapped at once while landing. Mapping has some fixed
+// overhead, but we can only check the deadline in between maps.
+constexpr size_t LANDING_BATCH = 16;
+
+CanvasHistory::Entry::~Entry() noexcept {
+	if (pbo) glDeleteBuffers(1, &pbo);
+	if (fence) glDeleteSync(fence);
+}
+
+CanvasHistory::CanvasHistory() {
+	mCanvasSize = ivec2::zero();
+	mTileCount = ivec2::zero();
+	mFormat = canvas_format_info(CanvasFormat::RGBA8);
+	mBudget = DEFAULT_BUDGET;
+	mCompress = true;
+}
+CanvasHistory::~CanvasHistory() noexcept {
+	// Entries own GL objects, make sure they go first
+	mUndo.clear();
+	mRedo.clear();
+}
+void CanvasHistory::reset(ivec2 canvasSize, CanvasFormat format) {
+	mUndo.clear();
+	mRedo.clear();
+	mCanvasSize = canvasSize;
+	mFormat = canvas_format_info(format);
+	mTileCount = (canvasSize + ivec2::splat(TILE_SIZE - 1)) / TILE_SIZE;
+	mStrokeTiles.assign(size_t(mTileCount.x) * size_t(mTileCount.y), false);
+}
+void CanvasHistory::mark(const CanvasRegion& region) {
+	ivec2 lo = math::vmax(region.min, ivec2::zero());
+	ivec2 hi = math::vmin(region.max, mCanvasSize);
+	if (lo.x >= hi.x || lo.y >= hi.y) return;
+	ivec2 firstTile = lo / TILE_SIZE;
+	ivec2 lastTile = (hi - ivec2::splat(1)) / TILE_SIZE;
+	for (int y = firstTile.y; y <= lastTile.y; y++) {
+		for (int x = firstTile.x; x <= lastTile.x; x++) {
+			mStrokeTiles[size_t(y) * mTileCount.x + x] = true;
+		}
+	}
+}
+void CanvasHistory::commit(const VirtualCanvas& before) {
+	std::vector<ivec2> origins;
+	for (int y = 0; y < mTileCount.y; y++) {
+		for (int x = 0; x < mTileCount.x; x++) {
+			if (mStrokeTiles[size_t(y) * mTileCount.x + x]) {
+				origins.push_back(ivec2(x, y) * TILE_SIZE);
+			}
+		}
+	}
+	std::fill(mStrokeTiles.begin(), mStrokeTiles.end(), false);
+	// Some strokes don't actually touch anything (i.e. a splatter stroke
+	// shorter than the splat interval)
+	if (origins.empty()) return;
+	mUndo.push_back(capture(before, origins));
+	mRedo.clear();
+	enforce_budget();
+}
+std::unique_ptr<CanvasHistory::Entry> CanvasHistory::capture(const VirtualCanvas& canvas, const std::vector<ivec2>& origins) {
+	auto entry = std::make_unique<Entry>();
+	entry->tiles.reserve(origins.size());
+	std::vector<VirtualCanvas::Readback> pieces;
+	pieces.reserve(origins.size());
+	size_t offset = 0;
+	for (ivec2 origin : origins) {
+		ivec2 size = math::vmin(ivec2::splat(TILE_SIZE), mCanvasSize - origin);
+		entry->tiles.push_back(Tile{ .origin = origin, .size = size, .offset = offset, .data = {}, .compressed = false });
+		pieces.push_back({ origin, size, offset });
+		offset += size_t(size.x) * size_t(size.y) * mFormat.bytesPerPixel;
+	}
+	entry->pboBytes = offset;
+
+	glGenBuffers(1, &entry->pbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, entry->pbo);
+	glBufferData(GL_PIXEL_PACK_BUFFER, entry->pboBytes, nullptr, GL_STREAM_READ);
+	canvas.read_into_buffer(pieces);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	entry->fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+	return entry;
+}
+void CanvasHistory::apply(VirtualCanvas& canvas, Entry& entry) {
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, canvas.atlas());
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	// Tiles which have landed are uploaded from main memory...
+	for (size_t i = 0; i < entry.landed; i++) {
+		const Tile& tile = entry.tiles[i];
+		const uint8_t* pixels = tile.data.data();
+		if (tile.compressed) {
+			mScratch.resize(size_t(tile.size.x) * size_t(tile.size.y) * mFormat.bytesPerPixel);
+			if (!tile_codec::decode(tile.data, mScratch, tile.size.x, tile.size.y, mFormat.bytesPerPixel)) {
+				// Leave the tile as it is rather than upload garbage
+				fprintf(stderr, "[error] history tile at (%d, %d) is corrupt, skipping it\n", tile.origin.x, tile.origin.y);
+				continue;
+			}
+			pixels = mScratch.data();
+		}
+		auto location = canvas.locate(tile.origin);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, location.offset.x, location.offset.y, location.layer, tile.size.x, tile.size.y, 1, mFormat.format, mFormat.type, pixels);
+	}
+	// ...and the rest are copied straight out of the PBO, without waiting
+	// for the readback to finish on our end
+	if (entry.landed < entry.tiles.size()) {
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, entry.pbo);
+		for (size_t i = entry.landed; i < entry.tiles.size(); i++) {
+			const Tile& tile = entry.tiles[i];
+			auto location = canvas.locate(tile.origin);
+			glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, location.offset.x, location.offset.y, location.layer, tile.size.x, tile.size.y, 1, mFormat.format, mFormat.type, (void*)(tile.offset));
+		}
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+	}
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+bool CanvasHistory::land(Entry& entry, std::chrono::steady_clock::time_point deadline) {
+	if (entry.landed == entry.tiles.size()) return true;
+	if (entry.fence) {
+		GLenum status = glClientWaitSync(entry.fence, 0, 0);
+		if (status == GL_TIMEOUT_EXPIRED) return false;
+		if (status == GL_WAIT_FAILED) {
+			fprintf(stderr, "[error] history fence wait failed\n");
+			return false;
+		}
+		glDeleteSync(entry.fence);
+		entry.fence = nullptr;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, entry.pbo);
+	while (entry.landed < entry.tiles.size() && std::chrono::steady_clock::now() < deadline) {
+		size_t first = entry.landed;
+		size_t last = std::min(first + LANDING_BATCH, entry.tiles.size());
+		size_t begin = entry.tiles[first].offset;
+		size_t end = last < entry.tiles.size() ? entry.tiles[last].offset : entry.pboBytes;
+		auto* mapped = static_cast<const uint8_t*>(glMapBufferRange(GL_PIXEL_PACK_BUFFER, begin, end - begin, GL_MAP_READ_BIT));
+		if (!mapped) {
+			fprintf(stderr, "[error] failed to map history buffer\n");
+			break;
+		}
+		for (size_t i = first; i < last; i++) {
+			Tile& tile = entry.tiles[i];
+			std::span<const uint8_t> pixels(mapped + (tile.offset - begin), size_t(tile.size.x) * size_t(tile.size.y) * mFormat.bytesPerPixel);
+			if (mCompress) {
+				tile.data = tile_codec::encode(pixels, tile.size.x, tile.size.y, mFormat.bytesPerPixel);
+				tile.compressed = true;
+			}
+			else {
+				tile.data.assign(pixels.begin(), pixels.end());
+				tile.compressed = false;
+			}
+			entry.hostBytes += tile.data.size();
+		}
+		if (!glUnmapBuffer(GL_PIXEL_PACK_BUFFER)) {
+			// The buffer contents got trashed (i.e. display mode change) while
+			// mapped. Rare enough that we just let that tile batch be garbage.
+			fprintf(stderr, "[error] history buffer was corrupted while mapped\n");
+		}
+		entry.landed = last;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	if (entry.landed == entry.tiles.size()) {
+		glDeleteBuffers(1, &entry.pbo);
+		entry.pbo = 0;
+		entry.pboBytes = 0;
+		return true;
+	}
+	return false;
+}
+CanvasRegion CanvasHistory::step(VirtualCanvas& canvas, std::deque<std::unique_ptr<Entry>>& from, std::deque<std::unique_ptr<Entry>>& to) {
+	if (from.empty()) return CanvasRegion::empty();
+	std::unique_ptr<Entry> target = std::move(from.back());
+	from.pop_back();
+	std::vector<ivec2> origins;
+	origins.reserve(target->tiles.size());
+	CanvasRegion modified = CanvasRegion::empty();
+	for (const Tile& tile : target->tiles) {
+		origins.push_back(tile.origin);
+		modified = CanvasRegion::merge(modified, CanvasRegion(tile.origin, tile.origin + tile.size));
+	}
+	// Order matters: this reads the tiles before apply overwrites them.
+	// GL guarantees both happen in submission order, so nothing blocks.
+	to.push_back(capture(canvas, origins));
+	apply(canvas, *target);
+	enforce_budget();
+	return modified;
+}
+CanvasRegion CanvasHistory::undo(VirtualCanvas& canvas) {
+	return step(canvas, mUndo, mRedo);
+}
+CanvasRegion CanvasHistory::redo(VirtualCanvas& canvas) {
+	return step(canvas, mRedo, mUndo);
+}
+void CanvasHistory::update() {
+	auto deadline = std::chrono::steady_clock::now() + LANDING_TIME_BUDGET;
+	// Newer entries are the likeliest to be undone, but it doesn't really
+	// matter whether they're in the PBO or main memory when that happens.
+	// Land the oldest first, since those have had the most time to finish.
+	for (auto* stack : { &mUndo, &mRedo }) {
+		for (auto& entry : *stack) {
+			if (!land(*entry, deadline)) break;
+		}
+	}
+	// Compression shrinks entries as they land
+	enforce_budget();
+}
+size_t CanvasHistory::memory_usage() const {
+	size_t total = 0;
+	for (auto& entry : mUndo) total += entry->memory_usage();
+	for (auto& entry : mRedo) total += entry->memory_usage();
+	return total;
+}
+size_t CanvasHistory::pending_count() const {
+	size_t count = 0;
+	for (auto& entry : mUndo) count += entry->landed < entry->tiles.size();
+	for (auto& entry : mRedo) count += entry->landed < entry->tiles.size();
+	return count;
+}
+void CanvasHistory::set_budget(size_t bytes) {
+	mBudget = bytes;
+	enforce_budget();
+}
+void CanvasHistory::enforce_budget() {
+	size_t usage = memory_usage();
+	// Drop the states furthest from the current one: the bottom of the
+	// undo stack, then the far end of the redo stack
+	while (usage > mBudget && mUndo.size() + mRedo.size() > 1) {
+		auto& stack = mUndo.empty() ? mRedo : mUndo;
+		usage -= stack.front()->memory_usage();
+		stack.pop_front();
+	}
+}
@@ -0,0 +1,133 @@
+#pragma once
+
+#include <chrono>
+#include <deque>
+#include <memory>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include "terrapainter/math.h"
+
+#include "canvas_format.h"
+
+struct CanvasRegion;
+class VirtualCanvas;
+
+// Tile-based undo/redo for the canvas.
+//
+// This is pretty much what the notes in canvas.h describe. While a stroke is
+// in progress, we mark every tile it touches. When it's committed, those tiles
+// are read out of the pre-stroke canvas into a pixel buffer object, which
+// the GPU fills in on its own time. Once the fence after the readback has
+// signalled, the tiles are copied (and optionally compressed) into main memory
+// a few at a time, so a huge stroke doesn't stall any one frame.
+//
+// If the user undoes before an entry has landed, we don't wait for it --
+// the remaining tiles are uploaded straight from the PBO, which never leaves
+// the GPU. Undoing first captures the tiles it's about to overwrite the same
+// way, and that becomes the redo entry (and vice versa).
+class CanvasHistory {
+public:
+	// Tiles are square, except along the right and top edges of the canvas.
+	static constexpr int TILE_SIZE = 64;
+	static constexpr size_t DEFAULT_BUDGET = size_t(512) << 20;
+private:
+	struct Tile {
+		// Bottom left corner & dimensions in canvas pixels
+		ivec2 origin;
+		ivec2 size;
+		// Byte offset of this tile's pixels within the entry's PBO
+		size_t offset;
+		// The pixels, once they've landed in main memory
+		std::vector<uint8_t> data;
+		// Whether data was passed through tile_codec
+		bool compressed;
+	};
+	// A set of tiles which will step the canvas to a different state.
+	struct Entry {
+		std::vector<Tile> tiles;
+		// Tiles [0, landed) are in main memory, the rest are only in the PBO.
+		size_t landed = 0;
+		// Zero once every tile has landed
+		GLuint pbo = 0;
+		size_t pboBytes = 0;
+		// Signalled once the readback into pbo is complete.
+		// Null once that's been observed.
+		GLsync fence = nullptr;
+		size_t hostBytes = 0;
+
+		Entry() = default;
+		Entry(const Entry&) = delete;
+		Entry& operator=(const Entry&) = delete;
+		~Entry() noexcept;
+
+		size_t memory_usage() const { return pboBytes + hostBytes; }
+	};
+
+	// The dimensions & format of the canvas
+	ivec2 mCanvasSize;
+	CanvasFormatInfo mFormat;
+	// The number of tiles along each axis
+	ivec2 mTileCount;
+	// One flag per tile, set if the current stroke touched it
+	std::vector<bool> mStrokeTiles;
+	// Most recent entries are at the back of both of these
+	std::deque<std::unique_ptr<Entry>> mUndo;
+	std::deque<std::unique_ptr<Entry>> mRedo;
+
+	// Scratch space for decompressing tiles before upload
+	std::vector<uint8_t> mScratch;
+
+	size_t mBudget;
+	bool mCompress;
+
+	std::unique_ptr<Entry> capture(const VirtualCanvas& canvas, const std::vector<ivec2>& origins);
+	void apply(VirtualCanvas& canvas, Entry& entry);
+	// Moves tiles into main memory until `deadline` passes.
+	// Returns true if the whole entry has landed.
+	bool land(Entry& entry, std::chrono::steady_clock::time_point deadline);
+	// Evicts the oldest entries until we're within budget
+	void enforce_budget();
+	// Swaps the canvas to the state stored at the back of `from`,
+	// pushing the state it replaced onto `to`.
+	CanvasRegion step(VirtualCanvas& canvas, std::deque<std::unique_ptr<Entry>>& from, std::deque<std::unique_ptr<Entry>>& to);
+public:
+	CanvasHistory();
+	~CanvasHistory() noexcept;
+
+	CanvasHistory(const CanvasHistory&) = delete;
+	CanvasHistory& operator=(const CanvasHistory&) = delete;
+
+	// Forgets everything and prepares for a canvas of the given size & format.
+	void reset(ivec2 canvasSize, CanvasFormat format);
+	// Marks the tiles overlapping `region` as touched by the current stroke.
+	void mark(const CanvasRegion& region);
+	// Ends the current stroke, recording the marked tiles of `before`,
+	// which must still contain the canvas from before the stroke.
+	// The marked tiles must be resident (see VirtualCanvas).
+	// This clears the redo stack.
+	void commit(const VirtualCanvas& before);
+
+	// Both of these modify `canvas` in place. They return a bound on
+	// the modified region, which is empty if there was nothing to undo/redo.
+	CanvasRegion undo(VirtualCanvas& canvas);
+	CanvasRegion redo(VirtualCanvas& canvas);
+
+	// Call once per frame to make progress on pending transfers.
+	void update();
+
+	size_t undo_count() const { return mUndo.size(); }
+	size_t redo_count() const { return mRedo.size(); }
+	// Total bytes used by both PBOs and host copies
+	size_t memory_usage() const;
+	// Number of entries which haven't fully landed in main memory
+	size_t pending_count() const;
+
+	size_t budget() const { return mBudget; }
+	// The most recent entry is always kept, even if it alone exceeds this.
+	void set_budget(size_t bytes);
+	bool compression() const { return mCompress; }
+	// Only affects tiles which land after this is changed.
+	void set_compression(bool enabled) { mCompress = enabled; }
+};
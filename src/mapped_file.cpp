@@ -0,0 +1,110 @@
+#include "terrapainter/mapped_file.h"
+
+#include <algorithm>
+
+#if _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+MappedFile::MappedFile() {
+	mData = nullptr;
+	mSize = 0;
+#if _WIN32
+	mFile = INVALID_HANDLE_VALUE;
+	mMapping = nullptr;
+#else
+	mFile = -1;
+#endif
+}
+MappedFile::~MappedFile() noexcept {
+	close();
+}
+#if _WIN32
+bool MappedFile::open(const std::string& path) {
+	close();
+	// Paths come from the file dialog as UTF-8
+	int length = MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, nullptr, 0);
+	std::wstring widePath(size_t(std::max(length, 1)), L'\0');
+	MultiByteToWideChar(CP_UTF8, 0, path.c_str(), -1, widePath.data(), length);
+	mFile = CreateFileW(widePath.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (mFile == INVALID_HANDLE_VALUE) return false;
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(mFile, &size)) {
+		close();
+		return false;
+	}
+	mSize = size_t(size.QuadPart);
+	// Empty files can't be mapped
+	if (mSize == 0) return true;
+	mMapping = CreateFileMappingW(mFile, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (mMapping) mData = static_cast<const uint8_t*>(MapViewOfFile(mMapping, FILE_MAP_READ, 0, 0, 0));
+	if (!mData) {
+		close();
+		return false;
+	}
+	return true;
+}
+void MappedFile::close() {
+	if (mData) UnmapViewOfFile(mData);
+	if (mMapping) CloseHandle(mMapping);
+	if (mFile != INVALID_HANDLE_VALUE) CloseHandle(mFile);
+	mData = nullptr;
+	mSize = 0;
+	mMapping = nullptr;
+	mFile = INVALID_HANDLE_VALUE;
+}
+void MappedFile::prefetch(size_t offset, size_t bytes) const {
+	// FILE_FLAG_SEQUENTIAL_SCAN already has the cache manager read ahead
+}
+bool MappedFile::is_open() const {
+	return mFile != INVALID_HANDLE_VALUE;
+}
+#else
+bool MappedFile::open(const std::string& path) {
+	close();
+	mFile = ::open(path.c_str(), O_RDONLY);
+	if (mFile < 0) return false;
+	struct stat info;
+	if (fstat(mFile, &info) != 0) {
+		close();
+		return false;
+	}
+	mSize = size_t(info.st_size);
+	// Empty files can't be mapped
+	if (mSize == 0) return true;
+	void* data = mmap(nullptr, mSize, PROT_READ, MAP_PRIVATE, mFile, 0);
+	if (data == MAP_FAILED) {
+		close();
+		return false;
+	}
+	mData = static_cast<const uint8_t*>(data);
+	// Mostly read front to back, so read ahead aggressively
+	madvise(data, mSize, MADV_SEQUENTIAL);
+	return true;
+}
+void MappedFile::close() {
+	if (mData) munmap(const_cast<uint8_t*>(mData), mSize);
+	if (mFile >= 0) ::close(mFile);
+	mData = nullptr;
+	mSize = 0;
+	mFile = -1;
+}
+void MappedFile::prefetch(size_t offset, size_t bytes) const {
+	if (!mData || offset >= mSize) return;
+	bytes = std::min(bytes, mSize - offset);
+	// madvise wants a page aligned start
+	size_t page = size_t(sysconf(_SC_PAGESIZE));
+	size_t start = offset / page * page;
+	madvise(const_cast<uint8_t*>(mData) + start, bytes + (offset - start), MADV_WILLNEED);
+}
+bool MappedFile::is_open() const {
+	return mFile >= 0;
+}
+#endif
@@ -0,0 +1,319 @@
+#include "terrapainter/math.h"
+
+namespace math::batch {
+	namespace {
+		// The SIMD loops below all consume four elements at a time;
+		// this is how many elements are left over for the scalar tail.
+		constexpr size_t simd_end(size_t count) {
+		#if TP_SIMD
+			return count & ~size_t(3);
+		#else
+			return 0;
+		#endif
+		}
+
+		void trs_scalar(float px, float py, float pz, float ax, float ay, float az, float sx, float sy, float sz, mat4& out) {
+			mat3 r = mat3::rotate_xyz(ax, ay, az);
+			vec3 r0 = r.row(0), r1 = r.row(1), r2 = r.row(2);
+			out = {
+				r0.x * sx, r0.y * sy, r0.z * sz, px,
+				r1.x * sx, r1.y * sy, r1.z * sz, py,
+				r2.x * sx, r2.y * sy, r2.z * sz, pz,
+				0, 0, 0, 1
+			};
+		}
+
+	#if TP_SIMD
+		using simd::f32x4;
+
+		inline f32x4 neg(f32x4 v) { return simd::sub(simd::splat(0.0f), v); }
+
+		// Computes the sine and cosine of all four lanes at once.
+		// This is the usual Cephes approach: reduce to [-pi/4, pi/4] by
+		// subtracting the nearest multiple of pi/2 (in three parts, so the
+		// reduction stays exact for reasonably sized angles), evaluate both
+		// minimax polynomials, then pick and negate based on the quadrant.
+		// Accurate to a couple of ULPs for |x| < 8192, which is plenty for
+		// angles coming out of an editor.
+		void sincos(f32x4 x, f32x4& s, f32x4& c) {
+		#if defined(TP_SIMD_SSE)
+			__m128i quadrant = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(0.63661977236758134f)));
+			f32x4 k = _mm_cvtepi32_ps(quadrant);
+		#elif defined(TP_SIMD_NEON)
+			int32x4_t quadrant = vcvtnq_s32_f32(vmulq_f32(x, vdupq_n_f32(0.63661977236758134f)));
+			f32x4 k = vcvtq_f32_s32(quadrant);
+		#endif
+			f32x4 r = simd::madd(k, simd::splat(-1.5703125f), x);
+			r = simd::madd(k, simd::splat(-4.837512969970703125e-4f), r);
+			r = simd::madd(k, simd::splat(-7.54978995489188216e-8f), r);
+			f32x4 r2 = simd::mul(r, r);
+
+			f32x4 sp = simd::madd(r2, simd::splat(-1.9515295891e-4f), simd::splat(8.3321608736e-3f));
+			sp = simd::madd(sp, r2, simd::splat(-1.6666654611e-1f));
+			sp = simd::madd(simd::mul(sp, r2), r, r);
+
+			f32x4 cp = simd::madd(r2, simd::splat(2.443315711809948e-5f), simd::splat(-1.388731625493765e-3f));
+			cp = simd::madd(cp, r2, simd::splat(4.166664568298827e-2f));
+			cp = simd::madd(simd::mul(cp, r2), r2, simd::madd(r2, simd::splat(-0.5f), simd::splat(1.0f)));
+
+			// Quadrant 0: ( sin,  cos)   1: ( cos, -sin)
+			//          2: (-sin, -cos)   3: (-cos,  sin)
+		#if defined(TP_SIMD_SSE)
+			__m128i one = _mm_set1_epi32(1);
+			__m128i two = _mm_set1_epi32(2);
+			f32x4 swap = _mm_castsi128_ps(_mm_cmpeq_epi32(_mm_and_si128(quadrant, one), one));
+			f32x4 sinSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(quadrant, two), 30));
+			f32x4 cosSign = _mm_castsi128_ps(_mm_slli_epi32(_mm_and_si128(_mm_add_epi32(quadrant, one), two), 30));
+			f32x4 sinMag = _mm_or_ps(_mm_and_ps(swap, cp), _mm_andnot_ps(swap, sp));
+			f32x4 cosMag = _mm_or_ps(_mm_and_ps(swap, sp), _mm_andnot_ps(swap, cp));
+			s = _mm_xor_ps(sinMag, sinSign);
+			c = _mm_xor_ps(cosMag, cosSign);
+		#elif defined(TP_SIMD_NEON)
+			int32x4_t one = vdupq_n_s32(1);
+			int32x4_t two = vdupq_n_s32(2);
+			uint32x4_t swap = vtstq_s32(quadrant, one);
+			uint32x4_t sinSign = vreinterpretq_u32_s32(vshlq_n_s32(vandq_s32(quadrant, two), 30));
+			uint32x4_t cosSign = vreinterpretq_u32_s32(vshlq_n_s32(vandq_s32(vaddq_s32(quadrant, one), two), 30));
+			f32x4 sinMag = vbslq_f32(swap, cp, sp);
+			f32x4 cosMag = vbslq_f32(swap, sp, cp);
+			s = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(sinMag), sinSign));
+			c = vreinterpretq_f32_u32(veorq_u32(vreinterpretq_u32_f32(cosMag), cosSign));
+		#endif
+		}
+	#endif
+	}
+
+	void transform_points(const mat4& m, csoa3 in, soa3 out) {
+		assert(in.size() == out.size());
+		const size_t count = in.size();
+		const size_t end = simd_end(count);
+	#if TP_SIMD
+		f32x4 e[3][4];
+		for (size_t i = 0; i < 3; i++) {
+			for (size_t j = 0; j < 4; j++) e[i][j] = simd::splat(m.row(i)[j]);
+		}
+		for (size_t i = 0; i < end; i += 4) {
+			f32x4 x = simd::loadu(&in.x[i]);
+			f32x4 y = simd::loadu(&in.y[i]);
+			f32x4 z = simd::loadu(&in.z[i]);
+			f32x4 rx = simd::madd(e[0][0], x, simd::madd(e[0][1], y, simd::madd(e[0][2], z, e[0][3])));
+			f32x4 ry = simd::madd(e[1][0], x, simd::madd(e[1][1], y, simd::madd(e[1][2], z, e[1][3])));
+			f32x4 rz = simd::madd(e[2][0], x, simd::madd(e[2][1], y, simd::madd(e[2][2], z, e[2][3])));
+			simd::storeu(&out.x[i], rx);
+			simd::storeu(&out.y[i], ry);
+			simd::storeu(&out.z[i], rz);
+		}
+	#endif
+		for (size_t i = end; i < count; i++) {
+			vec4 p = { in.x[i], in.y[i], in.z[i], 1.0f };
+			out.x[i] = math::dot(m.row(0), p);
+			out.y[i] = math::dot(m.row(1), p);
+			out.z[i] = math::dot(m.row(2), p);
+		}
+	}
+
+	void transform_vectors(const mat4& m, csoa3 in, soa3 out) {
+		assert(in.size() == out.size());
+		const size_t count = in.size();
+		const size_t end = simd_end(count);
+	#if TP_SIMD
+		f32x4 e[3][3];
+		for (size_t i = 0; i < 3; i++) {
+			for (size_t j = 0; j < 3; j++) e[i][j] = simd::splat(m.row(i)[j]);
+		}
+		for (size_t i = 0; i < end; i += 4) {
+			f32x4 x = simd::loadu(&in.x[i]);
+			f32x4 y = simd::loadu(&in.y[i]);
+			f32x4 z = simd::loadu(&in.z[i]);
+			f32x4 rx = simd::madd(e[0][0], x, simd::madd(e[0][1], y, simd::mul(e[0][2], z)));
+			f32x4 ry = simd::madd(e[1][0], x, simd::madd(e[1][1], y, simd::mul(e[1][2], z)));
+			f32x4 rz = simd::madd(e[2][0], x, simd::madd(e[2][1], y, simd::mul(e[2][2], z)));
+			simd::storeu(&out.x[i], rx);
+			simd::storeu(&out.y[i], ry);
+			simd::storeu(&out.z[i], rz);
+		}
+	#endif
+		for (size_t i = end; i < count; i++) {
+			vec4 v = { in.x[i], in.y[i], in.z[i], 0.0f };
+			out.x[i] = math::dot(m.row(0), v);
+			out.y[i] = math::dot(m.row(1), v);
+			out.z[i] = math::dot(m.row(2), v);
+		}
+	}
+
+	void build_trs(csoa3 positions, csoa3 angles, csoa3 scales, std::span<mat4> out) {
+		assert(positions.size() == out.size() && angles.size() == out.size() && scales.size() == out.size());
+		const size_t count = out.size();
+		const size_t end = simd_end(count);
+	#if TP_SIMD
+		for (size_t i = 0; i < end; i += 4) {
+			f32x4 sX, cX, sY, cY, sZ, cZ;
+			sincos(simd::loadu(&angles.x[i]), sX, cX);
+			sincos(simd::loadu(&angles.y[i]), sY, cY);
+			sincos(simd::loadu(&angles.z[i]), sZ, cZ);
+			f32x4 kx = simd::loadu(&scales.x[i]);
+			f32x4 ky = simd::loadu(&scales.y[i]);
+			f32x4 kz = simd::loadu(&scales.z[i]);
+
+			// Same terms as mat3::rotate_xyz, with each column then scaled
+			f32x4 sXsY = simd::mul(sX, sY);
+			f32x4 cXsY = simd::mul(cX, sY);
+			f32x4 rows[3][4] = {
+				{
+					simd::mul(simd::mul(cY, cZ), kx),
+					simd::mul(simd::sub(neg(simd::mul(sXsY, cZ)), simd::mul(cX, sZ)), ky),
+					simd::mul(simd::madd(sX, sZ, neg(simd::mul(cXsY, cZ))), kz),
+					simd::loadu(&positions.x[i])
+				},
+				{
+					simd::mul(simd::mul(cY, sZ), kx),
+					simd::mul(simd::madd(cX, cZ, neg(simd::mul(sXsY, sZ))), ky),
+					simd::mul(simd::sub(neg(simd::mul(cXsY, sZ)), simd::mul(sX, cZ)), kz),
+					simd::loadu(&positions.y[i])
+				},
+				{
+					simd::mul(sY, kx),
+					simd::mul(simd::mul(sX, cY), ky),
+					simd::mul(simd::mul(cX, cY), kz),
+					simd::loadu(&positions.z[i])
+				}
+			};
+			// Each register holds one entry of four different matrices;
+			// transposing turns them into one row of each matrix.
+			for (size_t r = 0; r < 3; r++) {
+				f32x4 a = rows[r][0], b = rows[r][1], c = rows[r][2], d = rows[r][3];
+				simd::transpose(a, b, c, d);
+				vec4 row[4];
+				simd::store(row[0].data(), a);
+				simd::store(row[1].data(), b);
+				simd::store(row[2].data(), c);
+				simd::store(row[3].data(), d);
+				for (size_t k = 0; k < 4; k++) out[i + k].set_row(r, row[k]);
+			}
+			for (size_t k = 0; k < 4; k++) {
+				out[i + k].set_row(3, vec4(0, 0, 0, 1));
+			}
+		}
+	#endif
+		for (size_t i = end; i < count; i++) {
+			trs_scalar(
+				positions.x[i], positions.y[i], positions.z[i],
+				angles.x[i], angles.y[i], angles.z[i],
+				scales.x[i], scales.y[i], scales.z[i],
+				out[i]
+			);
+		}
+	}
+
+	void dot(csoa3 a, csoa3 b, std::span<float> out) {
+		assert(a.size() == out.size() && b.size() == out.size());
+		const size_t count = out.size();
+		const size_t end = simd_end(count);
+	#if TP_SIMD
+		for (size_t i = 0; i < end; i += 4) {
+			f32x4 r = simd::mul(simd::loadu(&a.z[i]), simd::loadu(&b.z[i]));
+			r = simd::madd(simd::loadu(&a.y[i]), simd::loadu(&b.y[i]), r);
+			r = simd::madd(simd::loadu(&a.x[i]), simd::loadu(&b.x[i]), r);
+			simd::storeu(&out[i], r);
+		}
+	#endif
+		for (size_t i = end; i < count; i++) {
+			out[i] = a.x[i] * b.x[i] + a.y[i] * b.y[i] + a.z[i] * b.z[i];
+		}
+	}
+
+	void cross(csoa3 a, csoa3 b, soa3 out) {
+		assert(a.size() == out.size() && b.size() == out.size());
+		const size_t count = out.size();
+		const size_t end = simd_end(count);
+	#if TP_SIMD
+		for (size_t i = 0; i < end; i += 4) {
+			f32x4 ax = simd::loadu(&a.x[i]), ay = simd::loadu(&a.y[i]), az = simd::loadu(&a.z[i]);
+			f32x4 bx = simd::loadu(&b.x[i]), by = simd::loadu(&b.y[i]), bz = simd::loadu(&b.z[i]);
+			simd::storeu(&out.x[i], simd::sub(simd::mul(ay, bz), simd::mul(az, by)));
+			simd::storeu(&out.y[i], simd::sub(simd::mul(az, bx), simd::mul(ax, bz)));
+			simd::storeu(&out.z[i], simd::sub(simd::mul(ax, by), simd::mul(ay, bx)));
+		}
+	#endif
+		for (size_t i = end; i < count; i++) {
+			float ax = a.x[i], ay = a.y[i], az = a.z[i];
+			float bx = b.x[i], by = b.y[i], bz = b.z[i];
+			out.x[i] = ay * bz - az * by;
+			out.y[i] = az * bx - ax * bz;
+			out.z[i] = ax * by - ay * bx;
+		}
+	}
+
+	size_t frustum_cull(const Frustum& frustum, csoa3 mins, csoa3 maxs, std::span<uint8_t> visible) {
+		assert(mins.size() == visible.size() && maxs.size() == visible.size());
+		const size_t count = visible.size();
+		const size_t end = simd_end(count);
+		size_t numVisible = 0;
+	#if TP_SIMD
+		for (size_t i = 0; i < end; i += 4) {
+			f32x4 lo[3] = { simd::loadu(&mins.x[i]), simd::loadu(&mins.y[i]), simd::loadu(&mins.z[i]) };
+			f32x4 hi[3] = { simd::loadu(&maxs.x[i]), simd::loadu(&maxs.y[i]), simd::loadu(&maxs.z[i]) };
+			// The smallest "furthest reach" along any plane's normal.
+			// If that's behind the plane, the box is entirely outside.
+			f32x4 nearest = simd::splat(std::numeric_limits<float>::infinity());
+			for (const Plane& plane : frustum.planes) {
+				// The normal is the same for all four boxes, so picking the
+				// corner furthest along it is just a scalar branch per axis
+				f32x4 px = plane.normal.x >= 0 ? hi[0] : lo[0];
+				f32x4 py = plane.normal.y >= 0 ? hi[1] : lo[1];
+				f32x4 pz = plane.normal.z >= 0 ? hi[2] : lo[2];
+				f32x4 dist = simd::madd(simd::splat(plane.normal.x), px,
+					simd::madd(simd::splat(plane.normal.y), py,
+					simd::madd(simd::splat(plane.normal.z), pz, simd::splat(plane.offset))));
+				nearest = simd::min(nearest, dist);
+			}
+			alignas(16) float lanes[4];
+			simd::store(lanes, nearest);
+			for (size_t k = 0; k < 4; k++) {
+				visible[i + k] = lanes[k] >= 0;
+				numVisible += visible[i + k];
+			}
+		}
+	#endif
+		for (size_t i = end; i < count; i++) {
+			AABB box = { vec3(mins.x[i], mins.y[i], mins.z[i]), vec3(maxs.x[i], maxs.y[i], maxs.z[i]) };
+			visible[i] = frustum.intersects(box);
+			numVisible += visible[i];
+		}
+		return numVisible;
+	}
+
+	size_t frustum_cull(const Frustum& frustum, csoa3 centers, std::span<const float> radii, std::span<uint8_t> visible) {
+		assert(centers.size() == visible.size() && radii.size() == visible.size());
+		const size_t count = visible.size();
+		const size_t end = simd_end(count);
+		size_t numVisible = 0;
+	#if TP_SIMD
+		for (size_t i = 0; i < end; i += 4) {
+			f32x4 cx = simd::loadu(&centers.x[i]);
+			f32x4 cy = simd::loadu(&centers.y[i]);
+			f32x4 cz = simd::loadu(&centers.z[i]);
+			f32x4 nearest = simd::splat(std::numeric_limits<float>::infinity());
+			for (const Plane& plane : frustum.planes) {
+				f32x4 dist = simd::madd(simd::splat(plane.normal.x), cx,
+					simd::madd(simd::splat(plane.normal.y), cy,
+					simd::madd(simd::splat(plane.normal.z), cz, simd::splat(plane.offset))));
+				nearest = simd::min(nearest, dist);
+			}
+			nearest = simd::add(nearest, simd::loadu(&radii[i]));
+			alignas(16) float lanes[4];
+			simd::store(lanes, nearest);
+			for (size_t k = 0; k < 4; k++) {
+				visible[i + k] = lanes[k] >= 0;
+				numVisible += visible[i + k];
+			}
+		}
+	#endif
+		for (size_t i = end; i < count; i++) {
+			Sphere sphere = { vec3(centers.x[i], centers.y[i], centers.z[i]), radii[i] };
+			visible[i] = frustum.intersects(sphere);
+			numVisible += visible[i];
+		}
+		return numVisible;
+	}
+}
@@ -0,0 +1,393 @@
+#include "terrapainter/png_encoder.h"
+
+#include <algorithm>
+#include <array>
+#include <cassert>
+#include <chrono>
+#include <cstdlib>
+
+#include "terrapainter/thread_pool.h"
+
+namespace {
+	// Deflate only allows matches this far back
+	constexpr size_t WINDOW_SIZE = 32768;
+	constexpr size_t WINDOW_MASK = WINDOW_SIZE - 1;
+	constexpr int HASH_BITS = 15;
+	constexpr size_t MIN_MATCH = 3;
+	constexpr size_t MAX_MATCH = 258;
+
+	constexpr uint16_t LENGTH_BASE[29] = { 3, 4, 5, 6, 7, 8, 9, 10, 11, 13, 15, 17, 19, 23, 27, 31, 35, 43, 51, 59, 67, 83, 99, 115, 131, 163, 195, 227, 258 };
+	constexpr uint8_t LENGTH_EXTRA[29] = { 0, 0, 0, 0, 0, 0, 0, 0, 1, 1, 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 4, 4, 4, 4, 5, 5, 5, 5, 0 };
+	constexpr uint16_t DIST_BASE[30] = { 1, 2, 3, 4, 5, 7, 9, 13, 17, 25, 33, 49, 65, 97, 129, 193, 257, 385, 513, 769, 1025, 1537, 2049, 3073, 4097, 6145, 8193, 12289, 16385, 24577 };
+	constexpr uint8_t DIST_EXTRA[30] = { 0, 0, 0, 0, 1, 1, 2, 2, 3, 3, 4, 4, 5, 5, 6, 6, 7, 7, 8, 8, 9, 9, 10, 10, 11, 11, 12, 12, 13, 13 };
+
+	// Huffman codes go out most significant bit first, everything else least
+	uint32_t reverse_bits(uint32_t bits, int count) {
+		uint32_t reversed = 0;
+		for (int i = 0; i < count; i++) {
+			reversed = (reversed << 1) | ((bits >> i) & 1);
+		}
+		return reversed;
+	}
+
+	struct FixedCode {
+		uint16_t bits;
+		uint8_t length;
+	};
+	// The fixed literal/length code from RFC 1951, already reversed
+	const std::array<FixedCode, 288>& fixed_codes() {
+		static const auto codes = [] {
+			std::array<FixedCode, 288> codes;
+			for (int symbol = 0; symbol < 288; symbol++) {
+				uint32_t code;
+				int length;
+				if (symbol < 144) { code = 0x30 + symbol; length = 8; }
+				else if (symbol < 256) { code = 0x190 + (symbol - 144); length = 9; }
+				else if (symbol < 280) { code = symbol - 256; length = 7; }
+				else { code = 0xC0 + (symbol - 280); length = 8; }
+				codes[symbol] = FixedCode{ uint16_t(reverse_bits(code, length)), uint8_t(length) };
+			}
+			return codes;
+		}();
+		return codes;
+	}
+
+	uint32_t crc32(uint32_t crc, std::span<const uint8_t> bytes) {
+		static const auto table = [] {
+			std::array<uint32_t, 256> table;
+			for (uint32_t n = 0; n < 256; n++) {
+				uint32_t c = n;
+				for (int k = 0; k < 8; k++) c = (c & 1) ? 0xEDB88320u ^ (c >> 1) : c >> 1;
+				table[n] = c;
+			}
+			return table;
+		}();
+		crc = ~crc;
+		for (uint8_t byte : bytes) crc = table[(crc ^ byte) & 0xFF] ^ (crc >> 8);
+		return ~crc;
+	}
+
+	size_t hash3(const uint8_t* bytes) {
+		uint32_t key = (uint32_t(bytes[0]) << 16) | (uint32_t(bytes[1]) << 8) | bytes[2];
+		return (key * 2654435761u) >> (32 - HASH_BITS);
+	}
+
+	uint8_t paeth(uint8_t a, uint8_t b, uint8_t c) {
+		int p = int(a) + int(b) - int(c);
+		int pa = std::abs(p - int(a));
+		int pb = std::abs(p - int(b));
+		int pc = std::abs(p - int(c));
+		if (pa <= pb && pa <= pc) return a;
+		if (pb <= pc) return b;
+		return c;
+	}
+
+	// Band-local state for deflating one band
+	class Deflater {
+		std::vector<uint8_t>& mOut;
+		uint64_t mBits = 0;
+		int mBitCount = 0;
+	public:
+		explicit Deflater(std::vector<uint8_t>& out) : mOut(out) {}
+
+		void put_bits(uint32_t bits, int count) {
+			mBits |= uint64_t(bits) << mBitCount;
+			mBitCount += count;
+			while (mBitCount >= 8) {
+				mOut.push_back(uint8_t(mBits));
+				mBits >>= 8;
+				mBitCount -= 8;
+			}
+		}
+		void put_symbol(int symbol) {
+			const FixedCode& code = fixed_codes()[symbol];
+			put_bits(code.bits, code.length);
+		}
+		void put_match(size_t length, size_t distance) {
+			size_t li = std::upper_bound(std::begin(LENGTH_BASE), std::end(LENGTH_BASE), length) - std::begin(LENGTH_BASE) - 1;
+			put_symbol(int(257 + li));
+			put_bits(uint32_t(length - LENGTH_BASE[li]), LENGTH_EXTRA[li]);
+			size_t di = std::upper_bound(std::begin(DIST_BASE), std::end(DIST_BASE), distance) - std::begin(DIST_BASE) - 1;
+			// Distance codes are all 5 bits
+			put_bits(reverse_bits(uint32_t(di), 5), 5);
+			put_bits(uint32_t(distance - DIST_BASE[di]), DIST_EXTRA[di]);
+		}
+		// Deflates `input` as one fixed Huffman block, followed by a sync
+		// flush so whatever comes next starts on a byte boundary
+		void deflate(std::span<const uint8_t> input, PngEncoder::Level level) {
+			bool fast = level == PngEncoder::Level::FAST;
+			int maxChain = fast ? 4 : 32;
+			// Most recent position + 1 of each 3 byte hash, and the one before
+			// that for each position in the window. Zero is none.
+			std::vector<uint32_t> head(size_t(1) << HASH_BITS, 0);
+			std::vector<uint32_t> prev(WINDOW_SIZE, 0);
+			auto insert = [&](size_t pos) {
+				size_t h = hash3(&input[pos]);
+				prev[pos & WINDOW_MASK] = head[h];
+				head[h] = uint32_t(pos + 1);
+			};
+
+			put_bits(0, 1);
+			put_bits(1, 2);
+			size_t end = input.size();
+			size_t next = 0;
+			while (next < end) {
+				const uint8_t* cur = &input[next];
+				size_t best = 0;
+				size_t bestDistance = 0;
+				bool hashable = next + MIN_MATCH <= end;
+				if (hashable) {
+					size_t maxLength = std::min(MAX_MATCH, end - next);
+					size_t candidate = head[hash3(cur)];
+					for (int chain = 0; candidate && chain < maxChain; chain++) {
+						size_t pos = candidate - 1;
+						if (next - pos > WINDOW_SIZE) break;
+						const uint8_t* earlier = &input[pos];
+						size_t length = 0;
+						while (length < maxLength && earlier[length] == cur[length]) length++;
+						if (length > best) {
+							best = length;
+							bestDistance = next - pos;
+							if (length == maxLength) break;
+						}
+						// Entries only ever point further back, anything else is stale
+						size_t further = prev[pos & WINDOW_MASK];
+						if (further >= candidate) break;
+						candidate = further;
+					}
+				}
+				if (best >= MIN_MATCH) {
+					put_match(best, bestDistance);
+					// Skipping the positions inside a match is most of what
+					// makes the fast level fast, flat areas are all matches
+					size_t inserted = fast ? 1 : best;
+					for (size_t i = 0; i < inserted && next + i + MIN_MATCH <= end; i++) {
+						insert(next + i);
+					}
+					next += best;
+				}
+				else {
+					if (hashable) insert(next);
+					put_symbol(*cur);
+					next++;
+				}
+			}
+			put_symbol(256);
+			// Sync flush: an empty, non-final stored block
+			put_bits(0, 1);
+			put_bits(0, 2);
+			if (mBitCount > 0) put_bits(0, 8 - mBitCount);
+			static const uint8_t EMPTY_STORED[4] = { 0x00, 0x00, 0xFF, 0xFF };
+			mOut.insert(mOut.end(), EMPTY_STORED, EMPTY_STORED + 4);
+		}
+	};
+
+	constexpr uint32_t ADLER_MOD = 65521;
+
+	uint32_t adler32(uint32_t adler, std::span<const uint8_t> bytes) {
+		uint32_t a = adler & 0xFFFF;
+		uint32_t b = adler >> 16;
+		// Reduced often enough not to overflow
+		for (size_t i = 0; i < bytes.size(); i += 5552) {
+			size_t last = std::min(bytes.size(), i + 5552);
+			for (size_t j = i; j < last; j++) {
+				a += bytes[j];
+				b += a;
+			}
+			a %= ADLER_MOD;
+			b %= ADLER_MOD;
+		}
+		return (b << 16) | a;
+	}
+	// The Adler-32 of two streams back to back, given that of each and the
+	// length of the second. Same as zlib's adler32_combine.
+	uint32_t adler32_combine(uint32_t first, uint32_t second, size_t secondLength) {
+		uint32_t rem = uint32_t(secondLength % ADLER_MOD);
+		uint32_t a = first & 0xFFFF;
+		uint32_t b = uint32_t((uint64_t(rem) * a) % ADLER_MOD);
+		a += (second & 0xFFFF) + ADLER_MOD - 1;
+		b += (first >> 16) + (second >> 16) + ADLER_MOD - rem;
+		if (a >= ADLER_MOD) a -= ADLER_MOD;
+		if (a >= ADLER_MOD) a -= ADLER_MOD;
+		if (b >= 2 * ADLER_MOD) b -= 2 * ADLER_MOD;
+		if (b >= ADLER_MOD) b -= ADLER_MOD;
+		return (b << 16) | a;
+	}
+
+	// Filters `row` each way given in `filters` into `filtered`, indexed by
+	// filter type, and returns the best. Each starts with its filter type byte.
+	size_t filter_row(const uint8_t* row, const uint8_t* up, size_t rowBytes, size_t pixelBytes, std::span<const size_t> filters, std::vector<uint8_t> (&filtered)[5]) {
+		size_t bestFilter = 0;
+		uint64_t bestScore = UINT64_MAX;
+		// The first pixel has nothing to its left
+		size_t first = std::min(pixelBytes, rowBytes);
+		for (size_t filter : filters) {
+			filtered[filter].resize(1 + rowBytes);
+			uint8_t* out = filtered[filter].data() + 1;
+			out[-1] = uint8_t(filter);
+			switch (filter) {
+			case 0:
+				std::copy(row, row + rowBytes, out);
+				break;
+			case 1:
+				std::copy(row, row + first, out);
+				for (size_t i = first; i < rowBytes; i++) out[i] = uint8_t(row[i] - row[i - pixelBytes]);
+				break;
+			case 2:
+				for (size_t i = 0; i < rowBytes; i++) out[i] = uint8_t(row[i] - up[i]);
+				break;
+			case 3:
+				for (size_t i = 0; i < first; i++) out[i] = uint8_t(row[i] - up[i] / 2);
+				for (size_t i = first; i < rowBytes; i++) out[i] = uint8_t(row[i] - (int(row[i - pixelBytes]) + int(up[i])) / 2);
+				break;
+			default:
+				for (size_t i = 0; i < first; i++) out[i] = uint8_t(row[i] - paeth(0, up[i], 0));
+				for (size_t i = first; i < rowBytes; i++) out[i] = uint8_t(row[i] - paeth(row[i - pixelBytes], up[i], up[i - pixelBytes]));
+				break;
+			}
+			uint64_t score = 0;
+			for (size_t i = 0; i < rowBytes; i++) score += std::abs(int(int8_t(out[i])));
+			if (score < bestScore) {
+				bestScore = score;
+				bestFilter = filter;
+			}
+		}
+		return bestFilter;
+	}
+}
+
+PngEncoder::PngEncoder(BufferedSink::Sink sink, size_t width, size_t height, size_t channels, Level level, ThreadPool* pool, size_t bitDepth)
+	: mOut(std::move(sink)), mWidth(width), mHeight(height), mChannels(channels), mBitDepth(bitDepth), mLevel(level), mPool(pool) {
+	assert(width > 0 && height > 0);
+	assert(channels >= 1 && channels <= 4);
+	assert(bitDepth == 8 || bitDepth == 16);
+	mPixelBytes = channels * bitDepth / 8;
+	size_t rowBytes = width * mPixelBytes;
+	mRowsPerBand = std::max<size_t>(1, BAND_BYTES / rowBytes);
+	mRowsWritten = 0;
+	mLastRow.assign(rowBytes, 0);
+	mHeaderWritten = false;
+	mAdler = 1;
+
+	static const uint8_t SIGNATURE[8] = { 0x89, 'P', 'N', 'G', '\r', '\n', 0x1A, '\n' };
+	mOut.write(SIGNATURE);
+	static const uint8_t COLOR_TYPES[4] = { 0, 4, 2, 6 };
+	uint8_t header[13];
+	put_be32(header, uint32_t(width));
+	put_be32(header + 4, uint32_t(height));
+	header[8] = uint8_t(bitDepth);
+	header[9] = COLOR_TYPES[channels - 1];
+	header[10] = 0; // deflate
+	header[11] = 0; // adaptive filtering
+	header[12] = 0; // not interlaced
+	write_chunk("IHDR", header);
+}
+PngEncoder::~PngEncoder() noexcept {
+	// The bands' jobs refer to them
+	for (auto& band : mInFlight) {
+		if (band->done.valid()) band->done.wait();
+	}
+}
+void PngEncoder::encode_band(Band& band, size_t width, size_t pixelBytes, Level level) {
+	size_t rowBytes = width * pixelBytes;
+	size_t rows = band.rows.size() / rowBytes;
+	std::vector<uint8_t> input;
+	input.reserve(rows * (1 + rowBytes));
+	std::vector<uint8_t> filtered[5];
+	// Paeth wins most rows of a painting, and Up most of the rest
+	static const size_t ALL_FILTERS[] = { 0, 1, 2, 3, 4 };
+	static const size_t FAST_FILTERS[] = { 2, 4 };
+	std::span<const size_t> filters = level == Level::FAST ? std::span<const size_t>(FAST_FILTERS) : std::span<const size_t>(ALL_FILTERS);
+	for (size_t r = 0; r < rows; r++) {
+		const uint8_t* row = band.rows.data() + r * rowBytes;
+		const uint8_t* up = r > 0 ? row - rowBytes : band.above.data();
+		size_t best = filter_row(row, up, rowBytes, pixelBytes, filters, filtered);
+		input.insert(input.end(), filtered[best].begin(), filtered[best].end());
+	}
+	band.adler = adler32(1, input);
+	band.filteredBytes = input.size();
+	// Fixed Huffman codes never expand a byte past 9 bits
+	band.compressed.reserve(input.size() + input.size() / 8 + 16);
+	Deflater(band.compressed).deflate(input, level);
+	// Not needed anymore, don't hold onto it while waiting to be written
+	band.rows = {};
+	band.above = {};
+}
+void PngEncoder::dispatch() {
+	Band* band = mPending.get();
+	band->above = mLastRow;
+	size_t rowBytes = mWidth * mPixelBytes;
+	std::copy(band->rows.end() - rowBytes, band->rows.end(), mLastRow.begin());
+	if (mPool) {
+		band->done = mPool->submit([band, width = mWidth, pixelBytes = mPixelBytes, level = mLevel] {
+			encode_band(*band, width, pixelBytes, level);
+		});
+	}
+	else {
+		encode_band(*band, mWidth, mPixelBytes, mLevel);
+	}
+	mInFlight.push_back(std::move(mPending));
+	// A few bands per thread keeps them all busy, any more just holds memory
+	size_t maxInFlight = mPool ? 2 * mPool->size() : 0;
+	while (mInFlight.size() > maxInFlight) write_oldest();
+	// Write whatever's done already, so the file streams out steadily
+	while (!mInFlight.empty() && mInFlight.front()->done.wait_for(std::chrono::seconds(0)) == std::future_status::ready) {
+		write_oldest();
+	}
+}
+void PngEncoder::write_oldest() {
+	auto band = std::move(mInFlight.front());
+	mInFlight.pop_front();
+	if (band->done.valid()) band->done.get();
+	mAdler = adler32_combine(mAdler, band->adler, band->filteredBytes);
+	if (!mHeaderWritten) {
+		// zlib header: deflate with a 32K window, no dictionary
+		static const uint8_t ZLIB_HEADER[2] = { 0x78, 0x01 };
+		band->compressed.insert(band->compressed.begin(), ZLIB_HEADER, ZLIB_HEADER + 2);
+		mHeaderWritten = true;
+	}
+	write_chunk("IDAT", band->compressed);
+}
+void PngEncoder::write_chunk(const char type[4], std::span<const uint8_t> data) {
+	uint8_t header[8];
+	put_be32(header, uint32_t(data.size()));
+	std::copy(type, type + 4, header + 4);
+	uint8_t footer[4];
+	put_be32(footer, crc32(crc32(0, std::span(header + 4, 4)), data));
+	mOut.write(header);
+	mOut.write(data);
+	mOut.write(footer);
+}
+bool PngEncoder::write_rows(std::span<const uint8_t> rows) {
+	size_t rowBytes = mWidth * mPixelBytes;
+	assert(rows.size() % rowBytes == 0);
+	assert(mRowsWritten + rows.size() / rowBytes <= mHeight);
+	size_t offset = 0;
+	while (offset < rows.size() && !mOut.failed()) {
+		if (!mPending) {
+			mPending = std::make_unique<Band>();
+			mPending->rows.reserve(mRowsPerBand * rowBytes);
+		}
+		size_t room = mRowsPerBand * rowBytes - mPending->rows.size();
+		size_t take = std::min(room, rows.size() - offset);
+		mPending->rows.insert(mPending->rows.end(), rows.begin() + offset, rows.begin() + offset + take);
+		offset += take;
+		mRowsWritten += take / rowBytes;
+		if (mPending->rows.size() == mRowsPerBand * rowBytes) dispatch();
+	}
+	return !mOut.failed();
+}
+bool PngEncoder::finish() {
+	// Rows stop being taken once the sink fails
+	if (mOut.failed()) return false;
+	assert(mRowsWritten == mHeight);
+	if (mPending) dispatch();
+	while (!mInFlight.empty()) write_oldest();
+	// An empty final block, then the checksum
+	uint8_t trailer[6] = { 0x03, 0x00 };
+	put_be32(trailer + 2, mAdler);
+	write_chunk("IDAT", trailer);
+	write_chunk("IEND", {});
+	mOut.flush();
+	return !mOut.failed();
+}
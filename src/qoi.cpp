@@ -0,0 +1,154 @@
+#include "terrapainter/qoi.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace {
+	constexpr uint8_t OP_INDEX = 0x00;
+	constexpr uint8_t OP_DIFF = 0x40;
+	constexpr uint8_t OP_LUMA = 0x80;
+	constexpr uint8_t OP_RUN = 0xC0;
+	constexpr uint8_t OP_RGB = 0xFE;
+	constexpr uint8_t OP_RGBA = 0xFF;
+	constexpr uint8_t OP_MASK = 0xC0;
+	// Runs of 63 & 64 would collide with OP_RGB & OP_RGBA
+	constexpr int MAX_RUN = 62;
+	constexpr size_t HEADER_SIZE = 14;
+	constexpr uint8_t END_MARKER[8] = { 0, 0, 0, 0, 0, 0, 0, 1 };
+
+	size_t hash(const std::array<uint8_t, 4>& px) {
+		return (px[0] * 3 + px[1] * 5 + px[2] * 7 + px[3] * 11) % 64;
+	}
+}
+
+QoiEncoder::QoiEncoder(BufferedSink::Sink sink, size_t width, size_t height, size_t channels)
+	: mOut(std::move(sink)), mWidth(width), mHeight(height), mChannels(channels) {
+	assert(width > 0 && height > 0 && width * height <= MAX_PIXELS);
+	assert(channels == 3 || channels == 4);
+	mRowsWritten = 0;
+	mPrev = { 0, 0, 0, 255 };
+	mIndex = {};
+	mRun = 0;
+	uint8_t header[HEADER_SIZE] = { 'q', 'o', 'i', 'f' };
+	put_be32(header + 4, uint32_t(width));
+	put_be32(header + 8, uint32_t(height));
+	header[12] = uint8_t(channels);
+	header[13] = 0; // sRGB with linear alpha
+	mOut.write(header);
+}
+bool QoiEncoder::write_rows(std::span<const uint8_t> rows) {
+	assert(rows.size() % (mWidth * mChannels) == 0);
+	if (mOut.failed()) return false;
+	size_t count = rows.size() / mChannels;
+	std::array<uint8_t, 4> px = { 0, 0, 0, 255 };
+	for (size_t i = 0; i < count; i++) {
+		const uint8_t* in = rows.data() + i * mChannels;
+		std::copy(in, in + mChannels, px.begin());
+		if (px == mPrev) {
+			if (++mRun == MAX_RUN) {
+				mOut.put(uint8_t(OP_RUN | (mRun - 1)));
+				mRun = 0;
+			}
+			continue;
+		}
+		if (mRun > 0) {
+			mOut.put(uint8_t(OP_RUN | (mRun - 1)));
+			mRun = 0;
+		}
+		size_t slot = hash(px);
+		if (mIndex[slot] == px) {
+			mOut.put(uint8_t(OP_INDEX | slot));
+		}
+		else if (px[3] != mPrev[3]) {
+			mIndex[slot] = px;
+			const uint8_t op[5] = { OP_RGBA, px[0], px[1], px[2], px[3] };
+			mOut.write(op);
+		}
+		else {
+			mIndex[slot] = px;
+			// Wrapping differences, as the spec says
+			int dr = int8_t(px[0] - mPrev[0]);
+			int dg = int8_t(px[1] - mPrev[1]);
+			int db = int8_t(px[2] - mPrev[2]);
+			int drg = dr - dg;
+			int dbg = db - dg;
+			if (dr >= -2 && dr <= 1 && dg >= -2 && dg <= 1 && db >= -2 && db <= 1) {
+				mOut.put(uint8_t(OP_DIFF | ((dr + 2) << 4) | ((dg + 2) << 2) | (db + 2)));
+			}
+			else if (drg >= -8 && drg <= 7 && dg >= -32 && dg <= 31 && dbg >= -8 && dbg <= 7) {
+				mOut.put(uint8_t(OP_LUMA | (dg + 32)));
+				mOut.put(uint8_t(((drg + 8) << 4) | (dbg + 8)));
+			}
+			else {
+				const uint8_t op[4] = { OP_RGB, px[0], px[1], px[2] };
+				mOut.write(op);
+			}
+		}
+		mPrev = px;
+	}
+	mRowsWritten += count / mWidth;
+	return !mOut.failed();
+}
+bool QoiEncoder::finish() {
+	if (mOut.failed()) return false;
+	assert(mRowsWritten == mHeight);
+	if (mRun > 0) mOut.put(uint8_t(OP_RUN | (mRun - 1)));
+	mRun = 0;
+	mOut.write(END_MARKER);
+	mOut.flush();
+	return !mOut.failed();
+}
+bool QoiEncoder::decode(std::span<const uint8_t> file, size_t& width, size_t& height, std::vector<uint8_t>& pixels) {
+	if (file.size() < HEADER_SIZE + sizeof(END_MARKER)) return false;
+	const uint8_t* data = file.data();
+	if (data[0] != 'q' || data[1] != 'o' || data[2] != 'i' || data[3] != 'f') return false;
+	width = get_be32(data + 4);
+	height = get_be32(data + 8);
+	uint8_t channels = data[12];
+	if (width == 0 || height == 0 || width * height > MAX_PIXELS) return false;
+	if (channels != 3 && channels != 4) return false;
+
+	pixels.resize(width * height * 4);
+	std::array<uint8_t, 4> px = { 0, 0, 0, 255 };
+	std::array<std::array<uint8_t, 4>, 64> index = {};
+	int run = 0;
+	size_t pos = HEADER_SIZE;
+	size_t end = file.size() - sizeof(END_MARKER);
+	for (size_t i = 0; i < width * height; i++) {
+		if (run > 0) {
+			run--;
+		}
+		else {
+			if (pos >= end) return false;
+			uint8_t op = data[pos++];
+			if (op == OP_RGB || op == OP_RGBA) {
+				size_t bytes = op == OP_RGB ? 3 : 4;
+				if (end - pos < bytes) return false;
+				std::copy(data + pos, data + pos + bytes, px.begin());
+				pos += bytes;
+			}
+			else if ((op & OP_MASK) == OP_INDEX) {
+				px = index[op];
+			}
+			else if ((op & OP_MASK) == OP_DIFF) {
+				px[0] += ((op >> 4) & 3) - 2;
+				px[1] += ((op >> 2) & 3) - 2;
+				px[2] += (op & 3) - 2;
+			}
+			else if ((op & OP_MASK) == OP_LUMA) {
+				if (pos >= end) return false;
+				uint8_t next = data[pos++];
+				int dg = (op & 0x3F) - 32;
+				px[0] += dg - 8 + ((next >> 4) & 0x0F);
+				px[1] += dg;
+				px[2] += dg - 8 + (next & 0x0F);
+			}
+			else {
+				run = op & 0x3F;
+			}
+			index[hash(px)] = px;
+		}
+		std::copy(px.begin(), px.end(), pixels.begin() + i * 4);
+	}
+	return true;
+}
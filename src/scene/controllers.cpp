@@ -23,18 +23,11 @@ void NoclipController::process_frame(Entity* entity, float deltaTime) {
 
     // Get movement vectors
     // We can think of the entity's "default orientation" as pointing towards (1, 0, 0)
-    // so that's what we need to rotate. We avoid using a matrix since its overkill...
-    vec3 angles = entity->angles();
-    float sY = std::sin(angles.y);
-    float cY = std::cos(angles.y);
-    float sZ = std::sin(angles.z);
-    float cZ = std::cos(angles.z);
-    vec3 forward = vec3 { cY*cZ, cY*sZ, sY };
-
-    // We also calculate the right vector directly from angles
-    // This permits the user to look straight down or up
-    // TODO: This doesn't account for roll right now
-    vec3 right = vec3{ sZ, -cZ, 0 };
+    // with (0, 1, 0) to its left, so those are the columns of its rotation we need.
+    // The orientation is already a quaternion, so this doesn't need any trig.
+    mat3 rotation = entity->orientation().to_mat3();
+    vec3 forward = rotation.col(0);
+    vec3 right = -rotation.col(1);
 
     vec3 position = entity->position();
     if (keys[SDL_SCANCODE_W] || keys[SDL_SCANCODE_UP]) {
@@ -4,6 +4,19 @@
 Entity::Entity(vec3 position, vec3 euler_angles, vec3 scale) :
 	mPosition(position),
 	mAngles(euler_angles),
+	mOrientation(quat::rotate_xyz(euler_angles.x, euler_angles.y, euler_angles.z)),
+	mAnglesStale(false),
+	mScale(scale),
+	mParent(nullptr),
+	mChildren(),
+	mBakedWorldTransform(),
+	mBakedWorldTransformDirty(true) 
+{}
+Entity::Entity(vec3 position, quat orientation, vec3 scale) :
+	mPosition(position),
+	mAngles(),
+	mOrientation(orientation),
+	mAnglesStale(true),
 	mScale(scale),
 	mParent(nullptr),
 	mChildren(),
@@ -11,10 +24,18 @@ Entity::Entity(vec3 position, vec3 euler_angles, vec3 scale) :
 	mBakedWorldTransformDirty(true) 
 {}
 void Entity::bake_world_transform() const {
-	mat4 s = mat4::diag(mScale.x, mScale.y, mScale.z, 1);
-	mat4 r = mat3::rotate_xyz(mAngles.x, mAngles.y, mAngles.z).hmg();
-	mat4 t = mat4::translate_hmg(mPosition);
-	mat4 localTransform = t * r * s;
+	// This is translate * rotate * scale, written out directly since
+	// scaling only touches the rotation's columns
+	mat3 r = mOrientation.to_mat3();
+	vec3 r0 = r.row(0) * mScale;
+	vec3 r1 = r.row(1) * mScale;
+	vec3 r2 = r.row(2) * mScale;
+	mat4 localTransform = {
+		r0.x, r0.y, r0.z, mPosition.x,
+		r1.x, r1.y, r1.z, mPosition.y,
+		r2.x, r2.y, r2.z, mPosition.z,
+		0, 0, 0, 1
+	};
 	if (mParent) {
 		mBakedWorldTransform = mParent->world_transform() * localTransform;
 	}
@@ -87,7 +87,8 @@ void Terrain::generate(const Canvas &source)
         // canvas not ready, don't do anything else
         return;
     }
-    auto pixels = source.get_canvas();
+    // In [0, 1] whatever the canvas format, so R16 heightmaps keep their precision
+    auto heights = source.get_heights();
 
     std::vector<float> positions;
     std::vector<vec3> grassVertices;
@@ -98,11 +99,10 @@ void Terrain::generate(const Canvas &source)
     {
         for (int j = 0; j < width; j++)
         {
-            unsigned char *pixelOffset = (unsigned char *)pixels.data() + (j + width * i) * bytePerPixel;
-            unsigned char z = pixelOffset[0];
+            float z = 255.0f * heights[j + width * i];
             positions.push_back(-width / 2.0f + width * j / (float)width);
             positions.push_back(-height / 2.0f + height * i / (float)height);
-            positions.push_back((int)z * zScale - zShift);
+            positions.push_back(z * zScale - zShift);
         }
     }
 
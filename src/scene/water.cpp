@@ -62,16 +62,6 @@ void Water::draw(const RenderCtx& c) const {
 	glUniform1i(3, 0);
 	glUniform2iv(4, 1, c.viewportSize.data());
 	glUniform4fv(5, 1, c.cullPlane.data());
-	glActiveTexture(GL_TEXTURE1);
-	GLuint canvasTexture = mCanvas->get_canvas_texture();
-	// i am so sorry canvas
-	// this is all OpenGL's fault for not separating samplers from textures
-	// why would they do this, it's not even how the hardware works
-	glBindTexture(GL_TEXTURE_2D, canvasTexture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-	glUniform1i(6, 1);
-	ivec2 canvasSize = mCanvas->get_canvas_size();
-	glUniform2iv(7, 1, canvasSize.data());
 	glUniform3fv(8, 1, c.sunDir.data());
 	glUniform3fv(9, 1, c.viewPos.data());
 	glActiveTexture(GL_TEXTURE2);
@@ -84,10 +74,8 @@ void Water::draw(const RenderCtx& c) const {
 	glBindTexture(GL_TEXTURE_2D, mSeafoamTexture);
 	glUniform1i(12, 4);
 	glUniform3fv(13, 1, c.sunColor.data());
+	mCanvas->get_virtual_canvas().bind(14, 5);
 	glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
-
-	glBindTexture(GL_TEXTURE_2D, canvasTexture);
-	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
 	
 	glBindVertexArray(0);
 }
\ No newline at end of file
@@ -0,0 +1,106 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+
+#include "scratch_pool.h"
+
+static size_t bytes_per_texel(GLenum internalFormat) {
+	switch (internalFormat) {
+	case GL_R8: return 1;
+	case GL_R16: return 2;
+	case GL_R32F: return 4;
+	case GL_RGBA8: return 4;
+	case GL_RGBA16F: return 8;
+	case GL_RGBA32F: return 16;
+	default:
+		fprintf(stderr, "[error] unsupported scratch texture format 0x%x\n", internalFormat);
+		std::abort();
+	}
+}
+
+ScratchPool::ScratchPool() {
+	mBytes = 0;
+	mBytesInUse = 0;
+	mPeakBytes = 0;
+	mMaxSize = 0;
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &mMaxSize);
+}
+ScratchPool::~ScratchPool() noexcept {
+	// Tools may still be holding some of these, but they're torn down with the canvas anyway
+	for (Entry& entry : mEntries) {
+		assert(entry.texture);
+		glDeleteTextures(1, &entry.texture);
+	}
+}
+ScratchPool::Entry& ScratchPool::find(GLuint texture) {
+	for (Entry& entry : mEntries) {
+		if (entry.texture == texture) return entry;
+	}
+	fprintf(stderr, "[error] texture %u doesn't belong to the scratch pool\n", texture);
+	std::abort();
+}
+void ScratchPool::destroy(size_t index) {
+	Entry& entry = mEntries[index];
+	assert(!entry.inUse);
+	glDeleteTextures(1, &entry.texture);
+	mBytes -= entry.bytes;
+	mEntries.erase(mEntries.begin() + index);
+}
+GLuint ScratchPool::acquire(const Desc& desc, bool zeroed) {
+	assert(desc.size.x > 0 && desc.size.y > 0 && desc.levels > 0);
+	Entry* found = nullptr;
+	for (Entry& entry : mEntries) {
+		if (entry.inUse || entry.desc != desc) continue;
+		found = &entry;
+		// Prefer one we don't have to clear
+		if (!zeroed || entry.zeroed) break;
+	}
+	if (!found) {
+		size_t bytes = 0;
+		for (int level = 0; level < desc.levels; level++) {
+			ivec2 levelSize = math::vmax(ivec2(desc.size.x >> level, desc.size.y >> level), ivec2::splat(1));
+			bytes += size_t(levelSize.x) * size_t(levelSize.y) * bytes_per_texel(desc.internalFormat);
+		}
+		GLuint texture;
+		glGenTextures(1, &texture);
+		glBindTexture(GL_TEXTURE_2D, texture);
+		glTexStorage2D(GL_TEXTURE_2D, desc.levels, desc.internalFormat, desc.size.x, desc.size.y);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glBindTexture(GL_TEXTURE_2D, 0);
+		mEntries.push_back(Entry{ .texture = texture, .desc = desc, .bytes = bytes, .inUse = false, .zeroed = false, .released = {} });
+		found = &mEntries.back();
+		mBytes += bytes;
+		mPeakBytes = std::max(mPeakBytes, mBytes);
+	}
+	if (zeroed && !found->zeroed) {
+		// A null pointer clears to zero. RGBA so that alpha is zeroed too.
+		for (int level = 0; level < desc.levels; level++) {
+			glClearTexImage(found->texture, level, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		}
+	}
+	found->inUse = true;
+	found->zeroed = false;
+	mBytesInUse += found->bytes;
+	return found->texture;
+}
+void ScratchPool::release(GLuint texture, bool zeroed) {
+	Entry& entry = find(texture);
+	assert(entry.inUse);
+	entry.inUse = false;
+	entry.zeroed = zeroed;
+	entry.released = std::chrono::steady_clock::now();
+	mBytesInUse -= entry.bytes;
+}
+void ScratchPool::trim() {
+	auto cutoff = std::chrono::steady_clock::now() - IDLE_LIFETIME;
+	for (size_t i = mEntries.size(); i-- > 0;) {
+		if (!mEntries[i].inUse && mEntries[i].released < cutoff) destroy(i);
+	}
+}
+void ScratchPool::purge() {
+	for (size_t i = mEntries.size(); i-- > 0;) {
+		if (!mEntries[i].inUse) destroy(i);
+	}
+}
@@ -0,0 +1,77 @@
+#pragma once
+
+#include <chrono>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include "terrapainter/math.h"
+
+// Recycles the scratch textures tools need while a stroke is in progress
+// (stroke masks, splat buffers, blur tables...), so that only the active
+// tool's scratch space exists at any time. Tools acquire their textures when
+// a stroke starts and release them when it ends. Released textures are kept
+// around for a little while in case the next stroke wants the same thing,
+// then freed by trim().
+//
+// Textures are immutable (glTexStorage2D). Their sampling parameters are
+// whatever the last user left them as, so set the ones you care about.
+class ScratchPool {
+public:
+	struct Desc {
+		ivec2 size;
+		GLenum internalFormat;
+		int levels = 1;
+
+		bool operator==(const Desc&) const = default;
+	};
+	// How long a released texture is kept before trim() frees it
+	static constexpr auto IDLE_LIFETIME = std::chrono::seconds(5);
+private:
+	struct Entry {
+		GLuint texture;
+		Desc desc;
+		size_t bytes;
+		bool inUse;
+		// Whether every texel is known to be zero
+		bool zeroed;
+		std::chrono::steady_clock::time_point released;
+	};
+	std::vector<Entry> mEntries;
+	size_t mBytes;
+	size_t mBytesInUse;
+	size_t mPeakBytes;
+	// GL_MAX_TEXTURE_SIZE
+	int mMaxSize;
+
+	Entry& find(GLuint texture);
+	void destroy(size_t index);
+public:
+	ScratchPool();
+	~ScratchPool() noexcept;
+
+	ScratchPool(const ScratchPool&) = delete;
+	ScratchPool& operator=(const ScratchPool&) = delete;
+
+	// Returns a texture matching `desc`. If `zeroed` is set, every texel is
+	// zero, otherwise the contents are undefined.
+	GLuint acquire(const Desc& desc, bool zeroed);
+	// Hands `texture` back. Set `zeroed` if every texel is zero, which
+	// saves the next user who needs that from clearing it.
+	void release(GLuint texture, bool zeroed);
+	// Frees textures which have been idle for longer than IDLE_LIFETIME.
+	// Call once per frame.
+	void trim();
+	// Frees every idle texture, i.e. when the canvas is resized and
+	// nothing will fit anymore.
+	void purge();
+
+	// VRAM used by every texture in the pool, including idle ones
+	size_t memory_usage() const { return mBytes; }
+	// VRAM used by the textures tools are currently holding
+	size_t memory_in_use() const { return mBytesInUse; }
+	// The highest memory_usage() has ever been
+	size_t peak_memory_usage() const { return mPeakBytes; }
+	// The largest a texture can be along either axis
+	int max_size() const { return mMaxSize; }
+};
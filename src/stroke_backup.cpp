@@ -0,0 +1,107 @@
+#include <algorithm>
+#include <cassert>
+
+#include "stroke_backup.h"
+#include "scratch_pool.h"
+#include "canvas.h"
+#include "virtual_canvas.h"
+
+StrokeBackup::StrokeBackup(ScratchPool& pool) : mPool(pool) {
+	mCanvasSize = ivec2::zero();
+	mInternalFormat = canvas_format_info(CanvasFormat::RGBA8).internalFormat;
+	mTileCount = ivec2::zero();
+	mColumns = 0;
+	mAtlas = 0;
+	mAtlasRows = 0;
+}
+ivec2 StrokeBackup::tile_size(ivec2 origin) const {
+	return math::vmin(ivec2::splat(TILE_SIZE), mCanvasSize - origin);
+}
+ivec2 StrokeBackup::slot_origin(int slot) const {
+	return ivec2(slot % mColumns, slot / mColumns) * TILE_SIZE;
+}
+void StrokeBackup::reserve(int slots) {
+	int rows = (slots + mColumns - 1) / mColumns;
+	if (rows <= mAtlasRows) return;
+	// Doubling keeps the number of regrows (and pool sizes) small, but there's
+	// never a reason to have more slots than tiles
+	int maxRows = int((size_t(mTileCount.x) * size_t(mTileCount.y) + mColumns - 1) / mColumns);
+	int newRows = std::min(std::max(rows, 2 * mAtlasRows), maxRows);
+	ivec2 size = ivec2(mColumns, newRows) * TILE_SIZE;
+	GLuint atlas = mPool.acquire(ScratchPool::Desc{ .size = size, .internalFormat = mInternalFormat }, false);
+	if (mAtlas) {
+		// Slots are assigned row by row, so the old atlas maps onto the bottom of the new one
+		glCopyImageSubData(
+			mAtlas, GL_TEXTURE_2D, 0, 0, 0, 0,
+			atlas, GL_TEXTURE_2D, 0, 0, 0, 0,
+			mColumns * TILE_SIZE, mAtlasRows * TILE_SIZE, 1);
+		mPool.release(mAtlas, false);
+	}
+	mAtlas = atlas;
+	mAtlasRows = newRows;
+}
+bool StrokeBackup::fits(ivec2 canvasSize) const {
+	int maxTiles = mPool.max_size() / TILE_SIZE;
+	ivec2 tiles = (canvasSize + ivec2::splat(TILE_SIZE - 1)) / TILE_SIZE;
+	int columns = std::min(tiles.x, maxTiles);
+	if (columns == 0) return true;
+	size_t rows = (size_t(tiles.x) * size_t(tiles.y) + columns - 1) / columns;
+	return rows <= size_t(maxTiles);
+}
+void StrokeBackup::reset(ivec2 canvasSize, CanvasFormat format) {
+	clear();
+	mCanvasSize = canvasSize;
+	mInternalFormat = canvas_format_info(format).internalFormat;
+	mTileCount = (canvasSize + ivec2::splat(TILE_SIZE - 1)) / TILE_SIZE;
+	mColumns = std::min(mTileCount.x, mPool.max_size() / TILE_SIZE);
+	mSlots.assign(size_t(mTileCount.x) * size_t(mTileCount.y), -1);
+}
+void StrokeBackup::save(const VirtualCanvas& canvas, const CanvasRegion& region) {
+	CanvasRegion clamped = region.clamp(mCanvasSize);
+	if (clamped.is_empty()) return;
+	ivec2 firstTile = clamped.min / TILE_SIZE;
+	ivec2 lastTile = (clamped.max - ivec2::splat(1)) / TILE_SIZE;
+	// Compute shaders may have written to the canvas through image stores
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	for (int y = firstTile.y; y <= lastTile.y; y++) {
+		for (int x = firstTile.x; x <= lastTile.x; x++) {
+			int& slot = mSlots[size_t(y) * mTileCount.x + x];
+			if (slot >= 0) continue;
+			slot = int(mOrigins.size());
+			ivec2 origin = ivec2(x, y) * TILE_SIZE;
+			mOrigins.push_back(origin);
+			reserve(slot + 1);
+			ivec2 dst = slot_origin(slot);
+			ivec2 size = tile_size(origin);
+			auto location = canvas.locate(origin);
+			glCopyImageSubData(
+				canvas.atlas(), GL_TEXTURE_2D_ARRAY, 0, location.offset.x, location.offset.y, location.layer,
+				mAtlas, GL_TEXTURE_2D, 0, dst.x, dst.y, 0,
+				size.x, size.y, 1);
+		}
+	}
+}
+void StrokeBackup::restore(VirtualCanvas& canvas) {
+	if (mOrigins.empty()) return;
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	for (int slot = 0; slot < int(mOrigins.size()); slot++) {
+		ivec2 origin = mOrigins[slot];
+		ivec2 src = slot_origin(slot);
+		ivec2 size = tile_size(origin);
+		auto location = canvas.locate(origin);
+		glCopyImageSubData(
+			mAtlas, GL_TEXTURE_2D, 0, src.x, src.y, 0,
+			canvas.atlas(), GL_TEXTURE_2D_ARRAY, 0, location.offset.x, location.offset.y, location.layer,
+			size.x, size.y, 1);
+	}
+}
+void StrokeBackup::clear() {
+	for (ivec2 origin : mOrigins) {
+		ivec2 tile = origin / TILE_SIZE;
+		mSlots[size_t(tile.y) * mTileCount.x + tile.x] = -1;
+	}
+	mOrigins.clear();
+	if (mAtlas) mPool.release(mAtlas, false);
+	mAtlas = 0;
+	mAtlasRows = 0;
+}
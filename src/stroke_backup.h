@@ -0,0 +1,77 @@
+#pragma once
+
+#include <vector>
+
+#include <glad/gl.h>
+
+#include "terrapainter/math.h"
+
+#include "canvas_format.h"
+#include "history.h"
+
+struct CanvasRegion;
+class ScratchPool;
+class VirtualCanvas;
+
+// Pre-stroke copies of the canvas tiles the current stroke has touched.
+//
+// Strokes are composited straight into the canvas, rather than into
+// a second canvas-sized texture. Tools expect the canvas they read to stay
+// the same for the whole stroke, though, and the history needs the pre-stroke
+// tiles when the stroke is committed. So before a tile is first written, it's
+// copied into an atlas here, and restore() puts every copied tile back.
+//
+// The atlas is as wide as the canvas (or the largest texture, if that's
+// narrower) and grows a row of tiles at a time (well, doubling), so a stroke
+// which covers the entire canvas costs as much as the old second texture did,
+// and a typical stroke costs next to nothing.
+// It comes from the scratch pool, and is only held during a stroke.
+class StrokeBackup {
+public:
+	// Same tiles as the history, so both agree on what was touched
+	static constexpr int TILE_SIZE = CanvasHistory::TILE_SIZE;
+private:
+	ScratchPool& mPool;
+	// The dimensions & format of the canvas texture
+	ivec2 mCanvasSize;
+	GLenum mInternalFormat;
+	// The number of tiles along each axis
+	ivec2 mTileCount;
+	// The number of tiles along each row of the atlas
+	int mColumns;
+	// Atlas slot of each tile, or -1 if it hasn't been copied
+	std::vector<int> mSlots;
+	// Canvas origin of the tile in each slot
+	std::vector<ivec2> mOrigins;
+	// Zero when nothing has been copied. Its width is mColumns tiles.
+	GLuint mAtlas;
+	int mAtlasRows;
+
+	// Canvas pixels covered by the tile at `origin`, edge tiles are smaller
+	ivec2 tile_size(ivec2 origin) const;
+	// Bottom left corner of `slot` within the atlas
+	ivec2 slot_origin(int slot) const;
+	// Makes room for `slots` tiles in the atlas
+	void reserve(int slots);
+public:
+	explicit StrokeBackup(ScratchPool& pool);
+
+	StrokeBackup(const StrokeBackup&) = delete;
+	StrokeBackup& operator=(const StrokeBackup&) = delete;
+
+	// Whether the atlas can hold every tile of a canvas this big
+	bool fits(ivec2 canvasSize) const;
+	// Forgets everything and prepares for a canvas of the given size & format.
+	void reset(ivec2 canvasSize, CanvasFormat format);
+	// Copies the tiles of `canvas` overlapping `region` which haven't
+	// been copied yet. Call before anything can write to them, once
+	// they're resident.
+	void save(const VirtualCanvas& canvas, const CanvasRegion& region);
+	// Copies every saved tile back into `canvas`
+	void restore(VirtualCanvas& canvas);
+	// Ends the current stroke, handing the atlas back to the pool
+	void clear();
+
+	// Number of tiles currently saved
+	size_t tile_count() const { return mOrigins.size(); }
+};
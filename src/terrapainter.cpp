@@ -153,6 +153,9 @@ void terrapainter::run(SDL_Window *window)
             viewportSize = newViewportSize;
         }
 
+        // Saves finish in the background, even from the world
+        canvas.update_save();
+
         IApp *app = apps.at(size_t(appState));
         app->process_frame(deltaTime);
         app->render(viewportSize);
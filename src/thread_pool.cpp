@@ -0,0 +1,44 @@
+#include "terrapainter/thread_pool.h"
+
+#include <algorithm>
+
+ThreadPool::ThreadPool(size_t threads) {
+	if (threads == 0) threads = std::max(1u, std::thread::hardware_concurrency());
+	mStopping = false;
+	mThreads.reserve(threads);
+	for (size_t i = 0; i < threads; i++) {
+		mThreads.emplace_back([this] { work(); });
+	}
+}
+ThreadPool::~ThreadPool() noexcept {
+	{
+		std::lock_guard lock(mMutex);
+		mStopping = true;
+	}
+	mWake.notify_all();
+	for (auto& thread : mThreads) thread.join();
+}
+void ThreadPool::work() {
+	while (true) {
+		std::packaged_task<void()> job;
+		{
+			std::unique_lock lock(mMutex);
+			mWake.wait(lock, [this] { return mStopping || !mJobs.empty(); });
+			// Only stop once the queue has drained
+			if (mJobs.empty()) return;
+			job = std::move(mJobs.front());
+			mJobs.pop_front();
+		}
+		job();
+	}
+}
+std::future<void> ThreadPool::submit(std::function<void()> job) {
+	std::packaged_task<void()> task(std::move(job));
+	auto future = task.get_future();
+	{
+		std::lock_guard lock(mMutex);
+		mJobs.push_back(std::move(task));
+	}
+	mWake.notify_one();
+	return future;
+}
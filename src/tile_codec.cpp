@@ -0,0 +1,102 @@
+#include "terrapainter/tile_codec.h"
+
+#include <algorithm>
+#include <cassert>
+
+namespace tile_codec {
+	namespace {
+		// Control bytes below this are literal runs of (control + 1) bytes;
+		// at or above, the next byte repeats (control - REPEAT_BIAS) times.
+		constexpr uint8_t FIRST_REPEAT = 128;
+		constexpr size_t REPEAT_BIAS = FIRST_REPEAT - 3;
+		constexpr size_t MIN_REPEAT = 3;
+		constexpr size_t MAX_REPEAT = 255 - REPEAT_BIAS;
+		constexpr size_t MAX_LITERAL = FIRST_REPEAT;
+
+		void flush_literals(std::vector<uint8_t>& out, const uint8_t* begin, size_t count) {
+			while (count > 0) {
+				size_t chunk = std::min(count, MAX_LITERAL);
+				out.push_back(static_cast<uint8_t>(chunk - 1));
+				out.insert(out.end(), begin, begin + chunk);
+				begin += chunk;
+				count -= chunk;
+			}
+		}
+	}
+
+	std::vector<uint8_t> encode(std::span<const uint8_t> pixels, size_t width, size_t height, size_t channels) {
+		assert(pixels.size() == width * height * channels);
+		// Planar left-deltas
+		std::vector<uint8_t> deltas(pixels.size());
+		size_t plane = width * height;
+		for (size_t c = 0; c < channels; c++) {
+			for (size_t y = 0; y < height; y++) {
+				// The first pixel of a row is predicted from the one above it,
+				// so a flat tile becomes a single run instead of one per row
+				uint8_t prev = y > 0 ? pixels[(y - 1) * width * channels + c] : 0;
+				for (size_t x = 0; x < width; x++) {
+					uint8_t cur = pixels[(y * width + x) * channels + c];
+					deltas[c * plane + y * width + x] = cur - prev;
+					prev = cur;
+				}
+			}
+		}
+
+		std::vector<uint8_t> out;
+		out.reserve(deltas.size() / 4);
+		size_t literalStart = 0;
+		size_t i = 0;
+		while (i < deltas.size()) {
+			size_t run = 1;
+			while (i + run < deltas.size() && run < MAX_REPEAT && deltas[i + run] == deltas[i]) run++;
+			if (run >= MIN_REPEAT) {
+				flush_literals(out, &deltas[literalStart], i - literalStart);
+				out.push_back(static_cast<uint8_t>(run + REPEAT_BIAS));
+				out.push_back(deltas[i]);
+				i += run;
+				literalStart = i;
+			}
+			else {
+				i += run;
+			}
+		}
+		flush_literals(out, deltas.data() + literalStart, deltas.size() - literalStart);
+		return out;
+	}
+
+	bool decode(std::span<const uint8_t> encoded, std::span<uint8_t> pixels, size_t width, size_t height, size_t channels) {
+		if (pixels.size() != width * height * channels) return false;
+		std::vector<uint8_t> deltas(pixels.size());
+		size_t written = 0;
+		size_t i = 0;
+		while (i < encoded.size()) {
+			uint8_t control = encoded[i++];
+			if (control < FIRST_REPEAT) {
+				size_t count = size_t(control) + 1;
+				if (i + count > encoded.size() || written + count > deltas.size()) return false;
+				std::copy_n(&encoded[i], count, &deltas[written]);
+				i += count;
+				written += count;
+			}
+			else {
+				size_t count = size_t(control) - REPEAT_BIAS;
+				if (i >= encoded.size() || written + count > deltas.size()) return false;
+				std::fill_n(&deltas[written], count, encoded[i++]);
+				written += count;
+			}
+		}
+		if (written != deltas.size()) return false;
+
+		size_t plane = width * height;
+		for (size_t c = 0; c < channels; c++) {
+			for (size_t y = 0; y < height; y++) {
+				uint8_t prev = y > 0 ? pixels[(y - 1) * width * channels + c] : 0;
+				for (size_t x = 0; x < width; x++) {
+					prev += deltas[c * plane + y * width + x];
+					pixels[(y * width + x) * channels + c] = prev;
+				}
+			}
+		}
+		return true;
+	}
+}
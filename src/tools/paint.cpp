@@ -1,6 +1,7 @@
 #include <imgui/imgui.h>
 
 #include "canvas_tools.h"
+#include "stroke_raster.h"
 #include "../shadermgr.h"
 #include "../helpers.h"
 
@@ -17,32 +18,32 @@ class PaintTool : public virtual ICanvasTool {
 
 	bool mInStroke;
 	vec2 mLastBrushPos;
+	// Bounds everything the current stroke has touched, clamped to the canvas
+	CanvasRegion mStrokeRegion;
 
-	// One-channel "mask" storing the current stroke's shape
-	GLuint mStrokeTexture;
-	// Compute shader used for drawing the stroke into the texture
-	Program* mStrokeProgram;
+	// One-channel "mask" storing the current stroke's shape.
+	// Only held during a stroke, and only over the part it has touched.
+	ScratchRegion mStroke;
+	// Used for drawing the stroke into the texture
+	StrokeRasterizer mRasterizer;
 	// Compute shader using for compositing the stroke onto the canvas
 	Program* mCompositeProgram;
 	// Screenspace fragment shader used for drawing the stroke preview
 	Program* mPreviewProgram;
 
 public:
-	PaintTool() {
+	PaintTool() : mStroke(GL_R8, GL_LINEAR) {
 		// We have sensible defaults for these
 		mBrushColor = vec4::splat(1);
 		mBrushRadius = 20.0f;
 		mBrushHardness = 1.0f;
 		// We can't do anything about these until we receive canvas info
-		// We can still *make* the stroke texture, though...
 		mCanvasSize = ivec2::zero();
-		glGenTextures(1, &mStrokeTexture);
-		configure_texture(mStrokeTexture, GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_R8, GL_RED);
 		mInStroke = false;
 		mLastBrushPos = vec2::zero();
+		mStrokeRegion = CanvasRegion::empty();
 		// Since these go through the shader manager, we don't have to
 		// worry about resource cleanup...
-		mStrokeProgram = g_shaderMgr.compute("paint_stroke");
 		mCompositeProgram = g_shaderMgr.compute("paint_composite");
 		mPreviewProgram = g_shaderMgr.screenspace("paint_preview");
 	}
@@ -52,25 +53,18 @@ public:
 	PaintTool(const PaintTool&&) = delete;
 	PaintTool& operator= (const PaintTool&&) = delete;
 
-	~PaintTool() override {
-		assert(mStrokeTexture);
-		glDeleteTextures(1, &mStrokeTexture);
-	}
 	const char* name() const override {
 		return "Paint";
 	}
-	void clear_stroke(ivec2 canvasSize) override {
+	void attach(ScratchPool& pool, GpuScheduler& scheduler) override {
+		mStroke.attach(pool);
+	}
+	void clear_stroke(ivec2 canvasSize, CanvasFormat canvasFormat) override {
 		mInStroke = false;
 		assert(canvasSize.x > 0 && canvasSize.y > 0);
-		// We only re-create the texture if the canvas size changed,
-		// otherwise we just clear it...
-		if (mCanvasSize != canvasSize) {
-			glBindTexture(GL_TEXTURE_2D, mStrokeTexture);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, canvasSize.x, canvasSize.y, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
-			mCanvasSize = canvasSize;
-		}
-		const uint8_t zero = 0;
-		glClearTexImage(mStrokeTexture, 0, GL_RED, GL_UNSIGNED_BYTE, &zero);
+		mCanvasSize = canvasSize;
+		mStroke.release(mStrokeRegion);
+		mStrokeRegion = CanvasRegion::empty();
 	}
 	bool understands_param(SDL_Keycode keyCode) override {
 		return (keyCode == SDLK_f) || (keyCode == SDLK_h) || (keyCode == SDLK_a);
@@ -89,34 +83,47 @@ public:
 			mBrushColor.w = std::clamp(wanted, 0.0f, 1.0f);
 		}
 	}
-	void update_stroke(vec2 canvasMouse, bool modifier) override {
+	CanvasRegion update_stroke(const VirtualCanvas& canvas, std::span<const vec2> points, bool modifier) override {
+		if (points.empty()) return CanvasRegion::empty();
 		if (!mInStroke) {
 			mInStroke = true;
-			mLastBrushPos = canvasMouse;
+			mLastBrushPos = points.front();
 		}
-		CanvasRegion start(mLastBrushPos, mBrushRadius);
-		CanvasRegion end(canvasMouse, mBrushRadius);
-		CanvasRegion total = CanvasRegion::merge(start, end);
-		ivec2 size = total.max - total.min;
-		glUseProgram(mStrokeProgram->id());
-		glBindImageTexture(0, mStrokeTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R8);
-		glUniform2iv(1, 1, total.min.data());
-		glUniform2fv(2, 1, mLastBrushPos.data());
-		glUniform2fv(3, 1, canvasMouse.data());
-		glUniform2f(4, mBrushRadius, mBrushHardness);
-		glDispatchCompute((size.x + 15) / 16, (size.y + 15) / 16, 1);
-		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-		mLastBrushPos = canvasMouse;
+		CanvasRegion total = mRasterizer.rasterize(mStroke, mCanvasSize, mLastBrushPos, points, mBrushRadius, mBrushHardness);
+		mLastBrushPos = points.back();
+		mStrokeRegion = CanvasRegion::merge(mStrokeRegion, total);
+		return total;
 	}
-	void composite(GLuint dst, GLuint src) override {
+	bool set_proxy_scale(int scale) override {
+		// Strokes are drawn as an overlay and only composited once, so
+		// they're already cheap at any canvas size
+		return scale == 1;
+	}
+	CanvasRegion composite(VirtualCanvas& canvas, const CanvasRegion& clip) override {
+		CanvasRegion region = CanvasRegion::intersect(mStrokeRegion, clip);
+		if (region.is_empty()) return CanvasRegion::empty();
+		ivec2 size = region.size();
 		glUseProgram(mCompositeProgram->id());
 		// NOTE: layouts are hardcoded in the shader
-		glBindImageTexture(0, mStrokeTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R8);
-		glBindImageTexture(1, src, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
-		glBindImageTexture(2, dst, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
+		glBindImageTexture(0, mStroke.texture(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_R8);
+		canvas.bind_image(2, GL_WRITE_ONLY);
 		glUniform4fv(3, 1, mBrushColor.data());
-		glDispatchCompute( (mCanvasSize.x + 15) / 16, (mCanvasSize.y + 15) / 16, 1 );
+		glUniform2iv(4, 1, region.min.data());
+		canvas.bind(5, 0);
+		glUniform2iv(9, 1, mStroke.origin().data());
+		glDispatchCompute( (size.x + 15) / 16, (size.y + 15) / 16, 1 );
 		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		return region;
+	}
+	StrokeOverlay overlay() const override {
+		// Nothing to show until the stroke has actually started
+		if (!mStroke.texture()) return StrokeOverlay{};
+		return StrokeOverlay{
+			.mode = StrokeOverlay::Mode::MASK,
+			.texture = mStroke.texture(),
+			.origin = mStroke.origin(),
+			.color = mBrushColor,
+		};
 	}
 	void run_ui() override {
 		ImGui::DragFloat("Radius", &mBrushRadius, 1.0f, 1.0f, MAX_BRUSH_RADIUS, "%g");
@@ -0,0 +1,71 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+
+#include "scratch_region.h"
+
+ScratchRegion::ScratchRegion(GLenum internalFormat, GLenum filter) : mInternalFormat(internalFormat), mFilter(filter) {
+	mPool = nullptr;
+	mTexture = 0;
+	mRegion = CanvasRegion::empty();
+	mClipped = false;
+}
+CanvasRegion ScratchRegion::limit(CanvasRegion region, const CanvasRegion& keep, int maxSize) {
+	if (region.is_empty()) return region;
+	for (int axis = 0; axis < 2; axis++) {
+		if (region.max[axis] - region.min[axis] <= maxSize) continue;
+		// Slide the window as far down as it goes without losing the top of `keep`
+		int min = keep.is_empty() ? region.min[axis] : std::max(region.min[axis], keep.max[axis] - maxSize);
+		region.min[axis] = min;
+		region.max[axis] = min + maxSize;
+	}
+	return region;
+}
+void ScratchRegion::cover(const CanvasRegion& region, ivec2 canvasSize) {
+	CanvasRegion wanted = region.clamp(canvasSize);
+	if (wanted.is_empty() || mRegion.contains(wanted)) return;
+	assert(mPool);
+	CanvasRegion grown = CanvasRegion::merge(mRegion, wanted);
+	grown.min = grown.min / GRANULARITY * GRANULARITY;
+	grown.max = (grown.max + ivec2::splat(GRANULARITY - 1)) / GRANULARITY * GRANULARITY;
+	grown = limit(grown.clamp(canvasSize), mRegion, mPool->max_size());
+	if (!grown.contains(wanted) && !mClipped) {
+		fprintf(stderr, "[warning] stroke is too large for a scratch texture, clipping it\n");
+		mClipped = true;
+	}
+	if (mRegion.contains(grown)) return;
+
+	GLuint texture = mPool->acquire(ScratchPool::Desc{ .size = grown.size(), .internalFormat = mInternalFormat }, true);
+	glBindTexture(GL_TEXTURE_2D, texture);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, mFilter);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, mFilter);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	if (mTexture) {
+		// The old contents were written through image stores & framebuffers
+		glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+		ivec2 dst = mRegion.min - grown.min;
+		ivec2 size = mRegion.size();
+		glCopyImageSubData(
+			mTexture, GL_TEXTURE_2D, 0, 0, 0, 0,
+			texture, GL_TEXTURE_2D, 0, dst.x, dst.y, 0,
+			size.x, size.y, 1);
+		mPool->release(mTexture, false);
+	}
+	mTexture = texture;
+	mRegion = grown;
+}
+void ScratchRegion::release(const CanvasRegion& dirty) {
+	if (!mTexture) return;
+	// Everything else is already zero, so after this the whole texture is
+	CanvasRegion clear = CanvasRegion::intersect(dirty, mRegion);
+	if (!clear.is_empty()) {
+		ivec2 offset = clear.min - mRegion.min;
+		ivec2 size = clear.size();
+		// A null pointer clears to zero
+		glClearTexSubImage(mTexture, 0, offset.x, offset.y, 0, size.x, size.y, 1, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+	}
+	mPool->release(mTexture, true);
+	mTexture = 0;
+	mRegion = CanvasRegion::empty();
+	mClipped = false;
+}
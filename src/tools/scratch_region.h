@@ -0,0 +1,53 @@
+#pragma once
+
+#include <glad/gl.h>
+
+#include "../canvas.h"
+
+// A zeroed scratch texture (a stroke mask or splat buffer) which only covers
+// the part of the canvas the current stroke has reached, not all of it.
+// Texel (0, 0) is canvas pixel origin(), so shaders subtract that from
+// canvas coordinates.
+//
+// It grows along with the stroke: a bigger texture comes from the pool and the
+// old contents are copied into it. Growth is rounded out to GRANULARITY, so a
+// stroke only regrows it every so often and the pool sees the same few sizes.
+// A stroke wider than the largest possible texture is clipped.
+class ScratchRegion {
+public:
+	static constexpr int GRANULARITY = 256;
+private:
+	ScratchPool* mPool;
+	GLenum mInternalFormat;
+	// Min & mag filter, for whoever samples it
+	GLenum mFilter;
+	// Zero between strokes
+	GLuint mTexture;
+	// The canvas pixels the texture covers
+	CanvasRegion mRegion;
+	// Whether the current stroke has been clipped, so we only warn once
+	bool mClipped;
+public:
+	ScratchRegion(GLenum internalFormat, GLenum filter);
+
+	ScratchRegion(const ScratchRegion&) = delete;
+	ScratchRegion& operator=(const ScratchRegion&) = delete;
+
+	// Shrinks `region` to at most `maxSize` along each axis, while keeping as
+	// much of `keep` (which it contains) as will fit
+	static CanvasRegion limit(CanvasRegion region, const CanvasRegion& keep, int maxSize);
+
+	void attach(ScratchPool& pool) { mPool = &pool; }
+	// Grows the texture to cover `region` (clamped to the canvas), if it
+	// doesn't already, or as much of it as a texture can. Anything it didn't
+	// cover before is zero.
+	void cover(const CanvasRegion& region, ivec2 canvasSize);
+	// Zeroes `dirty`, which must bound everything written to the texture,
+	// and hands it back to the pool. Call when the stroke ends.
+	void release(const CanvasRegion& dirty);
+
+	// Zero until something has been covered
+	GLuint texture() const { return mTexture; }
+	const CanvasRegion& region() const { return mRegion; }
+	ivec2 origin() const { return mRegion.min; }
+};
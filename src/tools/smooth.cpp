@@ -1,79 +1,297 @@
 #include <imgui/imgui.h>
 
 #include "canvas_tools.h"
+#include "stroke_raster.h"
 #include "../shadermgr.h"
 #include "../helpers.h"
 
 constexpr float MAX_BRUSH_RADIUS = 256.0f;
+// Extra distance the integral image is built around the stroke's reach,
+// so that it doesn't need to be rebuilt every time the stroke grows a little
+constexpr int INTEGRAL_MARGIN = 128;
+// The integral image is rebuilt by a scheduler job, in steps of about this
+// many texels per unit of work
+constexpr size_t INTEGRAL_UNIT_TEXELS = 64 * 64;
+// Number of levels in the pyramid blur's mip chain. The coarsest level's texels
+// are 512px wide, which is enough for a 256px blur radius.
+constexpr int PYRAMID_LEVELS = 10;
 class SmoothTool : public virtual ICanvasTool {
 	// The dimensions of the current canvas.
 	ivec2 mCanvasSize;
 	bool mInStroke;
-	bool mDirtyIntegralTexture;
 
 	float mBrushRadius;
 	float mBrushHardness;
 	vec2 mLastBrushPos;
 	int mBlurRadius;
+	// See set_proxy_scale. The radii above are in real canvas pixels.
+	int mProxyScale;
+	enum class BlurMode {
+		// Exact box blur from a summed-area table
+		SAT = 0,
+		// Approximate blur from a mip pyramid, cheaper to build & store
+		PYRAMID = 1,
+	};
+	// Can't change mid-stroke, see run_ui
+	BlurMode mBlurMode;
+	// Bounds everything the current stroke has touched, clamped to the canvas
+	CanvasRegion mStrokeRegion;
 
 	// the idea for the integral texture is from
 	// https://stackoverflow.com/questions/22436502/how-to-implement-the-gradient-gaussian-blur
-	GLuint mIntegralXTexture; // <-- this is an intermediate texture used for integrating along X dimension...
-	GLuint mIntegralXYTexture; // <-- which then gets integrated again, but in the Y direction, to give this
-	GLuint mStrokeTexture;
+	// All of these textures come from mPool, and are only held during a stroke.
+	ScratchPool* mPool;
+	GpuScheduler* mScheduler;
+	// This is a single channel (R32F) summed-area table of mIntegralRegion,
+	// one texel larger than it on each axis so it can hold the totals.
+	// Zero until the first one has been built.
+	GLuint mIntegralTexture;
+	// The region of the canvas mIntegralTexture covers, its texel (0, 0) is
+	// the region's corner. Empty if the canvas may have changed since it was built.
+	CanvasRegion mIntegralRegion;
+	// When the stroke outgrows mIntegralRegion, a bigger table is built into
+	// mIntegralBuild by a scheduler job, a band of rows (and then columns) at
+	// a time. Meanwhile only the part of the stroke the old table covers
+	// is composited. mIntegralJob is zero when there's no build going on.
+	GpuScheduler::JobId mIntegralJob;
+	GLuint mIntegralBuild;
+	CanvasRegion mIntegralBuildRegion;
+	// How many rows, then columns, of the build have been scanned
+	int mIntegralBuildRows;
+	int mIntegralBuildCols;
+	// Mip chain of the canvas's red channel used by BlurMode::PYRAMID.
+	// R16, so that it doesn't throw away the precision of R16 canvases.
+	GLuint mPyramidTexture;
+	// Like mIntegralRegion, in base level texels. The pyramid is exactly
+	// this big, so it's replaced whenever the stroke outgrows it.
+	CanvasRegion mPyramidRegion;
+	// The stroke mask, see ScratchRegion
+	ScratchRegion mStroke;
+
+	// GL_TIME_ELAPSED query around the last composite, read back
+	// once it's available so we never stall waiting for it
+	GLuint mTimerQuery;
+	bool mTimerPending;
+	float mCompositeMs;
 
 	Program* mCompositeProgram;
-	Program* mStrokeProgram;
 	Program* mPreviewProgram;
-	// Compute shader input images must have a definite type (i.e. rgba8, rgba32f)
-	// This means I had to choose one of the following:
-	//	1. Make canvas texture RGBA32F
-	//	2. Copy canvas texture into RGBA32F texture and implement logic for switching axis at runtime
-	//	3. Make seperate X and XY shaders
-	// I chose number 3.
-	Program* mIntegralXProgram;
-	Program* mIntegralXYProgram;
-
-	void generate_integral_texture(GLuint src) {
-		glUseProgram(mIntegralXProgram->id());
-		glBindImageTexture(0, src, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
-		glBindImageTexture(1, mIntegralXTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
-		glUniform1i(2, mCanvasSize.y);
-		glDispatchCompute((mCanvasSize.x + 255) / 256, 1, 1);
-		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-
-		glUseProgram(mIntegralXYProgram->id());
-		glBindImageTexture(0, mIntegralXTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA32F);
-		glBindImageTexture(1, mIntegralXYTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA32F);
-		glUniform1i(2, mCanvasSize.x);
-		glDispatchCompute(1, (mCanvasSize.y + 255) / 256, 1);
+	StrokeRasterizer mRasterizer;
+	// The row pass reads the canvas through a sampler (so it works with any
+	// CanvasFormat) and the column pass reads the row sums in place as an
+	// r32f image, so they're separate shaders.
+	Program* mScanRowsProgram;
+	Program* mScanColsProgram;
+	Program* mPyramidFillProgram;
+	Program* mPyramidDownsampleProgram;
+
+	// The textures are all taken from the pool as the stroke reaches further,
+	// and only cover what it has reached. Nothing is held between strokes.
+	void begin_stroke() {
+		mIntegralRegion = CanvasRegion::empty();
+		mPyramidRegion = CanvasRegion::empty();
+	}
+	void release_textures() {
+		mStroke.release(mStrokeRegion);
+		if (mIntegralJob) {
+			mScheduler->cancel(mIntegralJob);
+			mIntegralJob = 0;
+			mPool->release(mIntegralBuild, false);
+			mIntegralBuild = 0;
+		}
+		if (mIntegralTexture) mPool->release(mIntegralTexture, false);
+		mIntegralTexture = 0;
+		if (mPyramidTexture) mPool->release(mPyramidTexture, false);
+		mPyramidTexture = 0;
+	}
+
+	// The radii in the pixels of the canvas strokes are actually made on
+	float stroke_brush_radius() const {
+		return mBrushRadius / float(mProxyScale);
+	}
+	int stroke_blur_radius() const {
+		return std::max(1, (mBlurRadius + mProxyScale / 2) / mProxyScale);
+	}
+
+	// Everything the current stroke can sample from the integral image,
+	// which is the stroke region plus the blur radius. The table is a texel
+	// larger than this, so past the largest texture, the rest of the stroke
+	// is left alone.
+	CanvasRegion integral_reach() const {
+		CanvasRegion reach = mStrokeRegion.grow(stroke_blur_radius() + 1).clamp(mCanvasSize);
+		return ScratchRegion::limit(reach, mStrokeRegion, mPool->max_size() - 1);
+	}
+	// The part of the canvas which can be composited with mIntegralTexture,
+	// i.e. where the reach of every texel is within mIntegralRegion
+	CanvasRegion integral_coverage() const {
+		if (mIntegralRegion.is_empty()) return mIntegralRegion;
+		int reach = stroke_blur_radius() + 1;
+		CanvasRegion coverage = mIntegralRegion;
+		// The reach is clamped to the canvas, so the edges don't shrink
+		if (coverage.min.x > 0) coverage.min.x += reach;
+		if (coverage.min.y > 0) coverage.min.y += reach;
+		if (coverage.max.x < mCanvasSize.x) coverage.max.x -= reach;
+		if (coverage.max.y < mCanvasSize.y) coverage.max.y -= reach;
+		return coverage;
+	}
+	// Starts a build of a bigger integral image, if the stroke has outgrown
+	// the current one and there isn't one on the way already. The build
+	// reads `canvas` when its job runs, not now.
+	void update_integral_texture(const VirtualCanvas& canvas) {
+		if (mIntegralJob || mIntegralRegion.contains(integral_reach())) return;
+		start_integral_build();
+		mIntegralJob = mScheduler->submit("smooth: summed-area table", [this, &canvas](size_t units) {
+			return step_integral_build(canvas, units);
+		});
+	}
+	void start_integral_build() {
+		// The table's origin is the region's corner, so growing it means
+		// rebuilding all of it. Overshoot to make that rare.
+		CanvasRegion reach = integral_reach();
+		CanvasRegion region = CanvasRegion::merge(mIntegralRegion, reach)
+			.grow(INTEGRAL_MARGIN)
+			.clamp(mCanvasSize);
+		mIntegralBuildRegion = ScratchRegion::limit(region, reach, mPool->max_size() - 1);
+		mIntegralBuildRows = 0;
+		mIntegralBuildCols = 0;
+		mIntegralBuild = mPool->acquire(ScratchPool::Desc{ .size = mIntegralBuildRegion.size() + ivec2::splat(1), .internalFormat = GL_R32F }, false);
+		glBindTexture(GL_TEXTURE_2D, mIntegralBuild);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	}
+	// The integral image job. Rows are independent of each other, and so are
+	// columns once every row is done, so either pass can stop at any row/column.
+	GpuScheduler::Progress step_integral_build(const VirtualCanvas& canvas, size_t units) {
+		CanvasRegion& region = mIntegralBuildRegion;
+		ivec2 size = region.size();
+		size_t done = 0;
+		if (mIntegralBuildRows < size.y) {
+			// Each row is u_size.x + 1 entries long
+			size_t rowUnits = std::max<size_t>(1, (size_t(size.x) + 1) / INTEGRAL_UNIT_TEXELS);
+			int rows = int(std::min<size_t>(size.y - mIntegralBuildRows, std::max<size_t>(1, units / rowUnits)));
+			glUseProgram(mScanRowsProgram->id());
+			glBindImageTexture(1, mIntegralBuild, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+			glUniform2iv(2, 1, region.min.data());
+			glUniform2iv(3, 1, size.data());
+			canvas.bind(4, 0);
+			glUniform1i(8, mIntegralBuildRows);
+			glDispatchCompute(rows, 1, 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+			mIntegralBuildRows += rows;
+			done = size_t(rows) * rowUnits;
+		}
+		else {
+			size_t colUnits = std::max<size_t>(1, (size_t(size.y) + 1) / INTEGRAL_UNIT_TEXELS);
+			int cols = int(std::min<size_t>(size.x + 1 - mIntegralBuildCols, std::max<size_t>(1, units / colUnits)));
+			glUseProgram(mScanColsProgram->id());
+			glBindImageTexture(0, mIntegralBuild, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R32F);
+			glUniform2iv(3, 1, size.data());
+			glUniform1i(4, mIntegralBuildCols);
+			glDispatchCompute(cols, 1, 1);
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+			mIntegralBuildCols += cols;
+			done = size_t(cols) * colUnits;
+		}
+		glUseProgram(0);
+		if (mIntegralBuildCols <= size.x) return { done, false };
+
+		if (mIntegralTexture) mPool->release(mIntegralTexture, false);
+		mIntegralTexture = mIntegralBuild;
+		mIntegralRegion = region;
+		mIntegralBuild = 0;
+		// The stroke may have grown since this build started. Carrying on
+		// (rather than queueing another job) keeps it ahead of anything
+		// that was submitted after it.
+		if (!mIntegralRegion.contains(integral_reach())) {
+			start_integral_build();
+			return { done, false };
+		}
+		mIntegralJob = 0;
+		return { done, true };
+	}
+	// Same idea as update_integral_texture, for the mip pyramid
+	void update_pyramid_texture(const VirtualCanvas& canvas) {
+		// Taps sit half a radius from the center, and the coarser of the two
+		// levels they blend between has texels twice the radius wide.
+		// Align to the coarsest level's texels, so every texel we rebuild
+		// is only made of other texels we rebuilt
+		static constexpr int BLOCK = 1 << (PYRAMID_LEVELS - 1);
+		auto align = [this](CanvasRegion region) {
+			region.min = (region.min / BLOCK) * BLOCK;
+			region.max = ((region.max + ivec2::splat(BLOCK - 1)) / BLOCK) * BLOCK;
+			return region.clamp(mCanvasSize);
+		};
+		// Like integral_reach, leaving room for the alignment
+		int maxSize = mPool->max_size();
+		CanvasRegion reach = mStrokeRegion.grow(4 * stroke_blur_radius() + 2).clamp(mCanvasSize);
+		reach = ScratchRegion::limit(reach, mStrokeRegion, maxSize - 2 * BLOCK);
+		if (mPyramidRegion.contains(reach)) return;
+		CanvasRegion region = align(CanvasRegion::merge(mPyramidRegion, reach).grow(INTEGRAL_MARGIN));
+		// No room for the old region & the margin
+		if (region.size().x > maxSize || region.size().y > maxSize) region = align(reach);
+		ivec2 size = region.size();
+
+		// It's rebuilt from scratch anyway, so a fresh texture costs nothing extra
+		if (mPyramidTexture) mPool->release(mPyramidTexture, false);
+		// Small regions can't have all PYRAMID_LEVELS
+		int levels = std::min(PYRAMID_LEVELS, int(std::log2(std::max(size.x, size.y))) + 1);
+		mPyramidTexture = mPool->acquire(ScratchPool::Desc{ .size = size, .internalFormat = GL_R16, .levels = levels }, false);
+		glBindTexture(GL_TEXTURE_2D, mPyramidTexture);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+		glUseProgram(mPyramidFillProgram->id());
+		glBindImageTexture(1, mPyramidTexture, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_R16);
+		glUniform2iv(2, 1, region.min.data());
+		canvas.bind(3, 0);
+		glDispatchCompute((size.x + 15) / 16, (size.y + 15) / 16, 1);
+
+		glUseProgram(mPyramidDownsampleProgram->id());
+		for (int level = 1; level < levels; level++) {
+			glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+			ivec2 levelSize = math::vmax(size / (1 << level), ivec2::splat(1));
+			glBindImageTexture(0, mPyramidTexture, level - 1, GL_FALSE, 0, GL_READ_ONLY, GL_R16);
+			glBindImageTexture(1, mPyramidTexture, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R16);
+			glDispatchCompute((levelSize.x + 15) / 16, (levelSize.y + 15) / 16, 1);
+		}
 		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
 
-		mDirtyIntegralTexture = false;
+		mPyramidRegion = region;
 	}
 public:
-	SmoothTool() {
+	SmoothTool() : mStroke(GL_R8, GL_NEAREST) {
 		// punt on appropriate canvas size until clear_stroke is called
 		mCanvasSize = ivec2::zero();
 		mInStroke = false;
-		mDirtyIntegralTexture = false;
+		mIntegralRegion = CanvasRegion::empty();
 
 		mBrushRadius = 20.0f;
 		mBrushHardness = 1.0f;
 		mLastBrushPos = vec2::zero();
 		mBlurRadius = 16;
-		glGenTextures(1, &mIntegralXTexture);
-		configure_texture(mIntegralXTexture, GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_RGBA32F, GL_RGBA, GL_FLOAT);
-		glGenTextures(1, &mIntegralXYTexture);
-		configure_texture(mIntegralXYTexture, GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_RGBA32F, GL_RGBA, GL_FLOAT);
-		glGenTextures(1, &mStrokeTexture);
-		configure_texture(mStrokeTexture, GL_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_R8, GL_RED);
+		mProxyScale = 1;
+		mBlurMode = BlurMode::SAT;
+		mStrokeRegion = CanvasRegion::empty();
+		mPool = nullptr;
+		mScheduler = nullptr;
+		mIntegralTexture = 0;
+		mIntegralJob = 0;
+		mIntegralBuild = 0;
+		mIntegralBuildRegion = CanvasRegion::empty();
+		mIntegralBuildRows = 0;
+		mIntegralBuildCols = 0;
+		mPyramidTexture = 0;
+		mPyramidRegion = CanvasRegion::empty();
+		glGenQueries(1, &mTimerQuery);
+		mTimerPending = false;
+		mCompositeMs = 0.0f;
 
 		mCompositeProgram = g_shaderMgr.compute("smooth_composite");
-		mStrokeProgram = g_shaderMgr.compute("paint_stroke");
 		mPreviewProgram = g_shaderMgr.screenspace("paint_preview");
-		mIntegralXProgram = g_shaderMgr.compute("smooth_integrate_x");
-		mIntegralXYProgram = g_shaderMgr.compute("smooth_integrate_xy");
+		mScanRowsProgram = g_shaderMgr.compute("smooth_sat_rows");
+		mScanColsProgram = g_shaderMgr.compute("smooth_sat_cols");
+		mPyramidFillProgram = g_shaderMgr.compute("smooth_pyramid_fill");
+		mPyramidDownsampleProgram = g_shaderMgr.compute("smooth_pyramid_downsample");
 	}
 
 	SmoothTool(const SmoothTool&) = delete;
@@ -82,34 +300,26 @@ public:
 	SmoothTool& operator= (const SmoothTool&&) = delete;
 
 	~SmoothTool() override {
-		assert(mIntegralXTexture);
-		glDeleteTextures(1, &mIntegralXTexture);
-		assert(mIntegralXYTexture);
-		glDeleteTextures(1, &mIntegralXYTexture);
-		assert(mStrokeTexture);
-		glDeleteTextures(1, &mStrokeTexture);
+		assert(mTimerQuery);
+		glDeleteQueries(1, &mTimerQuery);
 	}
 	const char* name() const override {
 		return "Smooth";
 	}
-	void clear_stroke(ivec2 canvasSize) override {
+	void attach(ScratchPool& pool, GpuScheduler& scheduler) override {
+		mPool = &pool;
+		mScheduler = &scheduler;
+		mStroke.attach(pool);
+	}
+	void clear_stroke(ivec2 canvasSize, CanvasFormat canvasFormat) override {
 		mInStroke = false;
-		mDirtyIntegralTexture = true;
+		// The canvas is about to change
+		mIntegralRegion = CanvasRegion::empty();
+		mPyramidRegion = CanvasRegion::empty();
 		assert(canvasSize.x > 0 && canvasSize.y > 0);
-		// We only re-create the texture if the canvas size changed,
-		// otherwise we just clear it...
-		if (mCanvasSize != canvasSize) {
-			glBindTexture(GL_TEXTURE_2D, mIntegralXTexture);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, canvasSize.x, canvasSize.y, 0, GL_RGBA, GL_FLOAT, nullptr);
-			glBindTexture(GL_TEXTURE_2D, mIntegralXYTexture);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA32F, canvasSize.x, canvasSize.y, 0, GL_RGBA, GL_FLOAT, nullptr);
-			glBindTexture(GL_TEXTURE_2D, mStrokeTexture);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_R8, canvasSize.x, canvasSize.y, 0, GL_RED, GL_UNSIGNED_BYTE, nullptr);
-			mCanvasSize = canvasSize;
-		}
-		// don't bother clearing the integral texture, we'll populate it as soon as we enter stroke
-		const uint8_t zero = 0;
-		glClearTexImage(mStrokeTexture, 0, GL_RED, GL_UNSIGNED_BYTE, &zero);
+		mCanvasSize = canvasSize;
+		release_textures();
+		mStrokeRegion = CanvasRegion::empty();
 	}
 	bool understands_param(SDL_Keycode keyCode) override {
 		return (keyCode == SDLK_f) || (keyCode == SDLK_h);
@@ -124,48 +334,99 @@ public:
 			mBrushHardness = std::clamp(wanted, 0.f, 4.f);
 		}
 	}
-	void update_stroke(vec2 canvasMouse, bool modifier) override {
+	CanvasRegion update_stroke(const VirtualCanvas& canvas, std::span<const vec2> points, bool modifier) override {
 		// This is copied DIRECTLY from paint.cpp
+		if (points.empty()) return CanvasRegion::empty();
 		if (!mInStroke) {
 			mInStroke = true;
-			mLastBrushPos = canvasMouse;
+			mLastBrushPos = points.front();
+			begin_stroke();
 		}
-		CanvasRegion start(mLastBrushPos, mBrushRadius);
-		CanvasRegion end(canvasMouse, mBrushRadius);
-		CanvasRegion total = CanvasRegion::merge(start, end);
-		ivec2 size = total.max - total.min;
-		glUseProgram(mStrokeProgram->id());
-		glBindImageTexture(0, mStrokeTexture, 0, GL_FALSE, 0, GL_READ_WRITE, GL_R8);
-		glUniform2iv(1, 1, total.min.data());
-		glUniform2fv(2, 1, mLastBrushPos.data());
-		glUniform2fv(3, 1, canvasMouse.data());
-		glUniform2f(4, mBrushRadius, mBrushHardness);
-		glDispatchCompute((size.x + 15) / 16, (size.y + 15) / 16, 1);
-		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
-		mLastBrushPos = canvasMouse;
-	}
-	void composite(GLuint dst, GLuint src) override {
-		// This relies on the fact that src is constant throughout a stroke
-		// I never documented this anywhere because I don't want to make this guarantee
-		// and if we had more time I would refactor the tool interface
-		// but for right now, hacks it is!
-		if (mDirtyIntegralTexture) generate_integral_texture(src);
+		CanvasRegion total = mRasterizer.rasterize(mStroke, mCanvasSize, mLastBrushPos, points, stroke_brush_radius(), mBrushHardness);
+		mLastBrushPos = points.back();
+		mStrokeRegion = CanvasRegion::merge(mStrokeRegion, total);
+		if (mBlurMode == BlurMode::SAT) update_integral_texture(canvas);
+		return total;
+	}
+	bool set_proxy_scale(int scale) override {
+		assert(scale >= 1 && !mInStroke);
+		// Every composite covers the whole stroke, which is what gets slow
+		mProxyScale = scale;
+		return true;
+	}
+	CanvasRegion composite(VirtualCanvas& canvas, const CanvasRegion& clip) override {
+		// This relies on the fact that src is constant throughout a stroke,
+		// the integral image & pyramid are only rebuilt as the stroke grows.
+		// The canvas guarantees this, see StrokeBackup. They're always built
+		// for the whole stroke, so later pieces of it don't rebuild them.
+		CanvasRegion region = CanvasRegion::intersect(mStrokeRegion, clip);
+		// While a bigger integral image is being built, only preview what the
+		// current one can. The final composite comes after the build finishes.
+		if (mBlurMode == BlurMode::SAT) region = CanvasRegion::intersect(region, integral_coverage());
+		if (region.is_empty()) return CanvasRegion::empty();
+		if (mTimerPending) {
+			GLint available = GL_FALSE;
+			glGetQueryObjectiv(mTimerQuery, GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available) {
+				GLuint64 ns = 0;
+				glGetQueryObjectui64v(mTimerQuery, GL_QUERY_RESULT, &ns);
+				mCompositeMs = float(ns) / 1e6f;
+				mTimerPending = false;
+			}
+		}
+		bool timed = !mTimerPending;
+		if (timed) glBeginQuery(GL_TIME_ELAPSED, mTimerQuery);
+
+		if (mBlurMode == BlurMode::PYRAMID) update_pyramid_texture(canvas);
+		ivec2 size = region.size();
 		glUseProgram(mCompositeProgram->id());
-		glBindImageTexture(0, mStrokeTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_R8);
+		glBindImageTexture(0, mStroke.texture(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_R8);
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, mIntegralXYTexture);
+		glBindTexture(GL_TEXTURE_2D, mIntegralTexture);
 		glUniform1i(1, 0);
-		glBindImageTexture(2, src, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
-		glBindImageTexture(3, dst, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
-		glUniform1i(4, mBlurRadius);
-		glDispatchCompute((mCanvasSize.x + 15) / 16, (mCanvasSize.y + 15) / 16, 1);
+		glActiveTexture(GL_TEXTURE1);
+		glBindTexture(GL_TEXTURE_2D, mPyramidTexture);
+		glUniform1i(6, 1);
+		glActiveTexture(GL_TEXTURE0);
+		canvas.bind_image(3, GL_WRITE_ONLY);
+		glUniform1i(4, stroke_blur_radius());
+		glUniform2iv(5, 1, region.min.data());
+		glUniform1i(7, int(mBlurMode));
+		canvas.bind(8, 2);
+		glUniform2iv(12, 1, mStroke.origin().data());
+		glUniform2iv(13, 1, mIntegralRegion.min.data());
+		glUniform2iv(14, 1, mPyramidRegion.min.data());
+		glDispatchCompute((size.x + 15) / 16, (size.y + 15) / 16, 1);
 		glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+
+		if (timed) {
+			glEndQuery(GL_TIME_ELAPSED);
+			mTimerPending = true;
+		}
+		return region;
+	}
+	StrokeOverlay overlay() const override {
+		// The blur needs the integral image/pyramid, which isn't a simple blend
+		return StrokeOverlay{};
 	}
 	void run_ui() override {
 		ImGui::DragFloat("Brush Radius", &mBrushRadius, 1.0f, 1.0f, MAX_BRUSH_RADIUS, "%g");
 		ImGui::DragFloat("Brush Hardness", &mBrushHardness, 0.1f, 0.0f, 4.0f, "%.2f");
 		ImGui::DragInt("Smooth Size", &mBlurRadius, 1.0f, 1, MAX_BRUSH_RADIUS, "%ipx");
 		if (mBlurRadius < 1) mBlurRadius = 1;
+		int mode = int(mBlurMode);
+		bool changed = ImGui::RadioButton("Exact", &mode, int(BlurMode::SAT));
+		ImGui::SameLine();
+		changed |= ImGui::RadioButton("Fast", &mode, int(BlurMode::PYRAMID));
+		// Switching mid-stroke would invalidate the textures we're compositing with
+		if (changed && !mInStroke) {
+			mBlurMode = BlurMode(mode);
+		}
+		if (ImGui::IsItemHovered()) {
+			ImGui::SetTooltip("Exact: box blur from a summed-area table (4 bytes/pixel)\n"
+				"Fast: approximate blur from a mip pyramid (~1.3 bytes/pixel)");
+		}
+		ImGui::Text("Composite: %.2fms (GPU)", mCompositeMs);
 	}
 	void preview(ivec2 screenSize, ivec2 screenMouse, float canvasScale) override {
 		// Again, copied wholesale from paint.cpp, except we have no stroke color...
@@ -4,19 +4,36 @@
 #include <SDL.h>
 
 #include "canvas_tools.h"
+#include "scratch_region.h"
 #include "../shadermgr.h"
 #include "../helpers.h"
 
 // This is a kind of a misnomer. The user can override this.
 // This is really just the max for the UI widget.
 constexpr float MAX_BRUSH_RADIUS = 256.0f;
+// Every brush is resampled to this size to fit in the texture array.
+// The original aspect ratio is kept around separately.
+constexpr GLsizei BRUSH_LAYER_SIZE = 512;
+// The size of the brush thumbnails shown in the UI
+constexpr GLsizei BRUSH_THUMBNAIL_SIZE = 64;
 class SplatterTool : public virtual ICanvasTool {
 	// The dimensions of the current canvas.
 	ivec2 mCanvasSize;
-	GLuint mBufferTexture;
+	// Straight-alpha RGBA8 splats of the current stroke.
+	// Only held during a stroke, and only over the part it has touched.
+	ScratchRegion mBuffer;
 
-	GLuint mSplatTexture; // TODO: making this an array of textures would be cool
-	ivec2 mSplatSize;
+	struct Brush {
+		// The dimensions of the image this was loaded from
+		ivec2 size;
+		GLuint thumbnail;
+	};
+	// One mipmapped RGBA8 layer per brush, zero if there aren't any
+	GLuint mBrushArray;
+	std::vector<Brush> mBrushes;
+	int mSelectedBrush;
+	// Pick a random brush for each splat instead of the selected one
+	bool mRandomBrush;
 	vec4 mSplatTint;
 	float mSplatScale;
 	float mSplatScaleRnd; // random offset to radius - always positive?
@@ -27,25 +44,116 @@ class SplatterTool : public virtual ICanvasTool {
 	uint64_t mLastTime;
 
 	bool mInStroke;
+	// Bounds everything the current stroke has touched, clamped to the canvas
+	CanvasRegion mStrokeRegion;
 
-	GLuint mQuadVAO;
+	// Matches the per-instance attributes of splat.vert
+	struct SplatInstance {
+		// Columns of the 2x2 rotation & scale
+		vec4 basis;
+		// XY: translation, Z: brush layer
+		vec4 offset;
+		vec4 tint;
+	};
+	// A splat emitted by update_stroke, in canvas pixels. They're only queued
+	// once the buffer has grown to fit them all, since that moves its origin.
+	struct PendingSplat {
+		vec2 pos;
+		float rot;
+		vec2 size;
+		int brush;
+	};
+	std::vector<PendingSplat> mPending;
+	// Splats queued up by queue_splat, drawn by draw_splats
+	std::vector<SplatInstance> mInstances;
+	GLuint mInstanceVBO;
+	size_t mInstanceCapacity;
+
+	GLuint mQuadVAO; // also has the per-instance attributes
 	GLuint mQuadVBO;
 
 	Program* mCompositeProgram;
 	Program* mRenderProgram; // used for rendering splats into buffer & rendering preview
+	Program* mResampleProgram; // used for resampling brushes into the array
 	GLuint mFramebuffer; // used for rendering to the buffer
 
+	// Draws `source` over the whole of whatever is bound to mFramebuffer
+	void resample(GLuint source, GLsizei size) {
+		glViewport(0, 0, size, size);
+		glBindVertexArray(mQuadVAO);
+		glUseProgram(mResampleProgram->id());
+		mat3 identity = mat3::ident();
+		glUniformMatrix3fv(0, 1, GL_TRUE, identity.data());
+		glActiveTexture(GL_TEXTURE0);
+		glBindTexture(GL_TEXTURE_2D, source);
+		glUniform1i(1, 0);
+		glUniform4f(2, 1.0f, 1.0f, 1.0f, 1.0f);
+		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		glUseProgram(0);
+		glBindVertexArray(0);
+	}
 	// pixels: rgba8
-	void set_stroke_texture(ivec2 size, uint8_t* pixels) {
+	void add_brush(ivec2 size, uint8_t* pixels) {
 		assert(size.x > 0 && size.y > 0);
 		// we don't really need this assert idk
 		assert(size.x <= MAX_CANVAS_AXIS && size.y <= MAX_CANVAS_AXIS);
-		glBindTexture(GL_TEXTURE_2D, mSplatTexture);
+		// Mipmapped so that shrinking big images down to the layer size doesn't alias
+		GLuint source;
+		glGenTextures(1, &source);
+		configure_texture(source, GL_LINEAR_MIPMAP_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_RGBA8, GL_RGBA);
 		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, size.x, size.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels);
+		glGenerateMipmap(GL_TEXTURE_2D);
+
+		// Array textures can't grow, so make a bigger one & copy the old layers over
+		GLsizei layers = GLsizei(mBrushes.size()) + 1;
+		GLuint array;
+		glGenTextures(1, &array);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, array);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+		glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, BRUSH_LAYER_SIZE, BRUSH_LAYER_SIZE, layers, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+		if (mBrushArray) {
+			glCopyImageSubData(
+				mBrushArray, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+				array, GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0,
+				BRUSH_LAYER_SIZE, BRUSH_LAYER_SIZE, layers - 1
+			);
+			glDeleteTextures(1, &mBrushArray);
+		}
+		mBrushArray = array;
+
+		GLuint thumbnail;
+		glGenTextures(1, &thumbnail);
+		configure_texture(thumbnail, GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_RGBA8, GL_RGBA);
+		glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, BRUSH_THUMBNAIL_SIZE, BRUSH_THUMBNAIL_SIZE, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+
+		int old[4];
+		glGetIntegerv(GL_VIEWPORT, old);
+		// We want the brush's alpha copied, not blended over garbage
+		GLboolean blend = glIsEnabled(GL_BLEND);
+		glDisable(GL_BLEND);
+		glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0);
+		glFramebufferTextureLayer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, mBrushArray, 0, layers - 1);
+		resample(source, BRUSH_LAYER_SIZE);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, thumbnail, 0);
+		resample(source, BRUSH_THUMBNAIL_SIZE);
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		if (blend) glEnable(GL_BLEND);
+		glViewport(old[0], old[1], old[2], old[3]);
+
+		glBindTexture(GL_TEXTURE_2D_ARRAY, mBrushArray);
+		glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
 		glBindTexture(GL_TEXTURE_2D, 0);
-		mSplatSize = size;
+		glDeleteTextures(1, &source);
+
+		mBrushes.push_back(Brush{ .size = size, .thumbnail = thumbnail });
+		mSelectedBrush = int(mBrushes.size()) - 1;
 	}
-	void prompt_choose_stroke_texture() {
+	void prompt_add_brush() {
 		// TODO: This has a lot in common with the canvas prompt
 		nfdu8filteritem_t filters[1] = { { "Images", "png,jpg,tga,bmp,psd,gif" } };
 		NFD::UniquePathU8 path = nullptr;
@@ -61,39 +169,80 @@ class SplatterTool : public virtual ICanvasTool {
 				&size.y,
 				nullptr,
 				4);
-			if (pixels) set_stroke_texture(size, pixels);
+			if (pixels) {
+				add_brush(size, pixels);
+				stbi_image_free(pixels);
+			}
 			else fprintf(stderr, "[error] STBI error: %s", stbi_failure_reason());
 		}
 	}
-	void draw_splat(vec2 pos, float rot, vec2 scale) {
-		auto xform = mat3::translate_hmg(pos)
-			* mat2::diag(scale.x, scale.y).hmg()
-			* mat2::rotate(rot).hmg();
+	// The brush's aspect ratio, with the longer axis being 1
+	vec2 brush_shape(int brush) const {
+		vec2 size = vec2(mBrushes[brush].size);
+		return size / std::max(size.x, size.y);
+	}
+	// Queues up a splat for the next draw_splats call. Everything's in clip space.
+	void queue_splat(vec2 pos, float rot, vec2 scale, int brush) {
+		// Same as translate(pos) * diag(scale) * rotate(rot), column by column
+		float c = cosf(rot);
+		float s = sinf(rot);
+		mInstances.push_back(SplatInstance{
+			.basis = vec4(scale.x * c, scale.y * s, -scale.x * s, scale.y * c),
+			.offset = vec4(pos.x, pos.y, float(brush), 0.0f),
+			.tint = mSplatTint,
+		});
+	}
+	// Draws every queued splat with a single instanced draw call
+	void draw_splats() {
+		if (mInstances.empty()) return;
+		glBindBuffer(GL_ARRAY_BUFFER, mInstanceVBO);
+		size_t bytes = mInstances.size() * sizeof(SplatInstance);
+		if (mInstances.size() > mInstanceCapacity) {
+			mInstanceCapacity = mInstances.size();
+			glBufferData(GL_ARRAY_BUFFER, bytes, mInstances.data(), GL_STREAM_DRAW);
+		}
+		else {
+			glBufferSubData(GL_ARRAY_BUFFER, 0, bytes, mInstances.data());
+		}
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
 		glBindVertexArray(mQuadVAO);
 		glUseProgram(mRenderProgram->id());
-		glUniformMatrix3fv(0, 1, GL_TRUE, xform.data());
 		glActiveTexture(GL_TEXTURE0);
-		glBindTexture(GL_TEXTURE_2D, mSplatTexture);
+		glBindTexture(GL_TEXTURE_2D_ARRAY, mBrushArray);
 		glUniform1i(1, 0);
-		glUniform4fv(2, 1, mSplatTint.data());
-		glDrawArrays(GL_TRIANGLE_STRIP, 0, 4);
+		glDrawArraysInstanced(GL_TRIANGLE_STRIP, 0, 4, GLsizei(mInstances.size()));
 		glUseProgram(0);
+		glBindVertexArray(0);
+		mInstances.clear();
 	}
 public:
-	SplatterTool() {
+	SplatterTool() : mBuffer(GL_RGBA8, GL_NEAREST) {
 		// punt on appropriate canvas size until clear_stroke is called
 		mCanvasSize = ivec2::zero();
 
-		glGenTextures(1, &mBufferTexture);
-		configure_texture(mBufferTexture, GL_NEAREST, GL_NEAREST, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_RGBA8, GL_RGBA);
-		glGenTextures(1, &mSplatTexture);
-		configure_texture(mSplatTexture, GL_LINEAR, GL_LINEAR, GL_CLAMP_TO_EDGE, GL_CLAMP_TO_EDGE, GL_RGBA8, GL_RGBA);
+		mBrushArray = 0;
+		mSelectedBrush = 0;
+		mRandomBrush = false;
 		glGenVertexArrays(1, &mQuadVAO);
 		glGenBuffers(1, &mQuadVBO);
 		configure_quad(mQuadVAO, mQuadVBO);
+		glGenBuffers(1, &mInstanceVBO);
+		mInstanceCapacity = 0;
+		glBindVertexArray(mQuadVAO);
+		glBindBuffer(GL_ARRAY_BUFFER, mInstanceVBO);
+		glEnableVertexAttribArray(2); // BASIS
+		glVertexAttribPointer(2, 4, GL_FLOAT, GL_FALSE, sizeof(SplatInstance), (void*)offsetof(SplatInstance, basis));
+		glEnableVertexAttribArray(3); // OFFSET
+		glVertexAttribPointer(3, 4, GL_FLOAT, GL_FALSE, sizeof(SplatInstance), (void*)offsetof(SplatInstance, offset));
+		glEnableVertexAttribArray(4); // TINT
+		glVertexAttribPointer(4, 4, GL_FLOAT, GL_FALSE, sizeof(SplatInstance), (void*)offsetof(SplatInstance, tint));
+		glVertexAttribDivisor(2, 1);
+		glVertexAttribDivisor(3, 1);
+		glVertexAttribDivisor(4, 1);
+		glBindVertexArray(0);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
 		glGenFramebuffers(1, &mFramebuffer);
 
-		mSplatSize = ivec2::zero();
 		mSplatTint = vec4::splat(1);
 		mSplatScale = 20.0f;
 		mSplatScaleRnd = 0;
@@ -103,9 +252,11 @@ public:
 		mSplatRate = 4;
 		mInStroke = false;
 		mLastTime = 0;
+		mStrokeRegion = CanvasRegion::empty();
 
 		mCompositeProgram = g_shaderMgr.compute("splatter_composite");
-		mRenderProgram = g_shaderMgr.graphics("simple_2d");
+		mRenderProgram = g_shaderMgr.graphics("splat");
+		mResampleProgram = g_shaderMgr.graphics("simple_2d");
 	}
 
 	SplatterTool(const SplatterTool&) = delete;
@@ -114,33 +265,33 @@ public:
 	SplatterTool& operator= (const SplatterTool&&) = delete;
 
 	~SplatterTool() override {
-		// even if an image isn't loaded (0x0), the texture name should still *exist*
-		assert(mSplatTexture);
-		glDeleteTextures(1, &mSplatTexture);
-		assert(mBufferTexture);
-		glDeleteTextures(1, &mBufferTexture);
+		// The array only exists once a brush has been loaded
+		if (mBrushArray) glDeleteTextures(1, &mBrushArray);
+		for (Brush& brush : mBrushes) {
+			assert(brush.thumbnail);
+			glDeleteTextures(1, &brush.thumbnail);
+		}
 		assert(mQuadVAO);
 		glDeleteVertexArrays(1, &mQuadVAO);
 		assert(mQuadVBO);
 		glDeleteBuffers(1, &mQuadVBO);
+		assert(mInstanceVBO);
+		glDeleteBuffers(1, &mInstanceVBO);
 		assert(mFramebuffer);
 		glDeleteFramebuffers(1, &mFramebuffer);
 	}
 	const char* name() const override {
 		return "Splatter";
 	}
-	void clear_stroke(ivec2 canvasSize) override {
+	void attach(ScratchPool& pool, GpuScheduler& scheduler) override {
+		mBuffer.attach(pool);
+	}
+	void clear_stroke(ivec2 canvasSize, CanvasFormat canvasFormat) override {
 		mInStroke = false;
 		assert(canvasSize.x > 0 && canvasSize.y > 0);
-		// We only re-create the texture if the canvas size changed,
-		// otherwise we just clear it...
-		if (mCanvasSize != canvasSize) {
-			glBindTexture(GL_TEXTURE_2D, mBufferTexture);
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, canvasSize.x, canvasSize.y, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
-			mCanvasSize = canvasSize;
-		}
-		const uint8_t zero[4] = { 0, 0, 0, 0 };
-		glClearTexImage(mBufferTexture, 0, GL_RGBA, GL_UNSIGNED_BYTE, zero);
+		mCanvasSize = canvasSize;
+		mBuffer.release(mStrokeRegion);
+		mStrokeRegion = CanvasRegion::empty();
 	}
 	bool understands_param(SDL_Keycode keyCode) override {
 		return (keyCode == SDLK_f) || (keyCode == SDLK_r) || (keyCode == SDLK_s) || (keyCode == SDLK_a);
@@ -163,7 +314,10 @@ public:
 			mSplatTint.w = std::clamp(wantedAlpha, 0.0f, 1.0f);
 		}
 	}
-	void update_stroke(vec2 canvasMouse, bool modifier) override {
+	CanvasRegion update_stroke(const VirtualCanvas& canvas, std::span<const vec2> points, bool modifier) override {
+		if (points.empty()) return CanvasRegion::empty();
+		// Splats are emitted over time, not distance, so only the latest position matters
+		vec2 canvasMouse = points.back();
 		if (!mInStroke) {
 			mInStroke = true;
 			mLastTime = SDL_GetTicks64();
@@ -171,17 +325,14 @@ public:
 		uint64_t recip = 1000ull / mSplatRate;
 		uint64_t curTime = SDL_GetTicks64();
 
-		if (curTime - mLastTime < recip) return; // early out to be a bit efficient
+		if (curTime - mLastTime < recip) return CanvasRegion::empty(); // early out to be a bit efficient
+		if (mBrushes.empty()) {
+			// Nothing to splat with, don't let the backlog pile up either
+			mLastTime = curTime;
+			return CanvasRegion::empty();
+		}
 
-		GLfloat clearColor[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
-		int old[4];
-		glGetIntegerv(GL_VIEWPORT, old);
-		// TODO: could be perf implications of not clearing the framebuffer
-		// using a swapchain could be better
-		glViewport(0, 0, mCanvasSize.x, mCanvasSize.y);
-		glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mBufferTexture, 0);
-		glDrawBuffer(GL_COLOR_ATTACHMENT0);
+		CanvasRegion modified = CanvasRegion::empty();
 		while (curTime - mLastTime > recip) {
 			// emit one stroke
 			mLastTime = mLastTime + recip;
@@ -190,38 +341,97 @@ public:
 			// ^^^ the sqrtf is to get an even distribution since these are polar coordinates
 			float offsetAngle = float(rand()) / (float(RAND_MAX) / (2*M_PI)); // [0, 2pi]
 			vec2 offset = { offsetRadius * cosf(offsetAngle), offsetRadius * sinf(offsetAngle) };
-			vec2 pos = 2 * vec2(canvasMouse+offset) / vec2(mCanvasSize) - vec2::splat(1);
 
 			float rot = mSplatRotation + mSplatRotationRnd * float(rand()) / float(RAND_MAX);
 
 			float prescale = mSplatScale + mSplatScaleRnd * float(rand()) / float(RAND_MAX);
-			vec2 nrm = vec2(mSplatSize) / std::max(mSplatSize.x, mSplatSize.y);
-			vec2 scale = (prescale * nrm) / vec2(mCanvasSize);
+			int brush = mRandomBrush ? rand() % int(mBrushes.size()) : mSelectedBrush;
+			vec2 nrm = brush_shape(brush);
 
-			draw_splat(pos, rot, scale);
+			mPending.push_back(PendingSplat{ .pos = canvasMouse + offset, .rot = rot, .size = prescale * nrm, .brush = brush });
+			// The splat quad can be rotated, so bound it by its diagonal
+			float extent = prescale * nrm.mag() / 2 + 1;
+			modified = CanvasRegion::merge(modified, CanvasRegion(canvasMouse + offset, extent));
+		}
+		mBuffer.cover(modified, mCanvasSize);
+		modified = CanvasRegion::intersect(modified, mBuffer.region());
+		if (modified.is_empty()) {
+			// Entirely off the canvas
+			mPending.clear();
+			return modified;
 		}
+		// The buffer is the whole viewport, so it's what clip space spans
+		vec2 origin = vec2(mBuffer.origin());
+		vec2 bufferSize = vec2(mBuffer.region().size());
+		for (const PendingSplat& splat : mPending) {
+			vec2 pos = 2 * (splat.pos - origin) / bufferSize - vec2::splat(1);
+			queue_splat(pos, splat.rot, splat.size / bufferSize, splat.brush);
+		}
+		mPending.clear();
+
+		int old[4];
+		glGetIntegerv(GL_VIEWPORT, old);
+		// TODO: could be perf implications of not clearing the framebuffer
+		// using a swapchain could be better
+		glViewport(0, 0, GLsizei(bufferSize.x), GLsizei(bufferSize.y));
+		glBindFramebuffer(GL_FRAMEBUFFER, mFramebuffer);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mBuffer.texture(), 0);
+		glDrawBuffer(GL_COLOR_ATTACHMENT0);
+		draw_splats();
 		// reset framebuffer to render buffer
 		glViewport(old[0], old[1], old[2], old[3]);
 		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+		mStrokeRegion = CanvasRegion::merge(mStrokeRegion, modified);
+		return modified;
+	}
+	bool set_proxy_scale(int scale) override {
+		// Splats are random and emitted over time, so a replay wouldn't match
+		return scale == 1;
 	}
-	void composite(GLuint dst, GLuint src) override {
+	CanvasRegion composite(VirtualCanvas& canvas, const CanvasRegion& clip) override {
+		CanvasRegion region = CanvasRegion::intersect(mStrokeRegion, clip);
+		if (region.is_empty()) return CanvasRegion::empty();
+		ivec2 size = region.size();
 		glUseProgram(mCompositeProgram->id());
 		// NOTE: layouts are hardcoded in the shader
-		glBindImageTexture(0, mBufferTexture, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
-		glBindImageTexture(1, src, 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
-		glBindImageTexture(2, dst, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RGBA8);
-		glDispatchCompute((mCanvasSize.x + 15) / 16, (mCanvasSize.y + 15) / 16, 1);
+		glBindImageTexture(0, mBuffer.texture(), 0, GL_FALSE, 0, GL_READ_ONLY, GL_RGBA8);
+		// On single channel canvases, only the red channel of the splats makes it
+		canvas.bind_image(2, GL_WRITE_ONLY);
+		glUniform2iv(3, 1, region.min.data());
+		canvas.bind(4, 0);
+		glUniform2iv(8, 1, mBuffer.origin().data());
+		glDispatchCompute((size.x + 15) / 16, (size.y + 15) / 16, 1);
 		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		return region;
+	}
+	StrokeOverlay overlay() const override {
+		// Nothing to show until the stroke has actually started
+		if (!mBuffer.texture()) return StrokeOverlay{};
+		return StrokeOverlay{
+			.mode = StrokeOverlay::Mode::BUFFER,
+			.texture = mBuffer.texture(),
+			.origin = mBuffer.origin(),
+		};
 	}
 	void run_ui() override {
-		DIAG_PUSHIGNORE_MSVC(4312);
-		// this is the way ImGui tells us to cast it
-		// manually specifying the UV coordinates since OpenGL's coordinate space is "upside down" compared to ImGui's
-		ImGui::Image((ImTextureID)mSplatTexture, ImVec2( 100, 100 ), ImVec2(0, 1), ImVec2(1,0));
-		DIAG_POP_MSVC();
-		if (ImGui::Button("Choose texture...")) {
-			prompt_choose_stroke_texture();
+		for (int i = 0; i < int(mBrushes.size()); i++) {
+			if (i % 4 != 0) ImGui::SameLine();
+			vec2 shape = brush_shape(i) * float(BRUSH_THUMBNAIL_SIZE);
+			// Highlight the brush(es) which will actually be used
+			bool active = mRandomBrush || i == mSelectedBrush;
+			ImVec4 bg = active ? ImGui::GetStyleColorVec4(ImGuiCol_ButtonActive) : ImVec4(0, 0, 0, 0);
+			DIAG_PUSHIGNORE_MSVC(4312);
+			// this is the way ImGui tells us to cast it
+			// manually specifying the UV coordinates since OpenGL's coordinate space is "upside down" compared to ImGui's
+			if (ImGui::ImageButton((ImTextureID)mBrushes[i].thumbnail, ImVec2(shape.x, shape.y), ImVec2(0, 1), ImVec2(1, 0), -1, bg)) {
+				mSelectedBrush = i;
+			}
+			DIAG_POP_MSVC();
+		}
+		if (ImGui::Button("Add brush...")) {
+			prompt_add_brush();
 		}
+		ImGui::Checkbox("Random Brush", &mRandomBrush);
 		ImGui::DragFloat("Scale", &mSplatScale, 1.0f, 1.0f, MAX_BRUSH_RADIUS, "%g");
 		ImGui::DragFloat("Scale (Random)", &mSplatScaleRnd, 1.0f, 0.0f, MAX_BRUSH_RADIUS, "%g");
 		float degRot = mSplatRotation * 180 / M_PI;
@@ -236,11 +446,13 @@ public:
 		ImGui::ColorPicker4("Tint", mSplatTint.data());
 	}
 	void preview(ivec2 screenSize, ivec2 screenMouse, float canvasScale) override {
+		if (mBrushes.empty()) return;
 		// dont even ask how I came up with this
-		vec2 nrm = vec2(mSplatSize) / std::max(mSplatSize.x, mSplatSize.y);
+		vec2 nrm = brush_shape(mSelectedBrush);
 		vec2 scale = (canvasScale * mSplatScale * nrm) / vec2(screenSize);
 		vec2 pos = 2 * vec2(screenMouse) / vec2(screenSize) - vec2::splat(1);
-		draw_splat(pos, mSplatRotation, scale);
+		queue_splat(pos, mSplatRotation, scale, mSelectedBrush);
+		draw_splats();
 	}
 };
 
@@ -0,0 +1,123 @@
+
+#include <cmath>
+#include <vector>
+
+#include "../shadermgr.h"
+#include "stroke_raster.h"
+
+// Workgroups per row of the dispatch grid, the tile list is laid out
+// row by row so that huge brushes don't exceed the 65535 group limit.
+// NOTE: also hardcoded in paint_stroke_cull.comp
+constexpr GLuint DISPATCH_WIDTH = 1024;
+// Workgroup size of paint_stroke_cull.comp, in tiles
+constexpr int CULL_GROUP_SIZE = 8;
+
+StrokeRasterizer::StrokeRasterizer() {
+	glGenBuffers(1, &mSegmentBuffer);
+	glGenBuffers(1, &mTileBuffer);
+	glGenBuffers(1, &mDispatchBuffer);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mDispatchBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, 4 * sizeof(GLuint), nullptr, GL_DYNAMIC_DRAW);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+	mTileCapacity = 0;
+	glGenTextures(1, &mFalloffTexture);
+	glBindTexture(GL_TEXTURE_1D, mFalloffTexture);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_1D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexImage1D(GL_TEXTURE_1D, 0, GL_R16, FALLOFF_LUT_SIZE, 0, GL_RED, GL_UNSIGNED_SHORT, nullptr);
+	glBindTexture(GL_TEXTURE_1D, 0);
+	// Not a valid hardness, so the first falloff_lut call fills it in
+	mFalloffHardness = -1.0f;
+	mCullProgram = g_shaderMgr.compute("paint_stroke_cull");
+	mProgram = g_shaderMgr.compute("paint_stroke");
+}
+StrokeRasterizer::~StrokeRasterizer() noexcept {
+	assert(mSegmentBuffer);
+	glDeleteBuffers(1, &mSegmentBuffer);
+	assert(mTileBuffer);
+	glDeleteBuffers(1, &mTileBuffer);
+	assert(mDispatchBuffer);
+	glDeleteBuffers(1, &mDispatchBuffer);
+	assert(mFalloffTexture);
+	glDeleteTextures(1, &mFalloffTexture);
+}
+GLuint StrokeRasterizer::falloff_lut(float hardness) {
+	if (hardness == mFalloffHardness) return mFalloffTexture;
+	std::vector<uint16_t> curve(FALLOFF_LUT_SIZE);
+	for (int i = 0; i < FALLOFF_LUT_SIZE; i++) {
+		// Entry 0 is the center of the brush, the last one is its edge
+		float normalized = 1.0f - float(i) / float(FALLOFF_LUT_SIZE - 1);
+		curve[i] = uint16_t(std::lround(65535.0f * std::pow(normalized, hardness)));
+	}
+	glBindTexture(GL_TEXTURE_1D, mFalloffTexture);
+	glTexSubImage1D(GL_TEXTURE_1D, 0, 0, FALLOFF_LUT_SIZE, GL_RED, GL_UNSIGNED_SHORT, curve.data());
+	glBindTexture(GL_TEXTURE_1D, 0);
+	mFalloffHardness = hardness;
+	return mFalloffTexture;
+}
+CanvasRegion StrokeRasterizer::rasterize(ScratchRegion& mask, ivec2 canvasSize, vec2 from, std::span<const vec2> points, float radius, float hardness) {
+	CanvasRegion total = CanvasRegion::empty();
+	mSegments.clear();
+	vec2 start = from;
+	for (vec2 end : points) {
+		total = CanvasRegion::merge(total, CanvasRegion(start, radius));
+		total = CanvasRegion::merge(total, CanvasRegion(end, radius));
+		mSegments.push_back(vec4(start.x, start.y, end.x, end.y));
+		start = end;
+	}
+	mask.cover(total, canvasSize);
+	CanvasRegion clamped = CanvasRegion::intersect(total.clamp(canvasSize), mask.region());
+	if (clamped.is_empty()) return clamped;
+	// Every tile in the bounding box is a candidate, the culling pass decides
+	ivec2 gridOrigin = clamped.min / TILE_SIZE;
+	ivec2 gridSize = (clamped.max - ivec2::splat(1)) / TILE_SIZE - gridOrigin + ivec2::splat(1);
+	size_t candidates = size_t(gridSize.x) * size_t(gridSize.y);
+
+	// Orphan & refill; these are tiny so there's no point in anything fancier
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mSegmentBuffer);
+	glBufferData(GL_SHADER_STORAGE_BUFFER, mSegments.size() * sizeof(vec4), mSegments.data(), GL_STREAM_DRAW);
+	if (candidates > mTileCapacity) {
+		mTileCapacity = candidates;
+		glBindBuffer(GL_SHADER_STORAGE_BUFFER, mTileBuffer);
+		glBufferData(GL_SHADER_STORAGE_BUFFER, mTileCapacity * sizeof(ivec2), nullptr, GL_DYNAMIC_DRAW);
+	}
+	const GLuint reset[4] = { 0, 0, 1, 0 };
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, mDispatchBuffer);
+	glBufferSubData(GL_SHADER_STORAGE_BUFFER, 0, sizeof(reset), reset);
+	glBindBuffer(GL_SHADER_STORAGE_BUFFER, 0);
+
+	// NOTE: layouts are hardcoded in the shaders
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 1, mSegmentBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 2, mTileBuffer);
+	glBindBufferBase(GL_SHADER_STORAGE_BUFFER, 3, mDispatchBuffer);
+
+	glUseProgram(mCullProgram->id());
+	glUniform1i(4, GLint(mSegments.size()));
+	glUniform2i(5, gridOrigin.x, gridOrigin.y);
+	glUniform2i(6, gridSize.x, gridSize.y);
+	glUniform1f(7, radius);
+	glDispatchCompute(
+		GLuint(gridSize.x + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE,
+		GLuint(gridSize.y + CULL_GROUP_SIZE - 1) / CULL_GROUP_SIZE,
+		1
+	);
+	// The tile list is read as storage, the arguments as a dispatch command
+	glMemoryBarrier(GL_SHADER_STORAGE_BARRIER_BIT | GL_COMMAND_BARRIER_BIT);
+
+	glUseProgram(mProgram->id());
+	glBindImageTexture(0, mask.texture(), 0, GL_FALSE, 0, GL_READ_WRITE, GL_R8);
+	glUniform1i(3, GLint(mSegments.size()));
+	glUniform2f(5, radius, hardness);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_1D, falloff_lut(hardness));
+	glUniform1i(6, 0);
+	ivec2 maskOrigin = mask.origin();
+	glUniform2i(7, maskOrigin.x, maskOrigin.y);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, mDispatchBuffer);
+	glDispatchComputeIndirect(0);
+	glBindBuffer(GL_DISPATCH_INDIRECT_BUFFER, 0);
+	// The mask is sampled directly when drawing the stroke overlay
+	glMemoryBarrier(GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+	return clamped;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <span>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include "../canvas.h"
+#include "scratch_region.h"
+
+// Rasterizes brush strokes into a one-channel (R8) mask texture, which only
+// covers the stroke so far (see ScratchRegion) and is grown to fit each batch.
+// Shared by the paint & smooth tools, which used to each dispatch
+// paint_stroke.comp once per mouse event.
+//
+// A batch of points becomes a chain of capsule-shaped segments, which are
+// uploaded to a shader storage buffer. A small culling pass then checks every
+// 16x16 tile in the batch's bounding box against the capsules, and appends
+// the ones they actually touch to a tile list. The rasterization pass is
+// dispatched indirectly over that list, with each texel taking the strongest
+// coverage of any segment. For long diagonal flicks, most of the bounding box
+// is nowhere near the capsule, so this skips the bulk of the invocations.
+//
+// The hardness curve is baked into a small lookup texture, which is only
+// rebuilt when the hardness changes, so the kernel doesn't need pow().
+class StrokeRasterizer {
+	// Segment endpoints (start.xy, end.xy), std430 vec4
+	GLuint mSegmentBuffer;
+	// Bottom left corner of each surviving tile, std430 ivec2
+	GLuint mTileBuffer;
+	// Indirect dispatch arguments followed by the tile count, 4 uints
+	GLuint mDispatchBuffer;
+	// How many tiles mTileBuffer can currently hold
+	size_t mTileCapacity;
+	Program* mCullProgram;
+	Program* mProgram;
+	// R16 1D texture of the falloff curve, and the hardness it was built for
+	GLuint mFalloffTexture;
+	float mFalloffHardness;
+
+	// Scratch space, kept around so we don't reallocate every frame
+	std::vector<vec4> mSegments;
+public:
+	// Texels along each side of a tile. Matches the shader's workgroup size.
+	static constexpr int TILE_SIZE = 16;
+	// Entries in the falloff lookup texture
+	static constexpr int FALLOFF_LUT_SIZE = 1024;
+
+	StrokeRasterizer();
+	~StrokeRasterizer() noexcept;
+
+	StrokeRasterizer(const StrokeRasterizer&) = delete;
+	StrokeRasterizer& operator=(const StrokeRasterizer&) = delete;
+
+	// Returns the falloff lookup texture for `hardness`, rebuilding it if needed.
+	GLuint falloff_lut(float hardness);
+
+	// Draws the segments from `from` through each of `points` into `mask`,
+	// growing it to cover them first. Returns a bound on the texels which may
+	// have been modified, in canvas coordinates.
+	CanvasRegion rasterize(ScratchRegion& mask, ivec2 canvasSize, vec2 from, std::span<const vec2> points, float radius, float hardness);
+};
@@ -0,0 +1,390 @@
+#include <algorithm>
+#include <cassert>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include "virtual_canvas.h"
+#include "canvas.h"
+#include "shadermgr.h"
+
+// What a blank canvas is filled with. The alpha is ignored by single channel formats.
+constexpr std::array<uint16_t, 4> BLANK_FILL = { 0, 0, 0, 65535 };
+
+VirtualCanvas::VirtualCanvas() {
+	mCanvasSize = ivec2::zero();
+	mFormat = CanvasFormat::RGBA8;
+	mTileCount = ivec2::zero();
+	// Integer textures are incomplete with linear filtering, and the fills
+	// are only ever read with texelFetch
+	glGenTextures(1, &mLayerTable);
+	glBindTexture(GL_TEXTURE_2D, mLayerTable);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glGenTextures(1, &mFillTable);
+	glBindTexture(GL_TEXTURE_2D, mFillTable);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	glBindTexture(GL_TEXTURE_2D, 0);
+	mAtlas = 0;
+	mAtlasCapacity = 0;
+	mResidentCount = 0;
+	glGenFramebuffers(1, &mReadFramebuffer);
+	mDownsampleProgram = g_shaderMgr.compute("canvas_downsample");
+}
+VirtualCanvas::~VirtualCanvas() noexcept {
+	assert(mLayerTable);
+	glDeleteTextures(1, &mLayerTable);
+	assert(mFillTable);
+	glDeleteTextures(1, &mFillTable);
+	if (mAtlas) glDeleteTextures(1, &mAtlas);
+	assert(mReadFramebuffer);
+	glDeleteFramebuffers(1, &mReadFramebuffer);
+}
+std::array<uint16_t, 4> VirtualCanvas::fill_of(const uint8_t* pixel) const {
+	if (mFormat == CanvasFormat::R16) {
+		uint16_t value;
+		memcpy(&value, pixel, sizeof(value));
+		return { value, value, value, 65535 };
+	}
+	// 8 bit unorm -> 16 bit unorm is exact
+	return { uint16_t(pixel[0] * 257), uint16_t(pixel[1] * 257), uint16_t(pixel[2] * 257), uint16_t(pixel[3] * 257) };
+}
+void VirtualCanvas::upload_tables() {
+	if (mLayers.empty()) return;
+	glBindTexture(GL_TEXTURE_2D, mLayerTable);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_R32I, mTileCount.x, mTileCount.y, 0, GL_RED_INTEGER, GL_INT, mLayers.data());
+	glBindTexture(GL_TEXTURE_2D, mFillTable);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA16, mTileCount.x, mTileCount.y, 0, GL_RGBA, GL_UNSIGNED_SHORT, mFills.data());
+	glBindTexture(GL_TEXTURE_2D, 0);
+}
+bool VirtualCanvas::fits(ivec2 canvasSize) {
+	GLint maxLayers = 0;
+	GLint maxSize = 0;
+	glGetIntegerv(GL_MAX_ARRAY_TEXTURE_LAYERS, &maxLayers);
+	glGetIntegerv(GL_MAX_TEXTURE_SIZE, &maxSize);
+	ivec2 tiles = (canvasSize + ivec2::splat(TILE_SIZE - 1)) / TILE_SIZE;
+	if (tiles.x > maxSize || tiles.y > maxSize) return false;
+	return size_t(tiles.x) * size_t(tiles.y) <= size_t(maxLayers);
+}
+void VirtualCanvas::reserve(int layers) {
+	if (layers <= mAtlasCapacity) return;
+	// Array textures can't grow, so make a bigger one & copy the old layers over.
+	// Doubling keeps that rare, but there's never a reason to have more
+	// layers than tiles.
+	int capacity = std::min(std::max(layers, 2 * mAtlasCapacity), int(mLayers.size()));
+	auto info = canvas_format_info(mFormat);
+	GLuint atlas;
+	glGenTextures(1, &atlas);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, atlas);
+	glTexStorage3D(GL_TEXTURE_2D_ARRAY, LEVELS, info.internalFormat, TILE_SIZE, TILE_SIZE, capacity);
+	// Only ever read with texelFetch, but the levels have to count
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+	glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+	// Single channel canvases read as grayscale everywhere they're sampled
+	// (display, water, tools), so nothing has to special-case them
+	if (info.singleChannel) {
+		GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, GL_ONE };
+		glTexParameteriv(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+	}
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+	if (mAtlas) {
+		if (mResidentCount > 0) {
+			// Compute shaders may have written to these through image stores
+			glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+			for (int level = 0; level < LEVELS; level++) {
+				glCopyImageSubData(
+					mAtlas, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+					atlas, GL_TEXTURE_2D_ARRAY, level, 0, 0, 0,
+					TILE_SIZE >> level, TILE_SIZE >> level, mResidentCount);
+			}
+		}
+		glDeleteTextures(1, &mAtlas);
+	}
+	mAtlas = atlas;
+	mAtlasCapacity = capacity;
+}
+void VirtualCanvas::reset(ivec2 canvasSize, CanvasFormat format, const void* pixels) {
+	begin_upload(canvasSize, format);
+	if (pixels) {
+		const uint8_t* bytes = static_cast<const uint8_t*>(pixels);
+		size_t stride = size_t(canvasSize.x) * canvas_format_info(format).bytesPerPixel;
+		std::array<const uint8_t*, TILE_SIZE> rows;
+		for (int ty = 0; ty < mTileCount.y; ty++) {
+			int height = std::min(TILE_SIZE, canvasSize.y - ty * TILE_SIZE);
+			for (int y = 0; y < height; y++) rows[y] = bytes + size_t(ty * TILE_SIZE + y) * stride;
+			upload_tile_row(ty, std::span(rows.data(), height), rows[0]);
+		}
+	}
+	end_upload();
+}
+void VirtualCanvas::begin_upload(ivec2 canvasSize, CanvasFormat format) {
+	if (mAtlas) glDeleteTextures(1, &mAtlas);
+	mAtlas = 0;
+	mAtlasCapacity = 0;
+	mResidentCount = 0;
+	mCanvasSize = canvasSize;
+	mFormat = format;
+	mTileCount = (canvasSize + ivec2::splat(TILE_SIZE - 1)) / TILE_SIZE;
+	size_t tileCount = size_t(mTileCount.x) * size_t(mTileCount.y);
+	mLayers.assign(tileCount, -1);
+	mFills.assign(tileCount, BLANK_FILL);
+}
+void VirtualCanvas::upload_tile_row(int tileY, std::span<const uint8_t* const> rows, const void* unpack) {
+	assert(tileY >= 0 && tileY < mTileCount.y);
+	assert(int(rows.size()) == std::min(TILE_SIZE, mCanvasSize.y - tileY * TILE_SIZE));
+	// Only tiles with more than one color in them need to be uploaded
+	auto info = canvas_format_info(mFormat);
+	int height = int(rows.size());
+	int firstLayer = mResidentCount;
+	for (int tx = 0; tx < mTileCount.x; tx++) {
+		size_t offset = size_t(tx) * TILE_SIZE * info.bytesPerPixel;
+		int width = std::min(TILE_SIZE, mCanvasSize.x - tx * TILE_SIZE);
+		const uint8_t* first = rows[0] + offset;
+		bool uniform = true;
+		for (int y = 0; y < height && uniform; y++) {
+			const uint8_t* row = rows[y] + offset;
+			for (int x = 0; x < width && uniform; x++) {
+				uniform = memcmp(row + size_t(x) * info.bytesPerPixel, first, info.bytesPerPixel) == 0;
+			}
+		}
+		size_t index = size_t(tileY) * mTileCount.x + tx;
+		if (uniform) mFills[index] = fill_of(first);
+		else mLayers[index] = mResidentCount++;
+	}
+	if (mResidentCount == firstLayer) return;
+	reserve(mResidentCount);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mAtlas);
+	// R16 rows aren't necessarily 4 byte aligned
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, mCanvasSize.x);
+	for (int tx = 0; tx < mTileCount.x; tx++) {
+		GLint layer = mLayers[size_t(tileY) * mTileCount.x + tx];
+		if (layer < firstLayer) continue;
+		int width = std::min(TILE_SIZE, mCanvasSize.x - tx * TILE_SIZE);
+		// With an unpack buffer bound, this is an offset rather than a pointer
+		const void* first = (const void*)(uintptr_t(unpack) + size_t(tx) * TILE_SIZE * info.bytesPerPixel);
+		glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, layer, width, height, 1, info.format, info.type, first);
+	}
+	glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+}
+void VirtualCanvas::end_upload() {
+	upload_tables();
+	update_mips(CanvasRegion(ivec2::zero(), mCanvasSize));
+}
+void VirtualCanvas::reset_downsampled(const VirtualCanvas& source, int level) {
+	assert(&source != this && level > 0 && level < LEVELS);
+	int scale = 1 << level;
+	reset((source.mCanvasSize + ivec2::splat(scale - 1)) / scale, source.mFormat, nullptr);
+	if (mLayers.empty()) return;
+	// Each of our tiles is a block of scale x scale source tiles, each of
+	// which contributes its (TILE_SIZE / scale)^2 mip at `level`
+	int part = TILE_SIZE >> level;
+	glMemoryBarrier(GL_TEXTURE_UPDATE_BARRIER_BIT);
+	for (int ty = 0; ty < mTileCount.y; ty++) {
+		for (int tx = 0; tx < mTileCount.x; tx++) {
+			ivec2 first = ivec2(tx, ty) * scale;
+			ivec2 last = math::vmin(first + ivec2::splat(scale), source.mTileCount) - ivec2::splat(1);
+			size_t index = size_t(ty) * mTileCount.x + tx;
+			// A block of identical uniform tiles stays uniform
+			size_t firstIndex = size_t(first.y) * source.mTileCount.x + first.x;
+			bool uniform = true;
+			for (int y = first.y; y <= last.y && uniform; y++) {
+				for (int x = first.x; x <= last.x && uniform; x++) {
+					size_t sourceIndex = size_t(y) * source.mTileCount.x + x;
+					uniform = source.mLayers[sourceIndex] < 0 && source.mFills[sourceIndex] == source.mFills[firstIndex];
+				}
+			}
+			if (uniform) {
+				mFills[index] = source.mFills[firstIndex];
+				continue;
+			}
+			reserve(mResidentCount + 1);
+			GLint layer = mResidentCount++;
+			mLayers[index] = layer;
+			for (int y = first.y; y <= last.y; y++) {
+				for (int x = first.x; x <= last.x; x++) {
+					size_t sourceIndex = size_t(y) * source.mTileCount.x + x;
+					ivec2 offset = (ivec2(x, y) - first) * part;
+					GLint sourceLayer = source.mLayers[sourceIndex];
+					if (sourceLayer < 0) {
+						glClearTexSubImage(mAtlas, 0, offset.x, offset.y, layer, part, part, 1, GL_RGBA, GL_UNSIGNED_SHORT, source.mFills[sourceIndex].data());
+					}
+					else {
+						glCopyImageSubData(
+							source.mAtlas, GL_TEXTURE_2D_ARRAY, level, 0, 0, sourceLayer,
+							mAtlas, GL_TEXTURE_2D_ARRAY, 0, offset.x, offset.y, layer,
+							part, part, 1);
+					}
+				}
+			}
+		}
+	}
+	upload_tables();
+	update_mips(CanvasRegion(ivec2::zero(), mCanvasSize));
+}
+void VirtualCanvas::make_resident(const CanvasRegion& region) {
+	CanvasRegion clamped = region.clamp(mCanvasSize);
+	if (clamped.is_empty()) return;
+	ivec2 firstTile = clamped.min / TILE_SIZE;
+	ivec2 lastTile = (clamped.max - ivec2::splat(1)) / TILE_SIZE;
+	bool changed = false;
+	for (int y = firstTile.y; y <= lastTile.y; y++) {
+		for (int x = firstTile.x; x <= lastTile.x; x++) {
+			size_t index = size_t(y) * mTileCount.x + x;
+			if (mLayers[index] >= 0) continue;
+			reserve(mResidentCount + 1);
+			GLint layer = mResidentCount++;
+			// The layer takes over from the fill, so it starts out as that color,
+			// mips included. (Single channel formats only take the red channel.)
+			for (int level = 0; level < LEVELS; level++) {
+				int size = TILE_SIZE >> level;
+				glClearTexSubImage(mAtlas, level, 0, 0, layer, size, size, 1, GL_RGBA, GL_UNSIGNED_SHORT, mFills[index].data());
+			}
+			mLayers[index] = layer;
+			changed = true;
+		}
+	}
+	if (changed) upload_tables();
+}
+void VirtualCanvas::update_mips(const CanvasRegion& region) {
+	CanvasRegion clamped = region.clamp(mCanvasSize);
+	if (clamped.is_empty() || mResidentCount == 0) return;
+	glUseProgram(mDownsampleProgram->id());
+	// NOTE: layouts are hardcoded in the shader. Uniform tiles are never
+	// touched, so this only needs part of what bind() sets up.
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mAtlas);
+	glUniform1i(3, 0);
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, mLayerTable);
+	glUniform1i(4, 1);
+	glUniform2iv(5, 1, mCanvasSize.data());
+	glActiveTexture(GL_TEXTURE0);
+	for (int level = 1; level < LEVELS; level++) {
+		// Each level reads the one before it through the sampler
+		glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT);
+		int scale = 1 << level;
+		ivec2 levelMin = clamped.min / scale;
+		ivec2 levelMax = (clamped.max + ivec2::splat(scale - 1)) / scale;
+		ivec2 levelSize = levelMax - levelMin;
+		glBindImageTexture(0, mAtlas, level, GL_TRUE, 0, GL_WRITE_ONLY, canvas_format_info(mFormat).internalFormat);
+		glUniform1i(1, level);
+		glUniform2iv(2, 1, levelMin.data());
+		glDispatchCompute((levelSize.x + 15) / 16, (levelSize.y + 15) / 16, 1);
+	}
+	glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT | GL_SHADER_IMAGE_ACCESS_BARRIER_BIT | GL_TEXTURE_UPDATE_BARRIER_BIT);
+	glUseProgram(0);
+}
+VirtualCanvas::Location VirtualCanvas::locate(ivec2 coords) const {
+	ivec2 tile = coords / TILE_SIZE;
+	GLint layer = mLayers[size_t(tile.y) * mTileCount.x + tile.x];
+	assert(layer >= 0);
+	return Location{ .layer = layer, .offset = coords - tile * TILE_SIZE };
+}
+void VirtualCanvas::read(GLenum format, GLenum type, void* pixels) const {
+	auto info = canvas_format_info(mFormat);
+	bool heights = format == GL_RED && type == GL_FLOAT;
+	if (!heights && (format != info.format || type != info.type)) {
+		fprintf(stderr, "[error] can't read a %s canvas as format 0x%x, type 0x%x\n", info.name, format, type);
+		std::abort();
+	}
+	size_t bytesPerPixel = heights ? sizeof(float) : info.bytesPerPixel;
+	uint8_t* bytes = static_cast<uint8_t*>(pixels);
+	size_t stride = size_t(mCanvasSize.x) * bytesPerPixel;
+
+	// Resident tiles are read straight into place...
+	glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, mReadFramebuffer);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	glPixelStorei(GL_PACK_ROW_LENGTH, mCanvasSize.x);
+	for (size_t index = 0; index < mLayers.size(); index++) {
+		ivec2 origin = ivec2(int(index % mTileCount.x), int(index / mTileCount.x)) * TILE_SIZE;
+		ivec2 size = math::vmin(ivec2::splat(TILE_SIZE), mCanvasSize - origin);
+		uint8_t* first = bytes + size_t(origin.y) * stride + size_t(origin.x) * bytesPerPixel;
+		if (mLayers[index] >= 0) {
+			glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, mAtlas, 0, mLayers[index]);
+			glReadPixels(0, 0, size.x, size.y, format, type, first);
+			continue;
+		}
+		// ...and uniform ones are filled in on the CPU
+		uint8_t pixel[4];
+		if (heights) {
+			float value = mFills[index][0] / 65535.0f;
+			memcpy(pixel, &value, sizeof(value));
+		}
+		else {
+			tile_fill(index, pixel);
+		}
+		for (int y = 0; y < size.y; y++) {
+			uint8_t* row = first + size_t(y) * stride;
+			for (int x = 0; x < size.x; x++) {
+				memcpy(row + size_t(x) * bytesPerPixel, pixel, bytesPerPixel);
+			}
+		}
+	}
+	glPixelStorei(GL_PACK_ROW_LENGTH, 0);
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+void VirtualCanvas::tile_fill(size_t index, uint8_t* pixel) const {
+	const auto& fill = mFills[index];
+	if (mFormat == CanvasFormat::R16) {
+		memcpy(pixel, &fill[0], sizeof(uint16_t));
+	}
+	else {
+		for (int c = 0; c < 4; c++) pixel[c] = uint8_t(fill[c] >> 8);
+	}
+}
+void VirtualCanvas::read_into_buffer(std::span<const Readback> pieces) const {
+	auto info = canvas_format_info(mFormat);
+	// The canvas may have just been written by a compute shader
+	glMemoryBarrier(GL_FRAMEBUFFER_BARRIER_BIT | GL_PIXEL_BUFFER_BARRIER_BIT);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, mReadFramebuffer);
+	glReadBuffer(GL_COLOR_ATTACHMENT0);
+	// Pieces are packed back to back, R16 edge tiles can have odd widths
+	glPixelStorei(GL_PACK_ALIGNMENT, 1);
+	// Consecutive pieces tend to share an atlas layer
+	GLint attached = -1;
+	// With a pack buffer bound, these return immediately; the "pointer" is an offset
+	for (const Readback& piece : pieces) {
+		auto location = locate(piece.origin);
+		if (location.layer != attached) {
+			glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, mAtlas, 0, location.layer);
+			attached = location.layer;
+		}
+		glReadPixels(location.offset.x, location.offset.y, piece.size.x, piece.size.y, info.format, info.type, (void*)(piece.offset));
+	}
+	glPixelStorei(GL_PACK_ALIGNMENT, 4);
+	glFramebufferTextureLayer(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, 0, 0, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+void VirtualCanvas::bind(GLint location, GLuint unit) const {
+	glActiveTexture(GL_TEXTURE0 + unit);
+	glBindTexture(GL_TEXTURE_2D_ARRAY, mAtlas);
+	glUniform1i(location, unit);
+	glActiveTexture(GL_TEXTURE0 + unit + 1);
+	glBindTexture(GL_TEXTURE_2D, mLayerTable);
+	glUniform1i(location + 1, unit + 1);
+	glActiveTexture(GL_TEXTURE0 + unit + 2);
+	glBindTexture(GL_TEXTURE_2D, mFillTable);
+	glUniform1i(location + 2, unit + 2);
+	glUniform2iv(location + 3, 1, mCanvasSize.data());
+	glActiveTexture(GL_TEXTURE0);
+}
+void VirtualCanvas::bind_image(GLuint binding, GLenum access) const {
+	// Nothing can be written before a tile is made resident anyway
+	if (!mAtlas) return;
+	glBindImageTexture(binding, mAtlas, 0, GL_TRUE, 0, access, canvas_format_info(mFormat).internalFormat);
+}
+size_t VirtualCanvas::memory_usage() const {
+	size_t texels = 0;
+	for (int level = 0; level < LEVELS; level++) {
+		texels += size_t(TILE_SIZE >> level) * size_t(TILE_SIZE >> level);
+	}
+	return size_t(mAtlasCapacity) * texels * canvas_format_info(mFormat).bytesPerPixel;
+}
@@ -0,0 +1,157 @@
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <span>
+#include <vector>
+
+#include <glad/gl.h>
+
+#include "terrapainter/math.h"
+
+#include "canvas_format.h"
+
+struct CanvasRegion;
+class Program;
+
+// The canvas's pixels, stored as a table of square tiles.
+//
+// Tiles which are a single solid color (i.e. everything on a blank canvas)
+// are just that color in the table, and cost no GPU memory. The rest are
+// "resident" and each get a layer of an array texture, the atlas.
+// Shaders find a pixel through two small indirection textures, one holding
+// each tile's atlas layer (or -1 if it's uniform) and one holding the colors
+// of the uniform tiles. Every shader which touches the canvas has a copy of
+// the same canvas_fetch/canvas_store functions, see paint_composite.comp.
+//
+// Tiles become resident the first time a stroke touches them, and stay that
+// way until the canvas is replaced, so memory is proportional to how much of
+// the canvas has been painted on.
+//
+// Each layer has a full mip chain, so the canvas display can sample a
+// zoomed out canvas without aliasing. Tiles are aligned at every level, so
+// no level ever mixes texels from two tiles. Whoever modifies the canvas
+// calls update_mips with the region they touched, and only that is rebuilt.
+// (The mips are for display only, nothing else has to keep them current.)
+class VirtualCanvas {
+public:
+	// Must match CANVAS_TILE_SIZE in the shaders. A multiple of
+	// CanvasHistory::TILE_SIZE, so history tiles never straddle two of these.
+	// GL 4 guarantees at least 2048 atlas layers, i.e. a fully resident
+	// canvas of about 23000x23000, see fits().
+	static constexpr int TILE_SIZE = 512;
+	// Each layer's mip chain goes all the way down to 1x1
+	static constexpr int LEVELS = 10;
+	static_assert(1 << (LEVELS - 1) == TILE_SIZE);
+
+	// Where a canvas pixel lives in the atlas
+	struct Location {
+		GLint layer;
+		ivec2 offset;
+	};
+	// A rectangle of canvas pixels to read back, and where its pixels go
+	struct Readback {
+		ivec2 origin;
+		ivec2 size;
+		// Byte offset into the pack buffer
+		size_t offset;
+	};
+private:
+	// The dimensions & format of the canvas
+	ivec2 mCanvasSize;
+	CanvasFormat mFormat;
+	// The number of tiles along each axis
+	ivec2 mTileCount;
+	// Atlas layer of each tile, or -1 if it's uniform
+	std::vector<GLint> mLayers;
+	// Color of each uniform tile as 16 bit unorm RGBA. This is what sampling
+	// the atlas would return, so single channel tiles are (v, v, v, 1).
+	std::vector<std::array<uint16_t, 4>> mFills;
+	// GPU copies of mLayers (R32I) & mFills (RGBA16), one texel per tile
+	GLuint mLayerTable;
+	GLuint mFillTable;
+	// Zero until some tile becomes resident
+	GLuint mAtlas;
+	int mAtlasCapacity;
+	int mResidentCount;
+	// Used to attach atlas layers for glReadPixels
+	GLuint mReadFramebuffer;
+	// Builds each mip level from the one before it
+	Program* mDownsampleProgram;
+
+	void upload_tables();
+	// Makes sure the atlas has room for `layers` layers
+	void reserve(int layers);
+	// Converts a pixel in the canvas format to a fill color
+	std::array<uint16_t, 4> fill_of(const uint8_t* pixel) const;
+public:
+	VirtualCanvas();
+	~VirtualCanvas() noexcept;
+
+	VirtualCanvas(const VirtualCanvas&) = delete;
+	VirtualCanvas& operator=(const VirtualCanvas&) = delete;
+
+	// Whether a canvas this big still fits once every tile is resident,
+	// i.e. the atlas has a layer for each tile and the tables fit a texture
+	static bool fits(ivec2 canvasSize);
+
+	// Replaces the whole canvas. `pixels` is tightly packed, in the layout
+	// given by canvas_format_info(format). If it's null, the canvas is
+	// opaque black, which doesn't make a single tile resident.
+	void reset(ivec2 canvasSize, CanvasFormat format, const void* pixels);
+	// reset() a row of tiles at a time, for images too big to want in memory
+	// all at once. begin_upload() makes a blank canvas, each row of tiles is
+	// then handed over bottom to top, and end_upload() builds the mips.
+	void begin_upload(ivec2 canvasSize, CanvasFormat format);
+	// `rows` points to each canvas row of tile row `tileY`, bottom to top,
+	// and is only used to find the uniform tiles. The rest are uploaded from
+	// `unpack`, which holds the same rows back to back: either host memory,
+	// or an offset into the buffer bound to GL_PIXEL_UNPACK_BUFFER.
+	void upload_tile_row(int tileY, std::span<const uint8_t* const> rows, const void* unpack);
+	void end_upload();
+	// Replaces the whole canvas with mip `level` of `source`, i.e. a copy
+	// 2^level times smaller along each axis. Only resident source tiles
+	// cost anything. The source's mips must be up to date.
+	void reset_downsampled(const VirtualCanvas& source, int level);
+	// Gives every tile overlapping `region` its own atlas layer, so that
+	// shaders can write to it.
+	void make_resident(const CanvasRegion& region);
+	// Rebuilds the mips of the resident tiles within `region`, after
+	// the base level has been modified there
+	void update_mips(const CanvasRegion& region);
+	// Finds the canvas pixel `coords`, which must be in a resident tile
+	Location locate(ivec2 coords) const;
+	// Reads back the whole canvas, see glReadPixels for `format` & `type`.
+	// Only the canvas's native layout, and GL_RED/GL_FLOAT, are supported.
+	void read(GLenum format, GLenum type, void* pixels) const;
+	// Queues reads of each rectangle into the buffer bound to
+	// GL_PIXEL_PACK_BUFFER, tightly packed in the canvas format. Each one
+	// must lie within a single resident tile. Returns right away, so fence
+	// the reads to know when the pixels have landed.
+	void read_into_buffer(std::span<const Readback> pieces) const;
+
+	// Binds the canvas for a shader's canvas_fetch. The atlas, layer table
+	// fill table and canvas size go at `location` onwards, and the textures
+	// take up texture units `unit` to `unit + 2`.
+	void bind(GLint location, GLuint unit) const;
+	// Binds the atlas for a shader's canvas_store
+	void bind_image(GLuint binding, GLenum access) const;
+
+	// The GL_TEXTURE_2D_ARRAY holding the resident tiles. This can change
+	// whenever a tile becomes resident.
+	GLuint atlas() const { return mAtlas; }
+	ivec2 size() const { return mCanvasSize; }
+	CanvasFormat format() const { return mFormat; }
+	size_t tile_count() const { return mLayers.size(); }
+	// The number of tiles along each axis. Tiles are indexed row by row,
+	// from the bottom left.
+	ivec2 tile_grid() const { return mTileCount; }
+	// Atlas layer of tile `index`, or -1 if it's uniform
+	GLint tile_layer(size_t index) const { return mLayers[index]; }
+	// Writes the color of uniform tile `index` as a single pixel in the
+	// canvas format
+	void tile_fill(size_t index, uint8_t* pixel) const;
+	size_t resident_count() const { return size_t(mResidentCount); }
+	// VRAM used by the atlas, including mips & room it hasn't used yet
+	size_t memory_usage() const;
+};
@@ -139,7 +139,7 @@ void World::render(ivec2 viewportSize)
         mLastViewportSize = viewportSize;
     }
 
-    const mat4 view = mActiveCamera->world_transform().inverse();
+    const mat4 view = mActiveCamera->world_transform().affine_inverse();
     const mat4 viewProj = mActiveCamera->projection() * view;
     const vec4 viewPosH = mActiveCamera->position().hmg();
     const vec3 viewPos(viewPosH.x, viewPosH.y, viewPosH.z);
@@ -0,0 +1,121 @@
+#include <cstring>
+#include <string>
+#include <vector>
+#include <catch2/catch_test_macros.hpp>
+#include "terrapainter/heightmap_formats.h"
+#include "test_helpers.h"
+
+using Format = HeightmapEncoder::Format;
+
+namespace {
+	// Heights in canvas order (bottom to top), written in the format's order
+	std::vector<uint8_t> encode(const std::vector<uint16_t>& heights, size_t w, size_t h, Format format) {
+		std::vector<uint16_t> ordered;
+		bool bottomUp = HeightmapEncoder::bottom_up(format);
+		for (size_t i = 0; i < h; i++) {
+			size_t y = bottomUp ? i : h - 1 - i;
+			ordered.insert(ordered.end(), heights.begin() + y * w, heights.begin() + (y + 1) * w);
+		}
+		return test::encode_rows<HeightmapEncoder>(ordered, w, 1, format, w, h);
+	}
+	std::vector<uint16_t> ramp(size_t w, size_t h) {
+		std::vector<uint16_t> heights(w * h);
+		for (size_t i = 0; i < heights.size(); i++) heights[i] = uint16_t(i * 4099 + i / 7);
+		// Both ends of the range
+		heights.front() = 0;
+		heights.back() = 65535;
+		return heights;
+	}
+	void put_f32(std::vector<uint8_t>& out, float value, bool little) {
+		uint32_t bits;
+		memcpy(&bits, &value, sizeof(bits));
+		for (int i = 0; i < 4; i++) out.push_back(uint8_t(bits >> ((little ? i : 3 - i) * 8)));
+	}
+}
+
+TEST_CASE("Heightmap formats round trip", "[heightmap_formats]") {
+	for (auto format : { Format::RAW16, Format::PFM, Format::TIFF }) {
+		// Raw files have no header, they have to be square to read back
+		size_t w = format == Format::RAW16 ? 37 : 53, h = 37;
+		auto heights = ramp(w, h);
+		auto file = encode(heights, w, h, format);
+		size_t dw, dh;
+		std::vector<uint16_t> decoded;
+		float low, high;
+		REQUIRE(HeightmapEncoder::decode(format, file, dw, dh, decoded, low, high));
+		REQUIRE(dw == w);
+		REQUIRE(dh == h);
+		REQUIRE(low == 0.0f);
+		REQUIRE(high == 1.0f);
+		// Floats hold every 16 bit height exactly
+		REQUIRE(decoded == heights);
+	}
+}
+
+TEST_CASE("Heightmap formats read other tools' files", "[heightmap_formats]") {
+	size_t w, h;
+	std::vector<uint16_t> heights;
+	float low, high;
+	SECTION("Raw files are little endian, top to bottom") {
+		std::vector<uint8_t> file = { 0x01, 0x00, 0x02, 0x00, 0x03, 0x00, 0x04, 0x01 };
+		REQUIRE(HeightmapEncoder::decode(Format::RAW16, file, w, h, heights, low, high));
+		REQUIRE(w == 2);
+		REQUIRE(heights == std::vector<uint16_t>{ 3, 0x104, 1, 2 });
+		file.pop_back();
+		REQUIRE_FALSE(HeightmapEncoder::decode(Format::RAW16, file, w, h, heights, low, high));
+	}
+	SECTION("Big endian PFM elevations are rescaled") {
+		std::string header = "Pf\n3 1\n1.0\n";
+		std::vector<uint8_t> file(header.begin(), header.end());
+		for (float value : { -50.0f, 150.0f, 100.0f }) put_f32(file, value, false);
+		REQUIRE(HeightmapEncoder::decode(Format::PFM, file, w, h, heights, low, high));
+		REQUIRE(low == -50.0f);
+		REQUIRE(high == 150.0f);
+		REQUIRE(heights == std::vector<uint16_t>{ 0, 65535, 49151 });
+	}
+	SECTION("Big endian 16 bit TIFF in several strips") {
+		std::vector<uint8_t> file = { 'M', 'M', 0, 42, 0, 0, 0, 8, 0, 6 };
+		auto entry = [&](uint16_t tag, uint16_t type, uint32_t count, uint32_t value) {
+			uint8_t bytes[12] = { uint8_t(tag >> 8), uint8_t(tag), 0, uint8_t(type), 0, 0, uint8_t(count >> 8), uint8_t(count) };
+			// Inline SHORTs are left justified
+			if (type == 3 && count == 1) value <<= 16;
+			for (int i = 0; i < 4; i++) bytes[8 + i] = uint8_t(value >> ((3 - i) * 8));
+			file.insert(file.end(), bytes, bytes + 12);
+		};
+		// 2 x 3, two rows per strip, the strip offsets out of line
+		size_t data = 10 + 6 * 12 + 4;
+		entry(256, 3, 1, 2);
+		entry(257, 3, 1, 3);
+		entry(258, 3, 1, 16);
+		entry(273, 4, 2, uint32_t(data));
+		entry(278, 3, 1, 2);
+		entry(279, 4, 2, 0);
+		file.insert(file.end(), 4, 0);
+		uint32_t strips[2] = { uint32_t(data + 8), uint32_t(data + 8 + 8) };
+		for (uint32_t offset : strips) {
+			for (int i = 0; i < 4; i++) file.push_back(uint8_t(offset >> ((3 - i) * 8)));
+		}
+		for (uint16_t value : { 1, 2, 3, 4, 5, 6 }) {
+			file.push_back(uint8_t(value >> 8));
+			file.push_back(uint8_t(value));
+		}
+		REQUIRE(HeightmapEncoder::decode(Format::TIFF, file, w, h, heights, low, high));
+		REQUIRE(w == 2);
+		REQUIRE(h == 3);
+		REQUIRE(heights == std::vector<uint16_t>{ 5, 6, 3, 4, 1, 2 });
+		// Cut short
+		file.pop_back();
+		REQUIRE_FALSE(HeightmapEncoder::decode(Format::TIFF, file, w, h, heights, low, high));
+	}
+	SECTION("Garbage") {
+		std::vector<uint8_t> file(100, 'x');
+		REQUIRE_FALSE(HeightmapEncoder::decode(Format::PFM, file, w, h, heights, low, high));
+		REQUIRE_FALSE(HeightmapEncoder::decode(Format::TIFF, file, w, h, heights, low, high));
+	}
+}
+
+TEST_CASE("TIFFs over 4GB don't fit", "[heightmap_formats]") {
+	REQUIRE(HeightmapEncoder::fits(Format::TIFF, 32768, 32767));
+	REQUIRE_FALSE(HeightmapEncoder::fits(Format::TIFF, 32768, 32768));
+	REQUIRE(HeightmapEncoder::fits(Format::RAW16, 32768, 32768));
+}
@@ -0,0 +1,73 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <cmath>
+#include <vector>
+#include <stb/stb_image_write.h>
+#include "terrapainter/png_encoder.h"
+#include "terrapainter/qoi.h"
+#include "terrapainter/thread_pool.h"
+#include "test_helpers.h"
+
+// These are hidden by default; run them with `terrapainter_tests [benchmark]`.
+// Every run encodes a whole image, so pass something like
+// `--benchmark-samples 5` unless you have a lot of time for the 8k ones.
+
+namespace {
+	// Something like a painted heightmap: smooth hills, a few flat areas and
+	// a little noise, as gray and as RGBA
+	std::vector<uint8_t> terrain(size_t size, size_t channels) {
+		std::vector<uint8_t> pixels(size * size * channels);
+		test::Lcg rng(1);
+		for (size_t y = 0; y < size; y++) {
+			for (size_t x = 0; x < size; x++) {
+				float u = float(x) / float(size), v = float(y) / float(size);
+				float height = 0.5f + 0.25f * std::sin(u * 9.0f) * std::cos(v * 7.0f) + 0.125f * std::sin((u + v) * 31.0f);
+				height = std::max(height, 0.35f);
+				uint8_t value = uint8_t(std::min(255.0f, height * 250.0f + float(rng.next() >> 30)));
+				uint8_t* px = &pixels[(y * size + x) * channels];
+				for (size_t c = 0; c < channels; c++) px[c] = c == 3 ? 255 : uint8_t(value * (c + 1) / channels);
+			}
+		}
+		return pixels;
+	}
+
+	size_t png(const std::vector<uint8_t>& pixels, size_t size, size_t channels, PngEncoder::Level level, ThreadPool* pool) {
+		size_t bytes = 0;
+		PngEncoder encoder([&](std::span<const uint8_t> data) { bytes += data.size(); return true; }, size, size, channels, level, pool);
+		encoder.write_rows(pixels);
+		encoder.finish();
+		return bytes;
+	}
+	size_t qoi(const std::vector<uint8_t>& pixels, size_t size) {
+		size_t bytes = 0;
+		QoiEncoder encoder([&](std::span<const uint8_t> data) { bytes += data.size(); return true; }, size, size, 4);
+		encoder.write_rows(pixels);
+		encoder.finish();
+		return bytes;
+	}
+	size_t stb(const std::vector<uint8_t>& pixels, size_t size, size_t channels) {
+		size_t bytes = 0;
+		stbi_write_png_to_func([](void* context, void*, int count) { *static_cast<size_t*>(context) += size_t(count); },
+			&bytes, int(size), int(size), int(channels), pixels.data(), int(size * channels));
+		return bytes;
+	}
+}
+
+TEST_CASE("Benchmark canvas export", "[.][benchmark]") {
+	ThreadPool pool;
+	for (size_t size : { 2048, 4096, 8192 }) {
+		auto label = [&](const char* what) { return std::to_string(size) + " " + what; };
+		auto gray = terrain(size, 1);
+		BENCHMARK(label("gray: stb_image_write")) { return stb(gray, size, 1); };
+		BENCHMARK(label("gray: PngEncoder")) { return png(gray, size, 1, PngEncoder::Level::DEFAULT, nullptr); };
+		BENCHMARK(label("gray: PngEncoder, threaded")) { return png(gray, size, 1, PngEncoder::Level::DEFAULT, &pool); };
+		BENCHMARK(label("gray: PngEncoder, fast & threaded")) { return png(gray, size, 1, PngEncoder::Level::FAST, &pool); };
+		gray = {};
+
+		auto color = terrain(size, 4);
+		BENCHMARK(label("RGBA: stb_image_write")) { return stb(color, size, 4); };
+		BENCHMARK(label("RGBA: PngEncoder, threaded")) { return png(color, size, 4, PngEncoder::Level::DEFAULT, &pool); };
+		BENCHMARK(label("RGBA: PngEncoder, fast & threaded")) { return png(color, size, 4, PngEncoder::Level::FAST, &pool); };
+		BENCHMARK(label("RGBA: QOI")) { return qoi(color, size); };
+	}
+}
@@ -0,0 +1,47 @@
+#include <cstdio>
+#include <filesystem>
+#include <vector>
+#include <catch2/catch_test_macros.hpp>
+#include "terrapainter/mapped_file.h"
+
+namespace {
+	std::string write_temp(const char* name, const std::vector<uint8_t>& bytes) {
+		auto path = (std::filesystem::temp_directory_path() / name).string();
+		FILE* file = fopen(path.c_str(), "wb");
+		REQUIRE(file);
+		if (!bytes.empty()) REQUIRE(fwrite(bytes.data(), 1, bytes.size(), file) == bytes.size());
+		fclose(file);
+		return path;
+	}
+}
+
+TEST_CASE("Mapped files", "[mapped_file]") {
+	MappedFile file;
+	SECTION("Holds the file's bytes") {
+		std::vector<uint8_t> bytes(100000);
+		for (size_t i = 0; i < bytes.size(); i++) bytes[i] = uint8_t(i * 31 + i / 256);
+		auto path = write_temp("terrapainter_mapped_file_test", bytes);
+		REQUIRE(file.open(path));
+		REQUIRE(file.is_open());
+		// Anywhere in the file, including an unaligned tail
+		file.prefetch(4097, 100000);
+		file.prefetch(200000, 5);
+		auto mapped = file.bytes();
+		REQUIRE(std::vector<uint8_t>(mapped.begin(), mapped.end()) == bytes);
+		file.close();
+		REQUIRE_FALSE(file.is_open());
+		REQUIRE(file.bytes().empty());
+		std::filesystem::remove(path);
+	}
+	SECTION("Empty files have no bytes") {
+		auto path = write_temp("terrapainter_mapped_file_empty", {});
+		REQUIRE(file.open(path));
+		REQUIRE(file.bytes().empty());
+		file.close();
+		std::filesystem::remove(path);
+	}
+	SECTION("Missing files don't open") {
+		REQUIRE_FALSE(file.open((std::filesystem::temp_directory_path() / "terrapainter_no_such_file").string()));
+		REQUIRE_FALSE(file.is_open());
+	}
+}
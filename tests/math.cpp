@@ -1,6 +1,10 @@
 #include <cfloat>
+#include <algorithm>
+#include <string>
+#include <vector>
 #include <catch2/catch_test_macros.hpp>
 #include "terrapainter/math.h"
+#include "terrapainter/scene/camera.h"
 TEST_CASE("Vector constructors/splats", "[linalg]") {
 	vec4 splat = vec4::splat(7.0);
 	REQUIRE( (splat.x == 7.0 && splat[0] == 7.0) );
@@ -884,6 +888,64 @@ TEST_CASE("Matrix inverse", "[linalg]") {
 			0.220872, -0.369961, -1.44174
 		};
 		REQUIRE(aeq(r3.inverse(), r3_inv, 1e6f));
+
+		mat4 r4 = {
+			0.426719, 0.0979894, 0.57436, 0.88369,
+			0.30224, 0.00128982, 0.805764, 0.808081,
+			0.898543, 0.798784, 0.898152, 0.882801,
+			0.343767, 0.622619, 0.583506, 0.264387
+		};
+		REQUIRE(aeq(r4.inverse(), r4.gauss_jordan_inverse(), 1e-4f));
+		REQUIRE(aeq(r4 * r4.inverse(), mat4::ident(), 1e-5f));
+		REQUIRE(aeq(r4.determinant() * r4.inverse().determinant(), 1.0f, 1e-5f));
+	}
+	SECTION("Closed form matches Gauss-Jordan") {
+		mat3 m3 = {
+			2, -1, 0,
+			-1, 2, -1,
+			0, -1, 2
+		};
+		REQUIRE(aeq(m3.inverse(), m3.gauss_jordan_inverse(), 1e-6f));
+		mat4 m4 = {
+			4, 7, 2, 3,
+			0, 5, 0, 1,
+			1, 0, 6, 2,
+			3, 1, 0, 8
+		};
+		REQUIRE(aeq(m4.inverse(), m4.gauss_jordan_inverse(), 1e-6f));
+		REQUIRE(aeq(m4 * m4.inverse(), mat4::ident(), 1e-6f));
+	}
+	SECTION("Constant evaluation") {
+		constexpr mat4 m = {
+			2, 0, 0, 0,
+			0, 4, 0, 0,
+			0, 0, 8, 0,
+			0, 0, 0, 1
+		};
+		constexpr mat4 inv = m.inverse();
+		static_assert(inv == mat4::diag(0.5f, 0.25f, 0.125f, 1.0f));
+		static_assert(m.determinant() == 64);
+	}
+}
+
+TEST_CASE("Matrix affine/rigid inverse", "[linalg]") {
+	mat4 r = mat3::rotate_xyz(0.3f, -1.1f, 2.4f).hmg();
+	mat4 t = mat4::translate_hmg(vec3{ 5, -2, 7.5 });
+	SECTION("Affine") {
+		mat4 s = mat4::diag(2.0f, 0.5f, 3.0f, 1.0f);
+		mat4 trs = t * r * s;
+		REQUIRE(aeq(trs.affine_inverse(), trs.inverse(), 1e-5f));
+		REQUIRE(aeq(trs * trs.affine_inverse(), mat4::ident(), 1e-5f));
+		REQUIRE(trs.affine_inverse().row(3) == vec4{ 0, 0, 0, 1 });
+
+		mat3 t2 = mat3::translate_hmg(vec2{ 3, 4 });
+		REQUIRE(aeq(t2.affine_inverse(), mat3::translate_hmg(vec2{ -3, -4 })));
+	}
+	SECTION("Rigid") {
+		mat4 tr = t * r;
+		REQUIRE(aeq(tr.rigid_inverse(), tr.inverse(), 1e-5f));
+		REQUIRE(aeq(tr.rigid_inverse(), tr.affine_inverse(), 1e-5f));
+		REQUIRE(aeq(tr * tr.rigid_inverse(), mat4::ident(), 1e-5f));
 	}
 }
 TEST_CASE("Matrix convenience constructors", "[linalg]") {
@@ -932,4 +994,311 @@ TEST_CASE("Matrix rotation", "[linalg]") {
 	// TODO: Write an actual test case for 3D
 	// I *GUARANTEE* you there's a bug lurking somewhere
 	REQUIRE(aeq(mat3::rotate_xyz(1, -2, 3).determinant(), 1.0f));
-}
\ No newline at end of file
+}
+
+TEST_CASE("SIMD agrees with constant evaluation", "[linalg]") {
+	// The constexpr variables below are always computed by the scalar code,
+	// the runtime ones go through the SIMD backend (if there is one).
+	constexpr vec4 a = { 0.5, -16.2, 30.7, 29.99 };
+	constexpr vec4 b = { -12, 4, 0.25, -65 };
+	constexpr mat4 m = {
+		0.426719, 0.0979894, 0.57436, 0.88369,
+		0.30224, -0.00128982, 0.805764, 0.808081,
+		-0.898543, 0.798784, 12.898152, 0.882801,
+		0.343767, 0.622619, 0.583506, -0.264387
+	};
+	constexpr mat4 n = {
+		1, 0, 0, 7,
+		0, 0, -1, -2,
+		0, 2, 0, 0.5,
+		0, 0, 0, 1
+	};
+	static_assert(mat4::ident() * vec4{ 1, 2, 3, 4 } == vec4{ 1, 2, 3, 4 });
+	static_assert((mat4::ident() * mat4::scale(3)).transpose() == mat4::scale(3));
+
+	SECTION("Vector arithmetic") {
+		constexpr vec4 sum = a + b, diff = a - b, prod = a * b, quot = a / b, scaled = a * 3;
+		vec4 rt_a = a, rt_b = b;
+		REQUIRE(rt_a + rt_b == sum);
+		REQUIRE(rt_a - rt_b == diff);
+		REQUIRE(rt_a * rt_b == prod);
+		REQUIRE(rt_a / rt_b == quot);
+		REQUIRE(rt_a * 3 == scaled);
+		rt_a += rt_b;
+		REQUIRE(rt_a == sum);
+	}
+	SECTION("Dot product") {
+		constexpr float ab = dot(a, b);
+		vec4 rt_a = a, rt_b = b;
+		REQUIRE(aeq(dot(rt_a, rt_b), ab));
+	}
+	SECTION("Matrix-vector multiply") {
+		constexpr vec4 ma = m * a;
+		mat4 rt_m = m;
+		vec4 rt_a = a;
+		REQUIRE(aeq(rt_m * rt_a, ma, 1e-6f));
+		REQUIRE(aeq(mat4::ident() * rt_a, rt_a));
+	}
+	SECTION("Matrix-matrix multiply") {
+		constexpr mat4 mn = m * n, nm = n * m;
+		mat4 rt_m = m, rt_n = n;
+		REQUIRE(aeq(rt_m * rt_n, mn, 1e-6f));
+		REQUIRE(aeq(rt_n * rt_m, nm, 1e-6f));
+		REQUIRE(rt_m * mat4::ident() == rt_m);
+		REQUIRE(mat4::ident() * rt_m == rt_m);
+	}
+	SECTION("Transpose") {
+		constexpr mat4 mt = m.transpose();
+		mat4 rt_m = m;
+		REQUIRE(rt_m.transpose() == mt);
+		REQUIRE(rt_m.transpose().transpose() == rt_m);
+	}
+}
+
+TEST_CASE("Batched SoA operations", "[linalg]") {
+	// Odd sizes so both the SIMD loop and the scalar tail get exercised
+	for (size_t count : { 0, 1, 3, 4, 7, 33 }) {
+		std::vector<float> ax(count), ay(count), az(count), bx(count), by(count), bz(count);
+		for (size_t i = 0; i < count; i++) {
+			float f = static_cast<float>(i);
+			ax[i] = 0.5f * f - 3.0f; ay[i] = std::sin(f) * 4.0f; az[i] = 1.0f / (f + 1.0f);
+			bx[i] = std::cos(f * 0.7f); by[i] = f * f * 0.01f; bz[i] = -2.0f + 0.25f * f;
+		}
+		math::batch::csoa3 a = { ax, ay, az };
+		math::batch::csoa3 b = { bx, by, bz };
+		auto vec_a = [&](size_t i) { return vec3(ax[i], ay[i], az[i]); };
+		auto vec_b = [&](size_t i) { return vec3(bx[i], by[i], bz[i]); };
+
+		std::vector<float> ox(count), oy(count), oz(count);
+		math::batch::soa3 out = { ox, oy, oz };
+		auto vec_out = [&](size_t i) { return vec3(ox[i], oy[i], oz[i]); };
+
+		SECTION("Dot/cross, count " + std::to_string(count)) {
+			std::vector<float> dots(count);
+			math::batch::dot(a, b, dots);
+			math::batch::cross(a, b, out);
+			for (size_t i = 0; i < count; i++) {
+				REQUIRE(aeq(dots[i], dot(vec_a(i), vec_b(i)), 1e-5f));
+				REQUIRE(aeq(vec_out(i), cross(vec_a(i), vec_b(i)), 1e-5f));
+			}
+		}
+		SECTION("Transform, count " + std::to_string(count)) {
+			mat4 m = mat4::translate_hmg(vec3(1, -2, 3))
+				* mat3::rotate_xyz(0.4f, 1.3f, -2.2f).hmg()
+				* mat4::diag(2.0f, 1.0f, 0.5f, 1.0f);
+			math::batch::transform_points(m, a, out);
+			for (size_t i = 0; i < count; i++) {
+				REQUIRE(aeq(vec_out(i), (m * vec_a(i).hmg()).template slice<0, 3>(), 1e-5f));
+			}
+			math::batch::transform_vectors(m, a, out);
+			for (size_t i = 0; i < count; i++) {
+				REQUIRE(aeq(vec_out(i), (m * vec4(ax[i], ay[i], az[i], 0)).template slice<0, 3>(), 1e-5f));
+			}
+			// In-place
+			math::batch::transform_points(m, out, out);
+			for (size_t i = 0; i < count; i++) {
+				vec4 v = m * vec4(ax[i], ay[i], az[i], 0);
+				v.w = 1;
+				REQUIRE(aeq(vec_out(i), (m * v).template slice<0, 3>(), 1e-5f));
+			}
+		}
+		SECTION("TRS, count " + std::to_string(count)) {
+			// Large angles, to check range reduction in the SIMD sin/cos
+			std::vector<float> rx(count), ry(count), rz(count);
+			for (size_t i = 0; i < count; i++) {
+				float f = static_cast<float>(i);
+				rx[i] = f * 1.37f - 20.0f; ry[i] = -f * 3.1f; rz[i] = f * 0.25f + 100.0f;
+			}
+			std::vector<mat4> mats(count);
+			math::batch::build_trs(b, { rx, ry, rz }, a, mats);
+			for (size_t i = 0; i < count; i++) {
+				mat4 expected = mat4::translate_hmg(vec_b(i))
+					* mat3::rotate_xyz(rx[i], ry[i], rz[i]).hmg()
+					* mat4::diag(ax[i], ay[i], az[i], 1.0f);
+				REQUIRE(aeq(mats[i], expected, 1e-5f));
+			}
+		}
+	}
+}
+
+TEST_CASE("Quaternions", "[linalg]") {
+	SECTION("Identity") {
+		REQUIRE(quat::ident().to_mat3() == mat3::ident());
+		REQUIRE(quat::ident() * quat::ident() == quat::ident());
+		REQUIRE(quat::ident().rotate(vec3(1, 2, 3)) == vec3(1, 2, 3));
+	}
+	SECTION("Matches rotate_xyz") {
+		for (vec3 a : { vec3(0, 0, 0), vec3(0.3f, -1.1f, 2.4f), vec3(-2.0f, 0.7f, -0.2f), vec3(1.0f, 1.5707f, 3.0f) }) {
+			quat q = quat::rotate_xyz(a.x, a.y, a.z);
+			mat3 m = mat3::rotate_xyz(a.x, a.y, a.z);
+			REQUIRE(aeq(q.to_mat3(), m, 1e-5f));
+			REQUIRE(aeq(q.to_mat4(), m.hmg(), 1e-5f));
+			vec3 v = { 0.5f, -2.0f, 1.25f };
+			REQUIRE(aeq(q.rotate(v), m * v, 1e-5f));
+			// Angles round-trip through the quaternion
+			vec3 back = q.to_angles_xyz();
+			REQUIRE(aeq(mat3::rotate_xyz(back.x, back.y, back.z), m, 1e-3f));
+		}
+	}
+	SECTION("Multiplication composes like matrices") {
+		quat a = quat::rotate_xyz(0.3f, -1.1f, 2.4f);
+		quat b = quat::axis_angle(vec3(0, 0.6f, 0.8f), 0.9f);
+		REQUIRE(aeq((a * b).to_mat3(), a.to_mat3() * b.to_mat3(), 1e-5f));
+		REQUIRE(aeq(a * a.conjugate(), quat::ident(), 1e-6f));
+
+		// Runtime (maybe SIMD) product agrees with the constant evaluated one
+		constexpr quat ca = { 0.1f, 0.2f, 0.3f, 0.927362f };
+		constexpr quat cb = { -0.5f, 0.5f, 0.5f, 0.5f };
+		constexpr quat cab = ca * cb;
+		quat ra = ca, rb = cb;
+		REQUIRE(aeq(ra * rb, cab, 1e-6f));
+	}
+	SECTION("Interpolation") {
+		quat a = quat::axis_angle(vec3(0, 0, 1), 0.2f);
+		quat b = quat::axis_angle(vec3(0, 0, 1), 1.4f);
+		REQUIRE(aeq(slerp(a, b, 0.0f), a, 1e-6f));
+		REQUIRE(aeq(slerp(a, b, 1.0f), b, 1e-6f));
+		REQUIRE(aeq(slerp(a, b, 0.25f), quat::axis_angle(vec3(0, 0, 1), 0.5f), 1e-6f));
+		// Takes the shorter arc even when the signs disagree
+		quat negB = quat(-b.x(), -b.y(), -b.z(), -b.w());
+		REQUIRE(aeq(slerp(a, negB, 0.5f), quat::axis_angle(vec3(0, 0, 1), 0.8f), 1e-6f));
+		// nlerp agrees at the midpoint
+		REQUIRE(aeq(nlerp(a, negB, 0.5f), quat::axis_angle(vec3(0, 0, 1), 0.8f), 1e-6f));
+	}
+}
+
+namespace {
+	// A view-projection matrix built the same way World::render does
+	mat4 test_view_proj(vec3 position, vec3 angles) {
+		Camera camera(position, angles, 1.4f, ivec2(1280, 720), vec2(0.5f, 200.0f));
+		return camera.projection() * camera.world_transform().affine_inverse();
+	}
+	// Signed distances (well, scaled) of p past each clip plane, in the
+	// same order as Frustum::PlaneIndex. Negative means outside.
+	std::array<float, 6> clip_margins(const mat4& viewProj, vec3 p) {
+		vec4 c = viewProj * p.hmg();
+		return { c.w + c.x, c.w - c.x, c.w + c.y, c.w - c.y, c.w + c.z, c.w - c.z };
+	}
+}
+
+TEST_CASE("Frustum culling", "[linalg]") {
+	const vec3 eye = { 3, -7, 12 };
+	const mat4 viewProj = test_view_proj(eye, vec3(0.2f, 0.3f, 0.7f));
+	const Frustum frustum = Frustum::from_view_proj(viewProj);
+	constexpr float EPS = 1e-3f;
+
+	SECTION("Points agree with clip space") {
+		size_t inside = 0;
+		for (float x = -200; x <= 200; x += 8) {
+			for (float y = -200; y <= 200; y += 8) {
+				for (float z = -200; z <= 200; z += 8) {
+					vec3 p = eye + vec3(x, y, z);
+					auto margins = clip_margins(viewProj, p);
+					float worst = *std::min_element(margins.begin(), margins.end());
+					if (std::abs(worst) < EPS) continue;
+					REQUIRE(frustum.contains(p) == (worst > 0));
+					inside += worst > 0;
+				}
+			}
+		}
+		// Make sure the test actually tested something
+		REQUIRE(inside > 100);
+	}
+	SECTION("Boxes are culled exactly when one plane separates them") {
+		size_t counts[3] = {};
+		for (float x = -220; x <= 220; x += 11) {
+			for (float y = -220; y <= 220; y += 11) {
+				for (float z = -220; z <= 220; z += 11) {
+					vec3 extents = { 1.0f + std::fmod(std::abs(x), 7.0f), 2.0f, 0.5f + std::fmod(std::abs(z), 13.0f) };
+					AABB box = AABB::from_center_extents(eye + vec3(x, y, z), extents);
+					bool separated = false, allInside = true, borderline = false;
+					for (size_t plane = 0; plane < 6; plane++) {
+						bool allOutside = true;
+						for (int corner = 0; corner < 8; corner++) {
+							vec3 p = {
+								corner & 1 ? box.max.x : box.min.x,
+								corner & 2 ? box.max.y : box.min.y,
+								corner & 4 ? box.max.z : box.min.z
+							};
+							float margin = clip_margins(viewProj, p)[plane];
+							borderline |= std::abs(margin) < EPS;
+							allOutside &= margin < 0;
+							allInside &= margin > 0;
+						}
+						separated |= allOutside;
+					}
+					if (borderline) continue;
+					Containment expected = separated ? Containment::Outside
+						: allInside ? Containment::Inside
+						: Containment::Intersecting;
+					REQUIRE(frustum.classify(box) == expected);
+					counts[static_cast<int>(expected)]++;
+				}
+			}
+		}
+		REQUIRE(counts[0] > 100);
+		REQUIRE(counts[1] > 100);
+		REQUIRE(counts[2] > 100);
+	}
+	SECTION("Spheres") {
+		const Plane& nearPlane = frustum.planes[Frustum::NEAR_PLANE];
+		vec3 ahead = eye - nearPlane.normal * nearPlane.signed_distance(eye) + 10.0f * nearPlane.normal;
+		REQUIRE(frustum.classify(Sphere{ ahead, 1.0f }) == Containment::Inside);
+		REQUIRE(frustum.classify(Sphere{ eye, 1.0f }) == Containment::Intersecting);
+		REQUIRE(frustum.classify(Sphere{ eye - 10.0f * nearPlane.normal, 1.0f }) == Containment::Outside);
+		REQUIRE(frustum.classify(Sphere{ eye - 10.0f * nearPlane.normal, 11.0f }) == Containment::Intersecting);
+	}
+	SECTION("Transformed boxes contain the transformed corners") {
+		AABB box = { vec3(-1, -2, -3), vec3(4, 5, 6) };
+		mat4 m = mat4::translate_hmg(vec3(10, 0, -5)) * quat::rotate_xyz(0.4f, 1.2f, -0.3f).to_mat4() * mat4::diag(2.0f, 1.0f, 0.5f, 1.0f);
+		AABB t = box.transformed(m);
+		for (int corner = 0; corner < 8; corner++) {
+			vec3 p = {
+				corner & 1 ? box.max.x : box.min.x,
+				corner & 2 ? box.max.y : box.min.y,
+				corner & 4 ? box.max.z : box.min.z
+			};
+			vec4 q = m * p.hmg();
+			for (size_t i = 0; i < 3; i++) {
+				REQUIRE(q[i] >= t.min[i] - 1e-4f);
+				REQUIRE(q[i] <= t.max[i] + 1e-4f);
+			}
+		}
+	}
+	SECTION("Batched tests agree with single tests") {
+		for (size_t count : { 0, 1, 2, 5, 8, 1001 }) {
+			std::vector<float> x(count), y(count), z(count), ex(count), ey(count), ez(count), radii(count);
+			std::vector<float> minX(count), minY(count), minZ(count), maxX(count), maxY(count), maxZ(count);
+			for (size_t i = 0; i < count; i++) {
+				float f = static_cast<float>(i);
+				x[i] = eye.x + 150.0f * std::sin(f * 0.37f);
+				y[i] = eye.y + 150.0f * std::sin(f * 0.91f + 1.0f);
+				z[i] = eye.z + 150.0f * std::cos(f * 0.13f);
+				ex[i] = 1.0f + std::fmod(f, 9.0f);
+				ey[i] = 1.0f + std::fmod(f, 4.0f);
+				ez[i] = 1.0f + std::fmod(f, 17.0f);
+				radii[i] = 0.5f + std::fmod(f, 23.0f);
+				minX[i] = x[i] - ex[i]; minY[i] = y[i] - ey[i]; minZ[i] = z[i] - ez[i];
+				maxX[i] = x[i] + ex[i]; maxY[i] = y[i] + ey[i]; maxZ[i] = z[i] + ez[i];
+			}
+			std::vector<uint8_t> visible(count);
+			size_t numVisible = math::batch::frustum_cull(frustum, { minX, minY, minZ }, { maxX, maxY, maxZ }, visible);
+			size_t expectedVisible = 0;
+			for (size_t i = 0; i < count; i++) {
+				bool expected = frustum.intersects(AABB{ vec3(minX[i], minY[i], minZ[i]), vec3(maxX[i], maxY[i], maxZ[i]) });
+				REQUIRE(bool(visible[i]) == expected);
+				expectedVisible += expected;
+			}
+			REQUIRE(numVisible == expectedVisible);
+
+			numVisible = math::batch::frustum_cull(frustum, { x, y, z }, radii, visible);
+			expectedVisible = 0;
+			for (size_t i = 0; i < count; i++) {
+				bool expected = frustum.intersects(Sphere{ vec3(x[i], y[i], z[i]), radii[i] });
+				REQUIRE(bool(visible[i]) == expected);
+				expectedVisible += expected;
+			}
+			REQUIRE(numVisible == expectedVisible);
+		}
+	}
+}
@@ -0,0 +1,218 @@
+#include <catch2/catch_test_macros.hpp>
+#include <catch2/benchmark/catch_benchmark.hpp>
+#include <vector>
+#include "terrapainter/math.h"
+
+// These are hidden by default; run them with `terrapainter_tests [benchmark]`.
+
+namespace {
+	// Plain nested loops over raw arrays, to show what the generic code
+	// amounts to without the SIMD specializations.
+	void naive_mul(float* out, const float* l, const float* r) {
+		for (size_t i = 0; i < 4; i++) {
+			for (size_t j = 0; j < 4; j++) {
+				float sum = 0;
+				for (size_t k = 0; k < 4; k++) sum += l[4 * i + k] * r[4 * k + j];
+				out[4 * i + j] = sum;
+			}
+		}
+	}
+
+	constexpr mat4 BENCH_MATRIX = {
+		0.426719, 0.0979894, 0.57436, 0.88369,
+		0.30224, 0.00128982, 0.805764, 0.808081,
+		0.898543, 0.798784, 0.898152, 0.882801,
+		0.343767, 0.622619, 0.583506, 0.264387
+	};
+}
+
+TEST_CASE("Benchmark mat4/vec4 SIMD", "[.][benchmark]") {
+	mat4 m = BENCH_MATRIX;
+	mat4 acc = mat4::ident();
+	vec4 v = { 1, 2, 3, 4 };
+
+	BENCHMARK("mat4 * mat4") {
+		acc = acc * m;
+		return acc;
+	};
+	BENCHMARK("mat4 * mat4 (naive loops)") {
+		mat4 out;
+		naive_mul(const_cast<float*>(out.data()), acc.data(), m.data());
+		acc = out;
+		return acc;
+	};
+	BENCHMARK("mat4 * vec4") {
+		v = m * v;
+		return v;
+	};
+	BENCHMARK("mat4 transpose") {
+		acc = acc.transpose();
+		return acc;
+	};
+	BENCHMARK("TRS chain") {
+		mat4 s = mat4::diag(2.0f, 3.0f, 4.0f, 1.0f);
+		mat4 r = mat3::rotate_xyz(0.1f, 0.2f, 0.3f).hmg();
+		mat4 t = mat4::translate_hmg(vec3{ 1, 2, 3 });
+		return t * r * s;
+	};
+}
+
+TEST_CASE("Benchmark matrix inverse", "[.][benchmark]") {
+	mat4 m = BENCH_MATRIX;
+	mat4 trs = mat4::translate_hmg(vec3{ 1, 2, 3 })
+		* mat3::rotate_xyz(0.1f, 0.2f, 0.3f).hmg()
+		* mat4::diag(2.0f, 3.0f, 4.0f, 1.0f);
+	mat4 tr = mat4::translate_hmg(vec3{ 1, 2, 3 }) * mat3::rotate_xyz(0.1f, 0.2f, 0.3f).hmg();
+	mat3 m3 = mat3::rotate_xyz(0.1f, 0.2f, 0.3f) * mat3::diag(2.0f, 3.0f, 4.0f);
+
+	BENCHMARK("mat4 determinant (closed form)") {
+		return m.determinant();
+	};
+	BENCHMARK("mat4 inverse (Gauss-Jordan)") {
+		return m.gauss_jordan_inverse();
+	};
+	BENCHMARK("mat4 inverse (closed form)") {
+		return m.inverse();
+	};
+	BENCHMARK("mat4 affine_inverse") {
+		return trs.affine_inverse();
+	};
+	BENCHMARK("mat4 rigid_inverse") {
+		return tr.rigid_inverse();
+	};
+	BENCHMARK("mat3 inverse (Gauss-Jordan)") {
+		return m3.gauss_jordan_inverse();
+	};
+	BENCHMARK("mat3 inverse (closed form)") {
+		return m3.inverse();
+	};
+}
+
+TEST_CASE("Benchmark batched SoA operations", "[.][benchmark]") {
+	constexpr size_t COUNT = 1 << 20;
+	std::vector<float> x(COUNT), y(COUNT), z(COUNT), ox(COUNT), oy(COUNT), oz(COUNT), dots(COUNT);
+	std::vector<vec3> aos(COUNT), aosOut(COUNT);
+	for (size_t i = 0; i < COUNT; i++) {
+		x[i] = static_cast<float>(i % 1000) * 0.01f;
+		y[i] = static_cast<float>(i % 777) * -0.02f;
+		z[i] = static_cast<float>(i % 313) * 0.03f;
+		aos[i] = vec3(x[i], y[i], z[i]);
+	}
+	math::batch::csoa3 in = { x, y, z };
+	math::batch::soa3 out = { ox, oy, oz };
+	mat4 m = mat4::translate_hmg(vec3{ 1, 2, 3 }) * mat3::rotate_xyz(0.1f, 0.2f, 0.3f).hmg();
+
+	BENCHMARK("transform 1M points (MVector loop)") {
+		for (size_t i = 0; i < COUNT; i++) {
+			aosOut[i] = (m * aos[i].hmg()).template slice<0, 3>();
+		}
+		return aosOut[COUNT - 1];
+	};
+	BENCHMARK("transform 1M points (batch)") {
+		math::batch::transform_points(m, in, out);
+		return ox[COUNT - 1];
+	};
+	BENCHMARK("dot 1M (MVector loop)") {
+		for (size_t i = 0; i < COUNT; i++) dots[i] = dot(aos[i], aosOut[i]);
+		return dots[COUNT - 1];
+	};
+	BENCHMARK("dot 1M (batch)") {
+		math::batch::dot(in, out, dots);
+		return dots[COUNT - 1];
+	};
+	BENCHMARK("cross 1M (MVector loop)") {
+		for (size_t i = 0; i < COUNT; i++) aosOut[i] = cross(aos[i], aosOut[i]);
+		return aosOut[COUNT - 1];
+	};
+	BENCHMARK("cross 1M (batch)") {
+		math::batch::cross(in, out, out);
+		return ox[COUNT - 1];
+	};
+
+	constexpr size_t TRS_COUNT = 1 << 16;
+	std::vector<mat4> mats(TRS_COUNT);
+	math::batch::csoa3 trsIn = { std::span(x).first(TRS_COUNT), std::span(y).first(TRS_COUNT), std::span(z).first(TRS_COUNT) };
+	BENCHMARK("build 64K TRS matrices (MMatrix loop)") {
+		for (size_t i = 0; i < TRS_COUNT; i++) {
+			mats[i] = mat4::translate_hmg(aos[i])
+				* mat3::rotate_xyz(aos[i].x, aos[i].y, aos[i].z).hmg()
+				* mat4::diag(aos[i].x, aos[i].y, aos[i].z, 1.0f);
+		}
+		return mats[TRS_COUNT - 1];
+	};
+	BENCHMARK("build 64K TRS matrices (batch)") {
+		math::batch::build_trs(trsIn, trsIn, trsIn, mats);
+		return mats[TRS_COUNT - 1];
+	};
+}
+
+TEST_CASE("Benchmark quaternions", "[.][benchmark]") {
+	quat a = quat::rotate_xyz(0.1f, 0.2f, 0.3f);
+	quat b = quat::axis_angle(vec3(0, 0.6f, 0.8f), 0.9f);
+	mat3 ma = a.to_mat3();
+	mat3 mb = b.to_mat3();
+	vec3 angles = { 0.1f, 0.2f, 0.3f };
+
+	BENCHMARK("quat * quat") {
+		a = a * b;
+		return a;
+	};
+	BENCHMARK("mat3 * mat3") {
+		ma = ma * mb;
+		return ma;
+	};
+	BENCHMARK("slerp") {
+		return slerp(a, b, 0.3f);
+	};
+	BENCHMARK("nlerp") {
+		return nlerp(a, b, 0.3f);
+	};
+	// What Entity::bake_world_transform costs per entity, before and after
+	BENCHMARK("rotation from angles (rotate_xyz)") {
+		return mat3::rotate_xyz(angles.x, angles.y, angles.z).hmg();
+	};
+	BENCHMARK("rotation from quaternion (to_mat4)") {
+		return b.to_mat4();
+	};
+}
+
+// Divide the count by the reported time to get boxes per microsecond;
+// e.g. 64K boxes in 100us is ~650 boxes/us.
+TEST_CASE("Benchmark frustum culling", "[.][benchmark]") {
+	constexpr size_t COUNT = 1 << 16;
+	mat4 proj = {
+		0, -1, 0, 0,
+		0, 0, 1.7f, 0,
+		-1.005f, 0, 0, -1.0f,
+		1, 0, 0, 0
+	};
+	Frustum frustum = Frustum::from_view_proj(proj * mat3::rotate_xyz(0.0f, 0.3f, 0.7f).hmg().transpose());
+	std::vector<float> minX(COUNT), minY(COUNT), minZ(COUNT), maxX(COUNT), maxY(COUNT), maxZ(COUNT), radii(COUNT);
+	std::vector<AABB> boxes(COUNT);
+	std::vector<uint8_t> visible(COUNT);
+	for (size_t i = 0; i < COUNT; i++) {
+		float f = static_cast<float>(i);
+		vec3 c = { 200.0f * std::sin(f * 0.37f), 200.0f * std::sin(f * 0.91f), 200.0f * std::cos(f * 0.13f) };
+		boxes[i] = AABB::from_center_extents(c, vec3(1, 2, 3));
+		minX[i] = boxes[i].min.x; minY[i] = boxes[i].min.y; minZ[i] = boxes[i].min.z;
+		maxX[i] = boxes[i].max.x; maxY[i] = boxes[i].max.y; maxZ[i] = boxes[i].max.z;
+		radii[i] = 3.0f;
+	}
+	math::batch::csoa3 mins = { minX, minY, minZ };
+	math::batch::csoa3 maxs = { maxX, maxY, maxZ };
+
+	BENCHMARK("64K boxes (Frustum::intersects loop)") {
+		size_t n = 0;
+		for (size_t i = 0; i < COUNT; i++) {
+			visible[i] = frustum.intersects(boxes[i]);
+			n += visible[i];
+		}
+		return n;
+	};
+	BENCHMARK("64K boxes (batch)") {
+		return math::batch::frustum_cull(frustum, mins, maxs, visible);
+	};
+	BENCHMARK("64K spheres (batch)") {
+		return math::batch::frustum_cull(frustum, mins, radii, visible);
+	};
+}
@@ -0,0 +1,127 @@
+#include <vector>
+#include <catch2/catch_test_macros.hpp>
+#include <stb/stb_image.h>
+#include "terrapainter/png_encoder.h"
+#include "terrapainter/thread_pool.h"
+#include "test_helpers.h"
+
+using test::noise;
+
+namespace {
+	// Encodes `pixels`, handing them over `rowsPerCall` rows at a time
+	std::vector<uint8_t> encode(const std::vector<uint8_t>& pixels, size_t w, size_t h, size_t channels, size_t rowsPerCall,
+		PngEncoder::Level level = PngEncoder::Level::DEFAULT, ThreadPool* pool = nullptr) {
+		return test::encode_rows<PngEncoder>(pixels, w * channels, rowsPerCall, w, h, channels, level, pool);
+	}
+	void require_round_trip(const std::vector<uint8_t>& pixels, size_t w, size_t h, size_t channels, size_t rowsPerCall = 1,
+		PngEncoder::Level level = PngEncoder::Level::DEFAULT, ThreadPool* pool = nullptr) {
+		auto file = encode(pixels, w, h, channels, rowsPerCall, level, pool);
+		int dw, dh, dc;
+		uint8_t* decoded = stbi_load_from_memory(file.data(), int(file.size()), &dw, &dh, &dc, int(channels));
+		REQUIRE(decoded);
+		REQUIRE(size_t(dw) == w);
+		REQUIRE(size_t(dh) == h);
+		REQUIRE(size_t(dc) == channels);
+		std::vector<uint8_t> result(decoded, decoded + pixels.size());
+		stbi_image_free(decoded);
+		REQUIRE(result == pixels);
+	}
+}
+
+TEST_CASE("PNG encoder round trips through stb_image", "[png_encoder]") {
+	SECTION("Every channel count, odd sizes") {
+		for (size_t channels : { 1, 2, 3, 4 }) {
+			for (size_t w : { 1, 7, 130 }) {
+				size_t h = 9;
+				std::vector<uint8_t> pixels(w * h * channels);
+				for (size_t i = 0; i < pixels.size(); i++) pixels[i] = static_cast<uint8_t>(i * 7 + i / 13);
+				require_round_trip(pixels, w, h, channels);
+			}
+		}
+	}
+	SECTION("Noise, in uneven batches of rows") {
+		require_round_trip(noise(200 * 150 * 4), 200, 150, 4, 17);
+	}
+	SECTION("Matches reach back across rows, in several bands") {
+		// 64 rows to a band, so this is two and a half of them, deflated
+		// separately, with their Adler-32s combined into the stream's
+		size_t w = 4096, h = 160;
+		std::vector<uint8_t> pixels(w * h * 4);
+		auto pattern = noise(w * 4);
+		for (size_t y = 0; y < h; y++) {
+			for (size_t i = 0; i < w * 4; i++) pixels[y * w * 4 + i] = uint8_t(pattern[(i + y * 12) % (w * 4)] ^ (y & 1));
+		}
+		require_round_trip(pixels, w, h, 4, 5);
+	}
+}
+
+TEST_CASE("PNG encoder bands join up", "[png_encoder]") {
+	// Several bands, the last one short, with rows spanning batches
+	size_t w = 700, h = 1300;
+	std::vector<uint8_t> pixels(w * h * 4);
+	auto pattern = noise(w * 4);
+	for (size_t y = 0; y < h; y++) {
+		for (size_t i = 0; i < w * 4; i++) pixels[y * w * 4 + i] = uint8_t(pattern[i] + (i < 400 ? y : 0));
+	}
+	REQUIRE(w * h * 4 > 3 * PngEncoder::BAND_BYTES);
+	ThreadPool pool(3);
+	for (auto level : { PngEncoder::Level::FAST, PngEncoder::Level::DEFAULT }) {
+		require_round_trip(pixels, w, h, 4, 97, level);
+		require_round_trip(pixels, w, h, 4, 97, level, &pool);
+		// Bands don't depend on the order the threads finish in
+		REQUIRE(encode(pixels, w, h, 4, 97, level, &pool) == encode(pixels, w, h, 4, 5, level));
+	}
+}
+
+TEST_CASE("PNG encoder writes 16 bit heightmaps", "[png_encoder]") {
+	for (size_t channels : { 1, 4 }) {
+		size_t w = 300, h = 40;
+		std::vector<uint16_t> heights(w * h * channels);
+		for (size_t i = 0; i < heights.size(); i++) heights[i] = uint16_t(i * 977 + i / 5);
+		// Given big endian
+		std::vector<uint8_t> bytes;
+		for (uint16_t height : heights) {
+			bytes.push_back(uint8_t(height >> 8));
+			bytes.push_back(uint8_t(height));
+		}
+		auto file = test::encode_rows<PngEncoder>(bytes, w * channels * 2, h, w, h, channels, PngEncoder::Level::DEFAULT, nullptr, 16);
+
+		REQUIRE(stbi_is_16_bit_from_memory(file.data(), int(file.size())));
+		int dw, dh, dc;
+		uint16_t* decoded = stbi_load_16_from_memory(file.data(), int(file.size()), &dw, &dh, &dc, int(channels));
+		REQUIRE(decoded);
+		std::vector<uint16_t> result(decoded, decoded + heights.size());
+		stbi_image_free(decoded);
+		REQUIRE(result == heights);
+	}
+}
+
+TEST_CASE("PNG encoder compresses", "[png_encoder]") {
+	size_t w = 512, h = 512;
+	std::vector<uint8_t> flat(w * h * 4, 0);
+	for (size_t i = 0; i < flat.size(); i += 4) {
+		flat[i] = 40; flat[i + 1] = 90; flat[i + 2] = 200; flat[i + 3] = 255;
+	}
+	REQUIRE(encode(flat, w, h, 4, 64).size() < flat.size() / 100);
+
+	std::vector<uint8_t> gradient(w * h);
+	for (size_t y = 0; y < h; y++) {
+		for (size_t x = 0; x < w; x++) gradient[y * w + x] = static_cast<uint8_t>((x + y) / 4);
+	}
+	REQUIRE(encode(gradient, w, h, 1, 64).size() < gradient.size() / 20);
+}
+
+TEST_CASE("PNG encoder stops when the sink fails", "[png_encoder]") {
+	size_t calls = 0;
+	PngEncoder encoder([&](std::span<const uint8_t>) {
+		calls++;
+		return false;
+	}, 512, 1024, 4);
+	// A whole band, so it's written out (too big to be held back) right away
+	auto pixels = noise(512 * 512 * 4);
+	REQUIRE_FALSE(encoder.write_rows(pixels));
+	REQUIRE_FALSE(encoder.write_rows(pixels));
+	REQUIRE_FALSE(encoder.finish());
+	// Nothing is written after the first refusal
+	REQUIRE(calls == 1);
+}
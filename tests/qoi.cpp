@@ -0,0 +1,74 @@
+#include <vector>
+#include <catch2/catch_test_macros.hpp>
+#include "terrapainter/qoi.h"
+#include "test_helpers.h"
+
+namespace {
+	std::vector<uint8_t> encode(const std::vector<uint8_t>& pixels, size_t w, size_t h, size_t channels) {
+		// Uneven batches of rows
+		return test::encode_rows<QoiEncoder>(pixels, w * channels, 3, w, h, channels);
+	}
+	void require_round_trip(const std::vector<uint8_t>& pixels, size_t w, size_t h, size_t channels) {
+		auto file = encode(pixels, w, h, channels);
+		size_t dw, dh;
+		std::vector<uint8_t> decoded;
+		REQUIRE(QoiEncoder::decode(file, dw, dh, decoded));
+		REQUIRE(dw == w);
+		REQUIRE(dh == h);
+		// Always decoded as RGBA
+		std::vector<uint8_t> expected;
+		for (size_t i = 0; i < w * h; i++) {
+			for (size_t c = 0; c < 4; c++) expected.push_back(c < channels ? pixels[i * channels + c] : 255);
+		}
+		REQUIRE(decoded == expected);
+	}
+}
+
+TEST_CASE("QOI round trips", "[qoi]") {
+	SECTION("Every op") {
+		for (size_t channels : { 3, 4 }) {
+			size_t w = 67, h = 13;
+			std::vector<uint8_t> pixels(w * h * channels);
+			test::Lcg rng(99);
+			for (size_t i = 0; i < w * h; i++) {
+				uint32_t state = rng.next();
+				uint8_t* px = &pixels[i * channels];
+				switch ((state >> 28) % 5) {
+				// Runs, longer than one op can hold
+				case 0: if (i > 0) std::copy(px - channels, px, px); break;
+				// Small & medium differences
+				case 1: for (size_t c = 0; c < channels; c++) px[c] = i > 0 ? uint8_t(px[c - channels] + 1) : 0; break;
+				case 2: for (size_t c = 0; c < channels; c++) px[c] = i > 0 ? uint8_t(px[c - channels] + 20 + c) : 0; break;
+				// Recurring colors, for the index
+				case 3: for (size_t c = 0; c < channels; c++) px[c] = uint8_t(c * 60 + (state >> 30) * 5); break;
+				default: for (size_t c = 0; c < channels; c++) px[c] = uint8_t(state >> (c * 6)); break;
+				}
+			}
+			for (size_t i = 300; i < 500; i++) std::copy(&pixels[299 * channels], &pixels[300 * channels], &pixels[i * channels]);
+			require_round_trip(pixels, w, h, channels);
+		}
+	}
+	SECTION("Flat color is tiny") {
+		std::vector<uint8_t> pixels(256 * 256 * 4, 128);
+		require_round_trip(pixels, 256, 256, 4);
+		REQUIRE(encode(pixels, 256, 256, 4).size() < pixels.size() / 200);
+	}
+}
+
+TEST_CASE("QOI rejects bad input", "[qoi]") {
+	std::vector<uint8_t> pixels(16 * 16 * 4);
+	for (size_t i = 0; i < pixels.size(); i++) pixels[i] = static_cast<uint8_t>(i * 31);
+	auto file = encode(pixels, 16, 16, 4);
+	size_t w, h;
+	std::vector<uint8_t> decoded;
+	// Truncated
+	REQUIRE_FALSE(QoiEncoder::decode(std::span(file).first(file.size() / 2), w, h, decoded));
+	// Not a QOI file
+	auto wrongMagic = file;
+	wrongMagic[0] = 'x';
+	REQUIRE_FALSE(QoiEncoder::decode(wrongMagic, w, h, decoded));
+	// Absurd dimensions
+	auto huge = file;
+	huge[4] = huge[8] = 0x7F;
+	REQUIRE_FALSE(QoiEncoder::decode(huge, w, h, decoded));
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <span>
+#include <utility>
+#include <vector>
+#include <catch2/catch_test_macros.hpp>
+
+// Fixtures shared by the encoder & codec tests
+namespace test {
+	// A tiny LCG (Numerical Recipes' constants), so the "random" data is the
+	// same every run and failures reproduce
+	class Lcg {
+		uint32_t mState;
+	public:
+		explicit Lcg(uint32_t seed) : mState(seed) {}
+		uint32_t next() {
+			mState = mState * 1664525u + 1013904223u;
+			return mState;
+		}
+	};
+
+	// `count` bytes of noise. The low bits of an LCG are poor, so it's the top byte.
+	inline std::vector<uint8_t> noise(size_t count, uint32_t seed = 777) {
+		std::vector<uint8_t> bytes(count);
+		Lcg rng(seed);
+		for (auto& b : bytes) b = uint8_t(rng.next() >> 24);
+		return bytes;
+	}
+
+	// Runs a streaming encoder (PngEncoder, QoiEncoder, HeightmapEncoder) over
+	// `rows`, which hold whole rows of `rowLength` values in the order the file
+	// stores them, handing them over `rowsPerCall` rows at a time. `args` are
+	// the encoder's constructor arguments after the sink. Returns the file.
+	template<typename Encoder, typename T, typename... Args>
+	std::vector<uint8_t> encode_rows(const std::vector<T>& rows, size_t rowLength, size_t rowsPerCall, Args&&... args) {
+		std::vector<uint8_t> file;
+		Encoder encoder([&](std::span<const uint8_t> bytes) {
+			file.insert(file.end(), bytes.begin(), bytes.end());
+			return true;
+		}, std::forward<Args>(args)...);
+		size_t batch = rowsPerCall * rowLength;
+		for (size_t offset = 0; offset < rows.size(); offset += batch) {
+			REQUIRE(encoder.write_rows(std::span(rows).subspan(offset, std::min(batch, rows.size() - offset))));
+		}
+		REQUIRE(encoder.finish());
+		return file;
+	}
+}
@@ -0,0 +1,69 @@
+#include <vector>
+#include <catch2/catch_test_macros.hpp>
+#include "terrapainter/tile_codec.h"
+#include "test_helpers.h"
+
+namespace {
+	void require_round_trip(const std::vector<uint8_t>& pixels, size_t w, size_t h, size_t channels) {
+		auto encoded = tile_codec::encode(pixels, w, h, channels);
+		std::vector<uint8_t> decoded(pixels.size(), 0xCD);
+		REQUIRE(tile_codec::decode(encoded, decoded, w, h, channels));
+		REQUIRE(decoded == pixels);
+	}
+}
+
+TEST_CASE("Tile codec round trips", "[tile_codec]") {
+	SECTION("Empty") {
+		require_round_trip({}, 0, 0, 4);
+	}
+	SECTION("Flat color compresses well") {
+		std::vector<uint8_t> pixels(64 * 64 * 4);
+		for (size_t i = 0; i < pixels.size(); i += 4) {
+			pixels[i] = 12; pixels[i + 1] = 200; pixels[i + 2] = 7; pixels[i + 3] = 255;
+		}
+		require_round_trip(pixels, 64, 64, 4);
+		REQUIRE(tile_codec::encode(pixels, 64, 64, 4).size() < pixels.size() / 20);
+	}
+	SECTION("Gradients compress well") {
+		std::vector<uint8_t> pixels(64 * 64);
+		for (size_t y = 0; y < 64; y++) {
+			for (size_t x = 0; x < 64; x++) pixels[y * 64 + x] = static_cast<uint8_t>(x * 3 + y);
+		}
+		require_round_trip(pixels, 64, 64, 1);
+		REQUIRE(tile_codec::encode(pixels, 64, 64, 1).size() < pixels.size() / 10);
+	}
+	SECTION("Noise survives, odd sizes") {
+		for (size_t channels : { 1, 2, 4 }) {
+			for (size_t w : { 1, 3, 64, 130 }) {
+				size_t h = 5;
+				std::vector<uint8_t> pixels(w * h * channels);
+				test::Lcg rng(12345);
+				for (auto& p : pixels) {
+					uint32_t state = rng.next();
+					// Mix in some runs so literal and repeat chunks interleave
+					p = (state >> 28) < 6 ? 0 : static_cast<uint8_t>(state >> 24);
+				}
+				require_round_trip(pixels, w, h, channels);
+			}
+		}
+	}
+	SECTION("Long runs and literals split across control bytes") {
+		std::vector<uint8_t> pixels(1000, 0);
+		for (size_t i = 400; i < 700; i++) pixels[i] = static_cast<uint8_t>(i * 37);
+		require_round_trip(pixels, 1000, 1, 1);
+	}
+}
+
+TEST_CASE("Tile codec rejects bad input", "[tile_codec]") {
+	std::vector<uint8_t> pixels(16 * 16 * 4, 9);
+	auto encoded = tile_codec::encode(pixels, 16, 16, 4);
+	std::vector<uint8_t> decoded(pixels.size());
+	// Wrong output size
+	REQUIRE_FALSE(tile_codec::decode(encoded, std::span(decoded).first(100), 16, 16, 4));
+	// Truncated
+	REQUIRE_FALSE(tile_codec::decode(std::span(encoded).first(encoded.size() - 1), decoded, 16, 16, 4));
+	// Too much data
+	encoded.push_back(0);
+	encoded.push_back(0);
+	REQUIRE_FALSE(tile_codec::decode(encoded, decoded, 16, 16, 4));
+}